@@ -0,0 +1,62 @@
+# Compiles an example to assembly and checks the shape of its loops.
+#   cmake -DJYNXC=<jynxc> -DSOURCE=<file.jx> -DLEVEL=<-O0|-O1|-O2>
+#         -DWORK=<dir> -P check_loops.cmake
+# Only loop headers are aligned, and each one is jumped back to by a single
+# conditional branch at the bottom of the loop, which falls through to the
+# exit rather than jumping again.
+
+get_filename_component(name "${SOURCE}" NAME_WE)
+set(output "${WORK}/${name}_loops${LEVEL}.s")
+
+execute_process(COMMAND "${JYNXC}" ${LEVEL} -S "${output}" "${SOURCE}"
+                RESULT_VARIABLE status OUTPUT_QUIET ERROR_QUIET)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "${name}: compiling failed (${status})")
+endif()
+
+file(STRINGS "${output}" lines)
+list(LENGTH lines count)
+set(headers 0)
+set(aligned FALSE)
+set(index 0)
+foreach(line IN LISTS lines)
+  if(line MATCHES "^    \\.p2align")
+    set(aligned TRUE)
+  elseif(aligned AND line MATCHES "^(\\.L[0-9_]+):$")
+    set(aligned FALSE)
+    set(header "${CMAKE_MATCH_1}")
+    math(EXPR headers "${headers} + 1")
+
+    # every jump to the header comes after it
+    set(back 0)
+    set(at ${index})
+    foreach(later RANGE ${index} ${count})
+      if(later EQUAL count)
+        break()
+      endif()
+      list(GET lines ${later} jump)
+      if(jump MATCHES "^    (j[a-z]+) ${header}$")
+        math(EXPR back "${back} + 1")
+        set(op "${CMAKE_MATCH_1}")
+        set(at ${later})
+      endif()
+    endforeach()
+    if(NOT back EQUAL 1 OR op STREQUAL "jmp")
+      message(FATAL_ERROR
+              "${name}: ${header} is not closed by one conditional branch")
+    endif()
+    math(EXPR after "${at} + 1")
+    if(after LESS count)
+      list(GET lines ${after} next)
+      if(next MATCHES "^    jmp ")
+        message(FATAL_ERROR "${name}: the branch back to ${header} is "
+                            "followed by another jump")
+      endif()
+    endif()
+  endif()
+  math(EXPR index "${index} + 1")
+endforeach()
+
+if(headers EQUAL 0)
+  message(FATAL_ERROR "${name}: no loop header found")
+endif()
@@ -0,0 +1,33 @@
+# Compiles and runs an example, failing unless it exits with EXPECTED.
+#   cmake -DJYNXC=<jynxc> -DSOURCE=<file.jx> -DMODE=<native|run|vm|jxb>
+#         -DLEVEL=<-O0|-O1|-O2> -DEXPECTED=<status> -DWORK=<dir>
+#         -P run_example.cmake
+# native writes an ELF executable and runs it, run and vm use --run and
+# --vm, and jxb writes bytecode and runs the file it wrote.
+
+get_filename_component(name "${SOURCE}" NAME_WE)
+set(base "${WORK}/${name}_${MODE}${LEVEL}")
+
+if(MODE STREQUAL "native" OR MODE STREQUAL "jxb")
+  if(MODE STREQUAL "native")
+    set(output -o "${base}")
+    set(program "${base}")
+  else()
+    set(output --jxb "${base}.jxb")
+    set(program "${JYNXC}" "${base}.jxb")
+  endif()
+  execute_process(COMMAND "${JYNXC}" ${LEVEL} ${output} "${SOURCE}"
+                  RESULT_VARIABLE status OUTPUT_QUIET ERROR_QUIET)
+  if(NOT status EQUAL 0)
+    message(FATAL_ERROR "${name}: compiling failed (${status})")
+  endif()
+  execute_process(COMMAND ${program}
+                  RESULT_VARIABLE status OUTPUT_QUIET ERROR_QUIET)
+else()
+  execute_process(COMMAND "${JYNXC}" ${LEVEL} --${MODE} "${SOURCE}"
+                  RESULT_VARIABLE status OUTPUT_QUIET ERROR_QUIET)
+endif()
+
+if(NOT status STREQUAL EXPECTED)
+  message(FATAL_ERROR "${name}: exited with ${status}, expected ${EXPECTED}")
+endif()
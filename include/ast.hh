@@ -6,7 +6,6 @@
 #include <vector>
 
 #include "log.hh"
-#include "scope.hh"
 #include "symbol.hh"
 #include "token.hh"
 #include "type.hh"
@@ -47,18 +46,14 @@ union NodeSemanticData {
     const Type* source_type;
     const Type* target_type;
   } cast;
-
-  Scope* scope;
 };
 
 struct SemanticInfo {
   const Type* declared_type = nullptr;
-  bool is_lvalue;
-  bool is_constant;
-
-  Scope* scope;
+  bool is_lvalue = false;
+  bool is_constant = false;
 
-  NodeSemanticData data;
+  NodeSemanticData data{};
 };
 
 struct CodegenInfo {
@@ -298,7 +293,7 @@ struct ConstructorDeclNode : ClassMemberNode {
 };
 
 struct NodeInfo {
-  std::unique_ptr<Symbol> sym;
+  Symbol* sym = nullptr;
   const Type* resolved_type = nullptr;
   std::string type_name;
 
@@ -308,7 +303,7 @@ struct NodeInfo {
 
   size_t param_index = 0;
 
-  std::vector<Symbol> overload_set;
+  std::vector<FunctionSymbol*> overload_set;
 };
 
 #endif  // AST_H_
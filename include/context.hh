@@ -2,10 +2,12 @@
 #define CONTEXT_H_
 
 #include "array_type.hh"
+#include "interner.hh"
 #include "methodtable.hh"
 #include "pointer_type.hh"
 #include "primitive_type.hh"
 #include "scope.hh"
+#include "symbol_arena.hh"
 #include "trie.hh"
 #include "type.hh"
 
@@ -13,7 +15,6 @@ class CompilerContext {
  public:
   CompilerContext();
 
-  std::unordered_map<std::string, Symbol> symbol_table;
   MethodTable method_table;
   KeywordTrie keywords;
 
@@ -32,10 +33,12 @@ class CompilerContext {
                       const std::string& message,
                       const SourceLocation& location);
 
-  void push_scope();
-  void pop_scope();
-  Scope* get_current_scope() const { return current_scope; }
-  void set_current_scope(Scope* scope) { current_scope = scope; }
+  NameId intern(const std::string& name) { return names.intern(name); }
+  const std::string& name_of(NameId id) const { return names.name(id); }
+
+  void push_scope() { scopes.enter_scope(); }
+  void pop_scope() { scopes.exit_scope(); }
+  size_t scope_depth() const { return scopes.depth(); }
 
   Symbol* declare(const std::string& name, const Type* type,
                   SourceLocation loc);
@@ -45,17 +48,25 @@ class CompilerContext {
                           const std::vector<const Type*> param_types,
                           SourceLocation loc);
 
-  Symbol* lookup(const std::string& name, bool walkParent = true);
-  Symbol* lookup(const std::string& name, Scope* startingScope,
-                 bool walkParent = true);
+  /// Makes an already declared symbol visible in the current scope again,
+  /// used by passes that replay the scopes the collector built
+  bool bind(Symbol* symbol);
+
+  Symbol* lookup(NameId name) const { return scopes.lookup(name); }
+  Symbol* lookup(const std::string& name) const;
+  Symbol* lookup_local(NameId name) const { return scopes.lookup_local(name); }
+
+  Symbol* get_symbol(SymbolId id) const { return symbols.get(id); }
+  size_t symbol_count() const { return symbols.size(); }
 
  private:
   std::vector<std::string> errors;
 
   std::vector<std::unique_ptr<Type>> type_storage;
-  std::vector<std::unique_ptr<Scope>> scope_storage;
+  SymbolArena symbols;
 
-  Scope* current_scope = nullptr;
+  NameInterner names;
+  ScopeTable scopes;
 
   const PrimitiveType* int32_type = nullptr;
   const PrimitiveType* bool_type = nullptr;
@@ -73,6 +84,10 @@ class CompilerContext {
     type_storage.push_back(std::move(ptr));
     return raw;
   }
+
+  template <typename T>
+  T* create_symbol(const std::string& name, const Type* type,
+                   SourceLocation loc);
 };
 
 #endif  // CONTEXT_H_
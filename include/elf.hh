@@ -0,0 +1,14 @@
+#ifndef ELF_H_
+#define ELF_H_
+
+#include <string>
+
+#include "encoder.hh"
+
+/// Writes a static ELF64 executable for x86-64 Linux: text and rodata in
+/// segments of their own, rip-relative references resolved against their
+/// final addresses and the entry point at _start. Returns false if the
+/// file cannot be written.
+bool write_executable(const std::string& path, x86::Image image);
+
+#endif  // ELF_H_
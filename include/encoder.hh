@@ -0,0 +1,39 @@
+#ifndef ENCODER_H_
+#define ENCODER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "x86.hh"
+
+namespace x86 {
+
+/// Machine code for a program, laid out as if text and rodata were loaded
+/// at offset zero. References from text into rodata stay as relocations
+/// until the final addresses are known.
+struct Image {
+  // a rip-relative disp32 at text[offset], measured from the end of its
+  // instruction at text offset next, to rodata[target]
+  struct Relocation {
+    uint32_t offset;
+    uint32_t next;
+    uint32_t target;
+  };
+
+  std::vector<uint8_t> text;
+  std::vector<uint8_t> rodata;
+  std::vector<Relocation> relocations;
+  std::vector<uint32_t> symbols;  // text offset of each Program symbol
+  uint32_t entry = 0;             // text offset of _start
+
+  // patches the relocations for text and rodata loaded at these addresses
+  void relocate(uint64_t text_address, uint64_t rodata_address);
+};
+
+/// Encodes every instruction from a table of opcode forms. Branches start
+/// out short and are widened until all targets are in range.
+Image encode(const Program& program);
+
+}  // namespace x86
+
+#endif  // ENCODER_H_
@@ -1,425 +1,131 @@
 #ifndef GEN_H_
 #define GEN_H_
 
-#include <unistd.h>
+#include <initializer_list>
+#include <span>
+#include <vector>
 
-#include <algorithm>
-#include <stdexcept>
-#include <string>
-#include <unordered_map>
-#include <unordered_set>
-#include <utility>
+#include "ir/ir.hh"
+#include "regalloc.hh"
+#include "x86.hh"
 
-#include "ast.hh"
-#include "log.hh"
-#include "token.hh"
-#include "visitor/visitor.hh"
-
-typedef struct Scope_ {
-  int stack_offset_start;
-  std::unordered_map<std::string, int> stack_offsets;
-  std::unordered_map<std::string, std::pair<int, int>> string_var_slots;
-} Scope_;
-
-class CodeGenerator : public ASTVisitor {
+/// x86-64 machine instructions for an IR module. Virtual registers are
+/// placed by the linear scan allocator; rax, rdx and r11 are scratch.
+class CodeGenerator {
  public:
-  explicit CodeGenerator(CompilerContext& ctx) : ASTVisitor(ctx) {
-    setupRegisters();
-  }
-  virtual ~CodeGenerator() = default;
+  CodeGenerator() = default;
 
-  std::string generate(const ProgramNode& root);
+  x86::Program generate(const ir::Module& module);
 
  private:
-  void generateStatement(StmtNode& stmt);
-  void generateExpression(ExprNode& expr);
-
-  void generateProgram(ProgramNode& node);
-  void generateBlock(BlockNode& node);
-  void generateVarDecl(VarDeclNode& node);
-  void generateIfStmt(IfStmtNode& node);
-  void generateWhileStmt(WhileStmtNode& node);
-  void generateReturn(ReturnStmtNode& node);
-  void generateExprStmt(ExprStmtNode& node);
-  void generateMethodDecl(MethodDeclNode& node);
-
-  void generateBinaryExpr(BinaryExprNode& node);
-  void generateUnaryExpr(UnaryExprNode& node);
-  void generateLiteralExpr(LiteralExprNode& node);
-  void generateIdentifierExpr(IdentifierExprNode& node);
-  void generateAssignmentExpr(AssignmentExprNode& node);
-  void generateMethodCall(MethodCallNode& node);
-  void generateArgument(ArgumentNode& node);
-
-  struct IfContext {
-    std::string false_label;
-    std::string end_label;
-    bool has_else;
-  };
-
-  struct WhileContext {
-    std::string start_label;
-    std::string end_label;
-  };
-
-  std::vector<IfContext> if_stack;
-  std::vector<WhileContext> while_stack;
-
-  void emit(const std::string& instruction) {
-    text_section << "    " << instruction << "\n";
-  }
-  void emitMove(const std::string& dst, const std::string& src) {
-    if ((contains(function_arg_registers64, dst) &&
-         contains(function_arg_registers32, src)) ||
-        (contains(caller_saved_registers64, dst) &&
-         contains(caller_saved_registers_abi32, src)))
-      emit("movsx " + dst + ", " + src);
-    else
-      emit("mov " + dst + ", " + src);
-  }
-  void emitArithmetic(const TokenType op, const std::string& left,
-                      const std::string& right, const std::string& dest) {
-    if (dest != left) emitMove(left, dest);
-
-    switch (op) {
-      case TokenType::TOKEN_PLUS:
-        emit("add " + dest + ", " + right);
-        break;
-      case TokenType::TOKEN_MINUS:
-        emit("sub " + dest + ", " + right);
-        break;
-      case TokenType::TOKEN_MULTIPLY:
-        emit("imul " + dest + ", " + right);
-        break;
-      case TokenType::TOKEN_DIVIDE:
-        if (dest != "rax") emitMove("rax", dest);
-        emit("cqo");
-        emit("idiv " + right);
-        if (dest != "rax" && dest != "rdx") emitMove(dest, "rax");
-        break;
-      default:
-        break;
-    }
-  }
-  void emitCompare(const std::string& left, const std::string& right) {
-    emit("cmp " + left + ", " + right);
-  }
-  void emitJump(const std::string& label) { emit("jmp " + label); }
-  void emitConditionalJump(const std::string& condition,
-                           const std::string& label) {
-    emit("j" + condition + " " + label);
-  }
-  void emitCall(const std::string& function) { emit("call " + function); }
-  void emitReturn() {
-    emit("leave");
-    emit("ret");
-  }
-  void emitLabel(const std::string& label) { text_section << label << ":\n"; }
-
-  // Emit a string literal into the rodata pool (deduplicated).
-  // contents are assumed to be already lexer-unescaped.
-  void poolStringLiteral(const std::string& contents) {
-    if (literal_pool_labels.find(contents) != literal_pool_labels.end()) return;
-    std::string label = generateLiteralLabel();
-    literal_pool_labels[contents] = label;
-    literal_pool_emission.emplace_back(label, contents);
-  }
-
-  // Write a single literal into the rodata section stream.
-  void emitRodataLiteral(const std::string& label,
-                         const std::string& contents) {
-    rodata_section << label << ":\n";
-    rodata_section << "   .ascii \"" << contents << "\"\n";
-    rodata_section << "   .byte 0\n";
-  }
-
-  // Print the string currently in RAX (ptr) and RDX (len) via Linux
-  // write(1,...).
-  void emitWriteCurrentString() {
-    // Preserve ptr from rax by moving to rsi as required by write syscall.
-    emit("mov rsi, rax");  // buf
-    emit("mov rax, 1");    // sys_write
-    emit("mov rdi, 1");    // fd = stdout
-    // rdx already holds len
-    emit("syscall");
-  }
-
-  // Allocate 16 bytes on the stack for a string descriptor (ptr,len) for
-  // variable 'name'. Returns pair of offsets: {ptrOffset, lenOffset} relative
-  // to rbp (positive integers used as [rbp-offset]).
-  std::pair<int, int> ensureStringVarSlots(const std::string& name) {
-    // First check if variable already exists in any scope
-    for (auto it = scope_stack.rbegin(); it != scope_stack.rend(); ++it) {
-      auto found = it->string_var_slots.find(name);
-      if (found != it->string_var_slots.end()) {
-        return found->second;
-      }
-    }
-
-    // Variable doesn't exist, allocate in current (innermost) scope
-    if (scope_stack.empty()) {
-      throw std::runtime_error("No scope available for string variable: " +
-                               name);
-    }
-
-    current_stack_offset += 16;
-    int lenOffset = current_stack_offset;      // [rbp-lenOffset]
-    int ptrOffset = current_stack_offset - 8;  // [rbp-ptrOffset]
-    emit("sub rsp, 16");
-
-    // Store in current scope
-    scope_stack.back().string_var_slots[name] = {ptrOffset, lenOffset};
-    return scope_stack.back().string_var_slots[name];
-  }
-
-  std::string allocateRegister(bool local, bool _32bit) {
-    std::string r;
-    std::vector<std::string>& regs =
-        _32bit ? caller_saved_registers32 : caller_saved_registers64;
-    if (local) {
-      if (regs.empty()) return "";
-      r = regs.back();
-      regs.pop_back();
-      live_regs.emplace(r);
-      LOG_DEBUG("[gen] emplacing {}", r);
-    } else {
-      return "";
-    }
-    return r;
-  }
-
-  void freeRegister(const std::string& reg) {
-    if (contains(caller_saved_registers_abi32, reg) &&
-        !contains(caller_saved_registers32, reg)) {
-      caller_saved_registers32.push_back(reg);
-    } else if (contains(caller_saved_registers_abi64, reg) &&
-               !contains(caller_saved_registers64, reg)) {
-      caller_saved_registers64.push_back(reg);
-    } else if (!contains(callee_saved_registers, reg)) {
-      callee_saved_registers.push_back(reg);
-    } else {
-      LOG_FATAL("[GEN] Unknown register freed");
-    }
-    live_regs.erase(reg);
-    LOG_DEBUG("[gen] erasing {}", reg);
-  }
-
-  static inline std::string ptrType(int size) {
-    if (size <= 8) return "byte ptr";
-    if (size <= 16) return "word ptr";
-    if (size <= 32) return "dword ptr";
-    if (size <= 64) return "qword ptr";
-    LOG_FATAL("128-bit sizes are not supported");
-    return "";
-  }
+  using Operand = x86::Operand;
+  using Opcode = x86::Opcode;
 
-  static std::string formatSlotOffset(int offset) {
-    if (offset > 0) return "+" + std::to_string(offset);
-    return std::to_string(offset);
-  }
-
-  static inline std::string formatSlot(int offset) {
-    return "[rbp-" + std::to_string(offset) + "]";
-  }
-
-  static inline std::string formatSlot(const VarDeclNode& node) {
-    return "[rbp" + formatSlotOffset(node.codegen.stack_offset) + "]";
-  }
-
-  static inline std::string formatSlot(const IdentifierExprNode& node) {
-    return "[rbp" + formatSlotOffset(node.codegen.stack_offset) + "]";
-  }
-
-  static inline std::string formatSlot(const ParamNode& node) {
-    return "[rbp" + formatSlotOffset(node.codegen.stack_offset) + "]";
-  }
-
-  static inline std::string formatStringLabel(std::string label) {
-    return "[rip+" + label + "]";
-  }
+  // loop heads start on a fetch block boundary
+  static constexpr int64_t kLoopAlignment = 16;
 
-  // Load a string literal into RAX (ptr) and RDX (len). Ensures the literal
-  // exists in rodata pool.
-  void loadStringLiteral(const std::string& contents) {
-    poolStringLiteral(contents);
-    const std::string& label = literal_pool_labels[contents];
-    emit("lea rax, " + formatStringLabel(label));
-    emit("mov rdx, " + std::to_string(contents.size()));
-  }
+  const ir::Module* module = nullptr;
+  const ir::Function* function = nullptr;
+  ir::FuncId function_id = 0;
+  ir::BlockId current_block = 0;
+  uint32_t current_inst = 0;
+  Allocation allocation;
 
-  // Store the current string in RAX/RDX to a named local variable slots.
-  void storeCurrentStringToVar(const std::string& name) {
-    auto [ptrOff, lenOff] = ensureStringVarSlots(name);
-    emit("mov QWORD PTR " + formatSlot(ptrOff) + ", rax");
-    emit("mov QWORD PTR " + formatSlot(lenOff) + ", rdx");
-  }
+  x86::Program program;
+  std::vector<uint32_t> function_labels;
+  std::vector<uint32_t> literal_labels;
+  std::vector<uint32_t> block_labels;  // of the current function
+  std::vector<uint32_t> stub_labels;   // parallel to allocation.stubs
 
-  // Load a string from a named local variable slots into RAX/RDX.
-  void loadStringFromVar(const std::string& name) {
-    // Search for string variable in scopes
-    for (auto it = scope_stack.rbegin(); it != scope_stack.rend(); ++it) {
-      auto found = it->string_var_slots.find(name);
-      if (found != it->string_var_slots.end()) {
-        auto [ptrOff, lenOff] = found->second;
-        emit("mov rax, QWORD PTR " + formatSlot(ptrOff));
-        emit("mov rdx, QWORD PTR " + formatSlot(lenOff));
-        return;
-      }
-    }
+  // scratch for parallel moves, reused so codegen does not allocate
+  std::vector<Move> pending_moves;
 
-    // If not found, treat as empty string (or could throw error)
-    loadStringLiteral("");
-  }
+  std::vector<uint32_t> use_counts;  // of the current function's registers
+  std::vector<bool> loop_heads;      // blocks of the current function
+  // branches and selects reading the flags of a compare before them rather
+  // than its boolean: per instruction of the current block, and per
+  // register the number of such readers
+  std::vector<bool> reads_flags;
+  std::vector<uint32_t> flag_readers;
+  x86::Cond flags_cc = x86::Cond::NE;  // set by the last compare
 
-  std::string getVariableLocation(const Token& var) {
-    // First check if variable already exists in any scope
-    for (auto it = scope_stack.rbegin(); it != scope_stack.rend(); ++it) {
-      auto found = it->stack_offsets.find(var.getValue());
-      if (found != it->stack_offsets.end()) {
-        return formatSlot(found->second);
-      }
-    }
+  void generateFunction(const ir::Function& fn);
+  void generateInst(const ir::Inst& inst);
+  void generateCall(const ir::Inst& inst);
+  void generateEntryPoint();
 
-    // Variable doesn't exist, allocate in current scope (like original
-    // behavior)
-    if (scope_stack.empty()) {
-      throw std::runtime_error("No scope available for variable: " +
-                               var.getValue());
-    }
+  void findFlagReaders(const ir::Block& block);
 
-    current_stack_offset += 8;  // 8-byte
-    emit("sub rsp, 8");
-    scope_stack.back().stack_offsets[var.getValue()] = current_stack_offset;
-    return formatSlot(current_stack_offset);
-  }
+  void emitPrologue();
+  void emitEpilogue();
 
-  void enter_scope() {
-    scope_stack.emplace_back();
-    scope_stack.back().stack_offset_start = current_stack_offset;
+  void emit(Opcode op, Operand dst = {}, Operand src = {}) {
+    program.text.push_back({.op = op, .dst = dst, .src = src});
   }
-
-  void exit_scope() {
-    if (scope_stack.empty()) return;
-
-    int bytes_allocated =
-        current_stack_offset - scope_stack.back().stack_offset_start;
-    if (bytes_allocated > 0) {
-      emit("add rsp, " + std::to_string(bytes_allocated));
-      current_stack_offset = scope_stack.back().stack_offset_start;
-    }
-
-    scope_stack.pop_back();
+  void emitCond(Opcode op, x86::Cond cc, Operand dst, Operand src = {}) {
+    program.text.push_back({.op = op, .cc = cc, .dst = dst, .src = src});
   }
-
-  // Check if a variable is a string type by searching scopes
-  bool isStringVariable(const std::string& name) {
-    for (auto it = scope_stack.rbegin(); it != scope_stack.rend(); ++it) {
-      if (it->string_var_slots.find(name) != it->string_var_slots.end()) {
-        return true;
-      }
-    }
-    return false;
+  void emitLabel(uint32_t label) {
+    emit(Opcode::Label, Operand::target(label));
   }
-
-  // Allocate a new scalar variable in current scope (for declarations)
-  std::string allocateVariableInCurrentScope(const std::string& name) {
-    if (scope_stack.empty()) {
-      throw std::runtime_error("No scope available for variable: " + name);
-    }
-
-    current_stack_offset += 8;  // 8-byte
-    emit("sub rsp, 8");
-    scope_stack.back().stack_offsets[name] = current_stack_offset;
-    return formatSlot(current_stack_offset);
+  void emitJump(ir::BlockId target) {
+    if (target != current_block + 1)
+      emit(Opcode::Jmp, Operand::target(block_labels[target]));
   }
 
-  inline static bool contains(const std::vector<std::string>& v,
-                              const std::string& item) {
-    return std::find(v.begin(), v.end(), item) != v.end();
+  void emitMove(const Location& to, const Location& from, bool wide);
+  // tests a boolean unless the current instruction reads the flags of the
+  // compare making it, returns the condition that means true
+  x86::Cond emitTest(ir::Reg cond);
+  void emitParallelMove(std::span<const Move> moves);
+  void emitParallelMove(std::initializer_list<Move> moves) {
+    emitParallelMove(std::span<const Move>(moves.begin(), moves.size()));
   }
 
-  bool isCallerSaved(const std::string& r) {
-    return contains(caller_saved_registers32, r) ||
-           contains(caller_saved_registers64, r);
-  }
+  // the value in a register, loaded into scratch if it lives on the stack
+  x86::Reg inRegister(const Location& location, x86::Reg scratch, bool wide);
 
-  void spill_live_regs(std::vector<std::string>& spilled) {
-    LOG_DEBUG("[gen] live regs count {}", live_regs.size());
-    for (const auto& reg : live_regs) {
-      if (reg == "rax" || !isCallerSaved(reg)) continue;
-      emit("push " + reg);
-      spilled.push_back(reg);
-    }
-  }
+  Location use(ir::Reg reg) const { return allocation.use(reg, current_inst); }
+  Location def(ir::Reg reg) const { return allocation.def(reg, current_inst); }
 
-  void restore_spilled(std::vector<std::string>& spilled) {
-    for (auto it = spilled.rbegin(); it != spilled.rend(); ++it)
-      emit("pop " + *it);
+  bool isWide(ir::Reg reg) const {
+    return ir::is_wide(function->reg_types[reg]);
   }
 
-  void setupRegisters() {
-    caller_saved_registers_abi64 = {"rax", "rcx", "rdx", "rsi", "rdi",
-                                    "r8",  "r9",  "r10", "r11"};
-    caller_saved_registers_abi32 = {"eax", "ecx", "edx",  "esi", "edi",
-                                    "r8d", "r9d", "r10d", "r11d"};
-
-    caller_saved_registers64 = {"rax", "rcx", "rdx", "rsi", "rdi",
-                                "r8",  "r9",  "r10", "r11"};
-    caller_saved_registers32 = {"eax", "ecx", "edx",  "esi", "edi",
-                                "r8d", "r9d", "r10d", "r11d"};
-
-    callee_saved_registers = {"rbx", "rbp", "r12", "r13", "r14", "r15"};
-
-    function_arg_registers_abi64 = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-    function_arg_registers_abi32 = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
-    function_arg_registers64 = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-    function_arg_registers32 = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
+  // saved callee registers come first in the frame, then the spill slots
+  static Operand slot(size_t index, uint8_t size) {
+    return Operand::mem(x86::rbp, -8 * static_cast<int32_t>(index + 1),
+                        size);
   }
-
-  std::stringstream text_section;
-  std::stringstream rodata_section;
-
-  std::vector<Scope_> scope_stack;
-  int current_stack_offset = 0;
-
-  std::vector<std::string> caller_saved_registers_abi32;
-  std::vector<std::string> caller_saved_registers_abi64;
-  std::vector<std::string> function_arg_registers_abi32;
-  std::vector<std::string> function_arg_registers_abi64;
-
-  std::vector<std::string> caller_saved_registers32;
-  std::vector<std::string> caller_saved_registers64;
-  std::vector<std::string> callee_saved_registers;
-  std::vector<std::string> function_arg_registers32;
-  std::vector<std::string> function_arg_registers64;
-
-  std::unordered_set<std::string> live_regs;
-  std::unordered_map<std::string, int> spill_slots;
-
-  std::unordered_map<std::string, std::string> literal_pool_labels;
-  std::vector<std::pair<std::string, std::string>> literal_pool_emission;
-  std::vector<std::string> eval_stack;
-  int label_counter = 0;
-
-  inline std::string generateUniqueLabel(const std::string& prefix = "L") {
-    return prefix + std::to_string(++label_counter);
+  Operand operand(const Location& location, bool wide) const {
+    uint8_t size = wide ? 8 : 4;
+    if (location.is_reg()) return Operand::r(location.reg, size);
+    return slot(allocation.callee_saved.size() + location.slot, size);
   }
 
-  inline std::string generateLiteralLabel() {
-    return generateUniqueLabel(".LC");
+  // where a branch from the current block to target has to go
+  uint32_t edgeLabel(ir::BlockId target) const {
+    for (size_t i = 0; i < allocation.stubs.size(); ++i)
+      if (allocation.stubs[i].from == current_block &&
+          allocation.stubs[i].to == target)
+        return stub_labels[i];
+    return block_labels[target];
   }
 
-  bool isComparisonOp(TokenType op) {
+  static x86::Cond conditionCode(ir::Op op) {
     switch (op) {
-      case TokenType::TOKEN_DEQ:
-      case TokenType::TOKEN_NEQ:
-      case TokenType::TOKEN_GEQ:
-      case TokenType::TOKEN_GT:
-      case TokenType::TOKEN_LEQ:
-      case TokenType::TOKEN_LT:
-        return true;
+      case ir::Op::Ne:
+        return x86::Cond::NE;
+      case ir::Op::Lt:
+        return x86::Cond::L;
+      case ir::Op::Le:
+        return x86::Cond::LE;
+      case ir::Op::Gt:
+        return x86::Cond::G;
+      case ir::Op::Ge:
+        return x86::Cond::GE;
       default:
-        return false;
+        return x86::Cond::E;
     }
   }
 };
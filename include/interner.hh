@@ -0,0 +1,42 @@
+#ifndef INTERNER_H_
+#define INTERNER_H_
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using NameId = uint32_t;
+
+constexpr NameId kInvalidName = UINT32_MAX;
+// the empty name is always interned first, so it doubles as the "global" owner
+constexpr NameId kEmptyName = 0;
+
+/// Maps identifier spellings to dense ids. Uses an open-addressing table with
+/// linear probing, so a lookup is one hash plus (usually) one string compare.
+class NameInterner {
+ public:
+  NameInterner();
+
+  NameId intern(std::string_view name);
+
+  /// Returns kInvalidName if the name has never been interned
+  NameId find(std::string_view name) const;
+
+  const std::string& name(NameId id) const { return names[id]; }
+  size_t size() const { return names.size(); }
+
+ private:
+  std::deque<std::string> names;
+  std::vector<uint64_t> hashes;
+
+  // id + 1 per slot, 0 marks an empty slot
+  std::vector<uint32_t> slots;
+
+  static uint64_t hash(std::string_view name);
+  size_t probe(std::string_view name, uint64_t h) const;
+  void grow();
+};
+
+#endif  // INTERNER_H_
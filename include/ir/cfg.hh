@@ -0,0 +1,68 @@
+#ifndef CFG_H_
+#define CFG_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "ir/ir.hh"
+
+namespace ir {
+
+/// Predecessors, successors and a reverse post-order of the blocks reachable
+/// from the entry. Recompute after changing any terminator.
+struct CFG {
+  explicit CFG(const Function& fn);
+
+  std::vector<std::vector<BlockId>> preds;
+  std::vector<std::vector<BlockId>> succs;
+  std::vector<BlockId> rpo;
+  std::vector<uint32_t> rpo_index;  // UINT32_MAX for unreachable blocks
+
+  bool reachable(BlockId block) const { return rpo_index[block] != UINT32_MAX; }
+};
+
+/// Dominator tree (Cooper, Harvey and Kennedy's iterative algorithm) and
+/// dominance frontiers
+struct DominatorTree {
+  DominatorTree(const Function& fn, const CFG& cfg);
+
+  std::vector<BlockId> idom;  // idom[entry] == entry, kNoBlock if unreachable
+  std::vector<std::vector<BlockId>> children;
+  std::vector<std::vector<BlockId>> frontier;
+
+  bool dominates(BlockId a, BlockId b) const {
+    return pre[a] <= pre[b] && post[b] <= post[a];
+  }
+
+ private:
+  // dfs numbering of the tree, a dominates b iff b is inside a's interval
+  std::vector<uint32_t> pre;
+  std::vector<uint32_t> post;
+};
+
+inline constexpr uint32_t kNoLoop = UINT32_MAX;
+
+struct Loop {
+  BlockId header;
+  std::vector<BlockId> blocks;   // header first
+  std::vector<BlockId> latches;  // sources of the back edges
+  uint32_t parent = kNoLoop;
+  uint32_t depth = 1;
+};
+
+/// Natural loops found from back edges; loops sharing a header are merged
+struct LoopInfo {
+  LoopInfo(const Function& fn, const CFG& cfg, const DominatorTree& dom);
+
+  std::vector<Loop> loops;        // outer loops come before inner ones
+  std::vector<uint32_t> loop_of;  // innermost loop of each block
+
+  uint32_t depth(BlockId block) const {
+    return loop_of[block] == kNoLoop ? 0 : loops[loop_of[block]].depth;
+  }
+  bool contains(uint32_t loop, BlockId block) const;
+};
+
+}  // namespace ir
+
+#endif  // CFG_H_
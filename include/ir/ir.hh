@@ -0,0 +1,238 @@
+#ifndef IR_H_
+#define IR_H_
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Typed three-address IR. A module holds functions made of basic blocks;
+/// every instruction reads and writes virtual registers. Before SSA
+/// construction a register may be assigned more than once (locals map to a
+/// fixed register), after it every register has exactly one definition.
+namespace ir {
+
+using Reg = uint32_t;
+using BlockId = uint32_t;
+using FuncId = uint32_t;
+
+inline constexpr Reg kNoReg = UINT32_MAX;
+inline constexpr BlockId kNoBlock = UINT32_MAX;
+
+// I1, I8 and I32 live zero/sign-extended in 32 bits, I64 and Ptr in 64
+enum class Ty : uint8_t { Void, I1, I8, I32, I64, Ptr };
+
+enum class Op : uint8_t {
+  Nop,
+  Const,     // dst = imm
+  Copy,      // dst = a
+  Add,       // dst = a + b
+  Sub,       // dst = a - b
+  Mul,       // dst = a * b
+  Div,       // dst = a / b, signed
+  Neg,       // dst = -a
+  Shl,       // dst = a << imm
+  Sar,       // dst = a >> imm, signed
+  Shr,       // dst = a >> imm, unsigned
+  Sext,      // dst:i64 = a:i32 sign-extended
+  Trunc,     // dst:i32 = low 32 bits of a:i64
+  Eq,        // dst:i1 = a == b
+  Ne,        // dst:i1 = a != b
+  Lt,        // dst:i1 = a < b, signed
+  Le,        // dst:i1 = a <= b
+  Gt,        // dst:i1 = a > b
+  Ge,        // dst:i1 = a >= b
+  Select,    // dst = a != 0 ? b : c
+  LoadByte,  // dst:i8 = byte at a + b
+  StrAddr,   // dst:ptr = address of string literal imm
+  Call,      // dst[, dst2] = callee(operands)
+  Phi,       // dst = value of the incoming edge, (register, block) operands
+  Print,     // write(stdout, a, b)
+  Br,        // goto target
+  CondBr,    // if a != 0 goto target else goto other
+  Ret,       // return [a[, b]]
+};
+
+struct Inst {
+  Op op = Op::Nop;
+  Ty ty = Ty::Void;  // type of dst
+  Reg dst = kNoReg;
+  Reg dst2 = kNoReg;  // second result of a call returning a string
+  Reg a = kNoReg;
+  Reg b = kNoReg;
+  Reg c = kNoReg;  // the third operand of a select
+  int64_t imm = 0;
+  BlockId target = kNoBlock;
+  BlockId other = kNoBlock;
+  FuncId callee = 0;
+  // call arguments or phi incomings, a range of the function's operand pool
+  uint32_t first = 0;
+  uint32_t count = 0;
+};
+
+inline bool is_terminator(Op op) {
+  return op == Op::Br || op == Op::CondBr || op == Op::Ret;
+}
+
+inline bool is_compare(Op op) { return op >= Op::Eq && op <= Op::Ge; }
+
+inline bool is_wide(Ty ty) { return ty == Ty::I64 || ty == Ty::Ptr; }
+
+struct Block {
+  std::vector<Inst> insts;  // the last instruction is the terminator
+
+  const Inst* terminator() const {
+    return !insts.empty() && is_terminator(insts.back().op) ? &insts.back()
+                                                            : nullptr;
+  }
+};
+
+struct Function {
+  std::string name;  // assembler symbol
+  std::vector<Ty> params;   // a string parameter is (Ptr, I64)
+  std::vector<Ty> results;  // empty for void, two entries for a string
+  std::vector<Ty> reg_types;
+  std::vector<Block> blocks;  // block 0 is the entry
+  std::vector<Reg> operands;
+
+  // registers 0..params.size()-1 hold the incoming parameters
+  Reg new_reg(Ty ty) {
+    reg_types.push_back(ty);
+    return static_cast<Reg>(reg_types.size() - 1);
+  }
+
+  BlockId new_block() {
+    blocks.emplace_back();
+    return static_cast<BlockId>(blocks.size() - 1);
+  }
+
+  std::span<const Reg> args(const Inst& inst) const {
+    return {operands.data() + inst.first, inst.count};
+  }
+  std::span<Reg> args(Inst& inst) {
+    return {operands.data() + inst.first, inst.count};
+  }
+
+  // a phi stores (value, predecessor) pairs
+  size_t phi_size(const Inst& phi) const { return phi.count / 2; }
+  Reg& phi_value(const Inst& phi, size_t i) {
+    return operands[phi.first + 2 * i];
+  }
+  Reg phi_value(const Inst& phi, size_t i) const {
+    return operands[phi.first + 2 * i];
+  }
+  BlockId& phi_block(const Inst& phi, size_t i) {
+    return operands[phi.first + 2 * i + 1];
+  }
+  BlockId phi_block(const Inst& phi, size_t i) const {
+    return operands[phi.first + 2 * i + 1];
+  }
+};
+
+/// Calls f(Reg&) for every register an instruction reads
+template <typename F>
+void for_each_use(Function& fn, Inst& inst, F&& f) {
+  if (inst.a != kNoReg) f(inst.a);
+  if (inst.b != kNoReg) f(inst.b);
+  if (inst.c != kNoReg) f(inst.c);
+  if (inst.op == Op::Call)
+    for (Reg& arg : fn.args(inst)) f(arg);
+  else if (inst.op == Op::Phi)
+    for (size_t i = 0; i < fn.phi_size(inst); ++i) f(fn.phi_value(inst, i));
+}
+
+template <typename F>
+void for_each_use(const Function& fn, const Inst& inst, F&& f) {
+  if (inst.a != kNoReg) f(inst.a);
+  if (inst.b != kNoReg) f(inst.b);
+  if (inst.c != kNoReg) f(inst.c);
+  if (inst.op == Op::Call)
+    for (Reg arg : fn.args(inst)) f(arg);
+  else if (inst.op == Op::Phi)
+    for (size_t i = 0; i < fn.phi_size(inst); ++i) f(fn.phi_value(inst, i));
+}
+
+struct Successors {
+  BlockId ids[2] = {kNoBlock, kNoBlock};
+  size_t count = 0;
+
+  const BlockId* begin() const { return ids; }
+  const BlockId* end() const { return ids + count; }
+  size_t size() const { return count; }
+};
+
+/// Successor blocks of a terminator, the same block may appear twice
+inline Successors successors(const Inst& term) {
+  if (term.op == Op::Br) return {{term.target, kNoBlock}, 1};
+  if (term.op == Op::CondBr) return {{term.target, term.other}, 2};
+  return {};
+}
+
+struct Module {
+  std::vector<Function> functions;
+  std::vector<std::string> strings;  // deduplicated literal pool
+  FuncId entry = 0;
+
+  uint32_t intern_string(const std::string& contents) {
+    auto [it, inserted] = string_ids.try_emplace(
+        contents, static_cast<uint32_t>(strings.size()));
+    if (inserted) strings.push_back(contents);
+    return it->second;
+  }
+
+ private:
+  std::unordered_map<std::string, uint32_t> string_ids;
+};
+
+/// Appends instructions to the current block of a function
+class Builder {
+ public:
+  explicit Builder(Function& fn) : fn(fn) {}
+
+  Function& function() { return fn; }
+  BlockId block() const { return current; }
+  void set_block(BlockId id) { current = id; }
+  bool terminated() const {
+    return fn.blocks[current].terminator() != nullptr;
+  }
+
+  Reg constant(Ty ty, int64_t value);
+  Reg copy(Ty ty, Reg src);
+  void copy_to(Reg dst, Reg src);
+  Reg unary(Op op, Ty ty, Reg a);
+  Reg binary(Op op, Ty ty, Reg a, Reg b);
+  Reg load_byte(Reg base, Reg index);
+  Reg string_address(uint32_t string_id);
+  Inst& call(FuncId callee, std::span<const Reg> args,
+             std::span<const Ty> results);
+  void print(Reg ptr, Reg len);
+
+  void br(BlockId target);
+  void cond_br(Reg cond, BlockId target, BlockId other);
+  void ret(Reg a = kNoReg, Reg b = kNoReg);
+
+ private:
+  Function& fn;
+  BlockId current = 0;
+
+  Inst& append(Inst inst);
+};
+
+const char* op_name(Op op);
+const char* ty_name(Ty ty);
+
+std::string print(const Module& module, const Function& fn);
+std::string print(const Module& module);
+
+/// Checks structural invariants: every block ends in exactly one terminator,
+/// branch targets, registers and callees exist and calls match the callee's
+/// signature. Violations are appended to errors.
+bool verify(const Module& module, std::vector<std::string>& errors);
+
+/// Drops blocks not reachable from the entry and renumbers the rest
+void remove_unreachable_blocks(Function& fn);
+
+}  // namespace ir
+
+#endif  // IR_H_
@@ -0,0 +1,64 @@
+#ifndef IR_PASSES_H_
+#define IR_PASSES_H_
+
+#include "ir/ir.hh"
+#include "pass_manager.hh"
+
+/// Transforms over SSA form, scheduled by the pass manager
+namespace ir {
+
+/// Inlines calls bottom-up over the call graph, so callees are already
+/// inlined into when their callers are considered. A call is inlined when
+/// the callee is not recursive and either has a single call site or its
+/// size exceeds the cost of the call by at most the inline threshold.
+/// Functions left without callers are removed.
+Preserved inline_functions(Module& module, Analyses& analyses);
+
+/// Turns self calls in tail position into jumps back to the top of the
+/// function, with the parameters carried by phis. A call whose result is
+/// only added to or multiplied with a value before being returned becomes
+/// a tail call too: the value goes into an accumulator that every other
+/// return applies to its result.
+Preserved eliminate_tail_calls(Module& module, FuncId fn, Analyses& analyses);
+
+/// Sparse conditional constant propagation (Wegman and Zadeck): registers
+/// and CFG edges are evaluated together, so values only flowing along
+/// branches that cannot be taken do not block folding. Registers found
+/// constant are redefined as constants and branches on them become jumps.
+Preserved propagate_constants(Module& module, FuncId fn, Analyses& analyses);
+
+/// If-conversion: a conditional whose arms only compute a few values
+/// without side effects runs both arms unconditionally, and the phis where
+/// they meet become selects on the condition, which code generation turns
+/// into cmov. Inner conditionals are flattened first.
+Preserved flatten_conditionals(Module& module, FuncId fn, Analyses& analyses);
+
+/// Loop-invariant code motion: pure instructions whose operands are all
+/// defined outside a loop move to its preheader, inner loops first.
+/// Nothing that can trap, read memory or has side effects moves, and
+/// constants only move along with an instruction using them.
+Preserved hoist_loop_invariants(Module& module, FuncId fn, Analyses& analyses);
+
+/// Unrolls single-block loops counting a 32-bit variable by a constant
+/// towards an invariant bound. Loops with a small constant trip count are
+/// replaced by one copy of the body per iteration; others run several
+/// copies per iteration while enough iterations are left, and the original
+/// loop runs the remainder. Both stay within a budget of instructions.
+Preserved unroll_loops(Module& module, FuncId fn, Analyses& analyses);
+
+/// Strength reduction. Multiplies of an induction variable by a loop
+/// invariant become an induction variable of their own, stepped by an add.
+/// Multiplies by constants become shifts and adds where that takes at most
+/// two instructions, and 32-bit divisions by constants other than 0, -1 and
+/// the minimum become shifts or a multiply by a magic number.
+Preserved reduce_strength(Module& module, FuncId fn, Analyses& analyses);
+
+/// Removes instructions whose results never reach a side effect: unread
+/// locals, stores overwritten before a read (separate definitions in SSA)
+/// and pure expression statements. Calls are always kept, and so are
+/// divisions that could trap.
+Preserved eliminate_dead_code(Module& module, FuncId fn, Analyses& analyses);
+
+}  // namespace ir
+
+#endif  // IR_PASSES_H_
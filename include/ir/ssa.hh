@@ -0,0 +1,27 @@
+#ifndef SSA_H_
+#define SSA_H_
+
+#include <string>
+#include <vector>
+
+#include "ir/ir.hh"
+
+namespace ir {
+
+/// Rewrites a function into SSA form: phis are placed on the iterated
+/// dominance frontier of every register assigned more than once (only where
+/// the register is live into a block), then uses are renamed along the
+/// dominator tree. Copies are folded while renaming and trivial or dead phis
+/// are removed afterwards.
+void construct_ssa(Function& fn);
+
+/// Replaces phis with copies: critical edges into phi blocks are split and
+/// each predecessor gets the phi moves as a sequentialized parallel copy.
+void destruct_ssa(Function& fn);
+
+/// Every register has one definition and every use is dominated by it
+bool verify_ssa(const Function& fn, std::vector<std::string>& errors);
+
+}  // namespace ir
+
+#endif  // SSA_H_
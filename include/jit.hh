@@ -0,0 +1,15 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <cstdint>
+
+#include "encoder.hh"
+
+/// Loads an image into this process and calls the function at text offset
+/// entry, which takes no arguments and returns an int. Text is mapped
+/// writable only until it is relocated, then read and execute; rodata goes
+/// on the read-only pages right after it. Returns false, with exit_code
+/// untouched, if the memory cannot be mapped.
+bool run_in_process(x86::Image image, uint32_t entry, int& exit_code);
+
+#endif  // JIT_H_
@@ -131,6 +131,7 @@ void parser_enter(const std::string& rule);
 void parser_exit(const std::string& rule, bool success);
 void parser_error(const std::string& message, const Token& token);
 void semantic_error(const std::string& message, int line, int col);
+void semantic_warning(const std::string& message, int line, int col);
 }  // namespace Compiler
 
 // AST printing functions (updated for templated AST)
@@ -1,15 +1,29 @@
 #ifndef METHODTABLE_H_
 #define METHODTABLE_H_
 
-#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
-#include "log.hh"
+#include "interner.hh"
 #include "symbol.hh"
 
+// splitmix64 finalizer, every input bit affects every output bit
+inline uint64_t mix_hash(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
 struct MethodKey {
-  std::string owner;
-  std::string name;
+  NameId owner;
+  NameId name;
 
   bool operator==(const MethodKey& other) const {
     return owner == other.owner && name == other.name;
@@ -18,8 +32,55 @@ struct MethodKey {
 
 struct MethodKeyHash {
   size_t operator()(const MethodKey& key) const {
-    return std::hash<std::string>()(key.owner) ^
-           (std::hash<std::string>()(key.name) << 1);
+    return mix_hash((static_cast<uint64_t>(key.owner) << 32) | key.name);
+  }
+};
+
+// (owner, name, argument types) of a call site. The memo stores owning
+// CallKeys but is probed with a CallKeyView so lookups never copy the
+// argument vector.
+struct CallKeyView {
+  NameId owner;
+  NameId name;
+  std::span<const Type* const> args;
+};
+
+struct CallKey {
+  NameId owner;
+  NameId name;
+  std::vector<const Type*> args;
+
+  CallKeyView view() const { return {owner, name, args}; }
+};
+
+struct CallKeyHash {
+  using is_transparent = void;
+
+  size_t operator()(const CallKeyView& key) const {
+    uint64_t h = MethodKeyHash()({key.owner, key.name});
+    for (const Type* arg : key.args)
+      h = mix_hash(h ^ reinterpret_cast<uintptr_t>(arg));
+    return h;
+  }
+  size_t operator()(const CallKey& key) const { return (*this)(key.view()); }
+};
+
+struct CallKeyEqual {
+  using is_transparent = void;
+
+  static bool same(const CallKeyView& a, const CallKeyView& b) {
+    return a.owner == b.owner && a.name == b.name &&
+           std::equal(a.args.begin(), a.args.end(), b.args.begin(),
+                      b.args.end());
+  }
+  bool operator()(const CallKey& a, const CallKey& b) const {
+    return same(a.view(), b.view());
+  }
+  bool operator()(const CallKeyView& a, const CallKey& b) const {
+    return same(a, b.view());
+  }
+  bool operator()(const CallKey& a, const CallKeyView& b) const {
+    return same(a.view(), b);
   }
 };
 
@@ -28,13 +89,9 @@ class MethodTable {
   bool add_method(FunctionSymbol* method, std::string* error = nullptr) {
     if (!method) return false;
 
-    MethodKey key{method->owner_class, method->name};
-
-    LOG_INFO("owner_class: {}", method->owner_class);
+    auto& bucket = methods[{method->owner, method->name_id}];
 
-    auto& bucket = methods[key];
-
-    for (const auto& existing : bucket) {
+    for (const auto* existing : bucket) {
       if (existing->param_types == method->param_types) {
         if (error) *error = "duplicate overload";
         return false;
@@ -42,39 +99,52 @@ class MethodTable {
     }
 
     bucket.push_back(method);
+    // a new overload can change how earlier calls would resolve
+    resolved.clear();
     return true;
   }
 
-  static std::string make_method_key(const FunctionSymbol& method) {
-    std::string key = method.owner_class + "_" + method.name + "_";
-    for (size_t i = 0; i < method.fields.size(); ++i) {
+  void remove_method(const FunctionSymbol* method) {
+    if (!method) return;
+
+    auto it = methods.find({method->owner, method->name_id});
+    if (it == methods.end()) return;
+
+    std::erase(it->second, method);
+    resolved.clear();
+  }
+
+  /// Symbol name for a method: owner, name and parameter types
+  static std::string make_method_key(const FunctionSymbol& method,
+                                     const NameInterner& names) {
+    std::string key = names.name(method.owner) + "_" + method.name + "_";
+    for (size_t i = 0; i < method.param_types.size(); ++i) {
       if (i > 0) key += "_";
-      key += method.fields[i]->type->to_string();
+      key += method.param_types[i]->to_string();
     }
     return key;
   }
 
+  /// Resolves a call. Exact parameter matches win; otherwise a single
+  /// candidate whose parameters all accept the arguments is chosen. Results
+  /// (including misses) are memoized per (owner, name, argument types).
   const FunctionSymbol* find_overload(
-      const std::string& owner, const std::string& name,
-      const std::vector<const Type*>& param_types) const {
-    MethodKey key{owner, name};
-    auto it = methods.find(key);
-    if (it == methods.end()) return nullptr;
-
-    for (const auto* method : it->second) {
-      if (method->param_types == param_types) return method;
-    }
-
-    return nullptr;
+      NameId owner, NameId name,
+      const std::vector<const Type*>& arg_types) const {
+    CallKeyView key{owner, name, arg_types};
+    auto memo = resolved.find(key);
+    if (memo != resolved.end()) return memo->second;
+
+    const FunctionSymbol* result = resolve(owner, name, arg_types);
+    resolved.emplace(CallKey{owner, name, arg_types}, result);
+    return result;
   }
 
-  const std::vector<FunctionSymbol*> find_all(const std::string& owner,
-                                              const std::string& name) const {
-    MethodKey key{owner, name};
-    auto it = methods.find(key);
-    if (it == methods.end()) return {};
-
-    return it->second;
+  const std::vector<FunctionSymbol*>& find_all(NameId owner,
+                                               NameId name) const {
+    static const std::vector<FunctionSymbol*> none;
+    auto it = methods.find({owner, name});
+    return it == methods.end() ? none : it->second;
   }
 
   bool empty() const { return methods.empty(); }
@@ -82,6 +152,33 @@ class MethodTable {
  private:
   std::unordered_map<MethodKey, std::vector<FunctionSymbol*>, MethodKeyHash>
       methods;
+  mutable std::unordered_map<CallKey, const FunctionSymbol*, CallKeyHash,
+                             CallKeyEqual>
+      resolved;
+
+  const FunctionSymbol* resolve(
+      NameId owner, NameId name,
+      const std::vector<const Type*>& arg_types) const {
+    const auto& bucket = find_all(owner, name);
+
+    for (const auto* method : bucket)
+      if (method->param_types == arg_types) return method;
+
+    const FunctionSymbol* viable = nullptr;
+    for (const auto* method : bucket) {
+      if (method->param_types.size() != arg_types.size()) continue;
+
+      bool accepts = true;
+      for (size_t i = 0; i < arg_types.size() && accepts; ++i)
+        accepts = arg_types[i] &&
+                  method->param_types[i]->is_compatible_with(*arg_types[i]);
+      if (!accepts) continue;
+
+      if (viable) return nullptr;  // ambiguous
+      viable = method;
+    }
+    return viable;
+  }
 };
 
 #endif  // METHODTABLE_H_
@@ -0,0 +1,105 @@
+#ifndef PASS_MANAGER_H_
+#define PASS_MANAGER_H_
+
+#include <chrono>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ir/cfg.hh"
+#include "ir/ir.hh"
+#include "x86.hh"
+
+/// What a transform left intact. Dominators and loops are derived from the
+/// CFG, so a pass that keeps blocks and branches as they were keeps all of
+/// them.
+enum Preserved : uint8_t {
+  kPreservesNothing = 0,
+  kPreservesCfg = 1 << 0,
+  kPreservesAll = 0xff,
+};
+
+/// Tunables of individual passes
+struct PassOptions {
+  // how many instructions an inlined body may add beyond what the call
+  // itself costs
+  int inline_threshold = 0;
+};
+
+/// Analyses of the functions of a module, computed on first use and kept
+/// until a pass reports that it changed what they describe
+class Analyses {
+ public:
+  Analyses(const ir::Module& module, const PassOptions& options)
+      : options(options), module(module), entries(module.functions.size()) {}
+
+  const PassOptions& options;
+
+  const ir::CFG& cfg(ir::FuncId fn);
+  const ir::DominatorTree& dominators(ir::FuncId fn);
+  const ir::LoopInfo& loops(ir::FuncId fn);
+
+  void invalidate(ir::FuncId fn, Preserved preserved);
+  void invalidate(Preserved preserved);
+
+ private:
+  struct Entry {
+    std::optional<ir::CFG> cfg;
+    std::optional<ir::DominatorTree> dominators;
+    std::optional<ir::LoopInfo> loops;
+  };
+
+  const ir::Module& module;
+  std::vector<Entry> entries;
+};
+
+struct Pass {
+  enum class Kind : uint8_t { Function, Module, Machine };
+
+  const char* name;
+  const char* description;
+  Kind kind;
+  // the one matching kind is set
+  Preserved (*function)(ir::Module&, ir::FuncId, Analyses&) = nullptr;
+  Preserved (*module)(ir::Module&, Analyses&) = nullptr;
+  void (*machine)(x86::Program&) = nullptr;
+};
+
+/// Every pass --passes can name
+std::span<const Pass> registered_passes();
+const Pass* find_pass(std::string_view name);
+
+/// An ordered pipeline of IR passes, run on SSA form, and machine passes,
+/// run on the generated instructions. Each pass is timed.
+class PassManager {
+ public:
+  static constexpr int kMaxLevel = 2;
+
+  /// The -O0, -O1 and -O2 presets
+  void add_level(int level);
+  /// Comma separated pass names; on an unknown name nothing is added
+  bool add(std::string_view pipeline, std::string& error);
+
+  bool empty() const { return pipeline.empty(); }
+
+  PassOptions options;
+
+  void run(ir::Module& module);
+  void run(x86::Program& program);
+
+  /// Time spent in each pass, slowest first
+  std::string report() const;
+
+ private:
+  struct Scheduled {
+    const Pass* pass;
+    std::chrono::nanoseconds time{};
+    uint32_t runs = 0;
+  };
+
+  std::vector<Scheduled> pipeline;
+};
+
+#endif  // PASS_MANAGER_H_
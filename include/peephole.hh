@@ -0,0 +1,18 @@
+#ifndef PEEPHOLE_H_
+#define PEEPHOLE_H_
+
+#include "x86.hh"
+
+namespace x86 {
+
+/// Pattern-based cleanup of the generated instructions, one function at a
+/// time: self moves and moves straight back, moves into dead registers,
+/// `mov reg, 0`, branches on a materialized compare, jumps to the next
+/// label and adjacent stack adjustments. Patterns are listed in one table
+/// in peephole.cc and may ask whether a register or the flags are live
+/// after the window they match.
+void peephole(Program& program);
+
+}  // namespace x86
+
+#endif  // PEEPHOLE_H_
@@ -0,0 +1,119 @@
+#ifndef QUERY_H_
+#define QUERY_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.hh"
+#include "context.hh"
+
+enum class QueryKind : uint8_t {
+  Globals,      // top-level statements that are not functions
+  Signature,    // function symbol and parameter types of a method
+  Body,         // locals, name resolution and type checking of a method
+  ClassLayout,  // field offsets and size of a class
+};
+
+struct QueryKey {
+  QueryKind kind;
+  const ASTNode* node;
+
+  bool operator==(const QueryKey& other) const {
+    return kind == other.kind && node == other.node;
+  }
+};
+
+struct QueryKeyHash {
+  size_t operator()(const QueryKey& key) const {
+    return mix_hash(reinterpret_cast<uintptr_t>(key.node) ^
+                    (static_cast<uint64_t>(key.kind) << 56));
+  }
+};
+
+struct ClassLayout {
+  struct Field {
+    NameId name;
+    const Type* type;
+    size_t offset;
+  };
+
+  std::vector<Field> fields;
+  size_t size = 0;
+  size_t align = 1;
+};
+
+/// Demand-driven semantic analysis. Every piece of analysis is a memoized
+/// query; a query that demands another while running records a dependency
+/// edge, so invalidating one result also drops everything computed from it.
+/// A build only checks what is reachable from its entry point, and tooling
+/// can ask for any single query.
+class QueryEngine {
+ public:
+  explicit QueryEngine(CompilerContext& ctx) : ctx(ctx) {}
+
+  /// Indexes the declarations of a program, no analysis is done here
+  void index(ProgramNode& program);
+
+  bool globals();
+  FunctionSymbol* signature(MethodDeclNode& method);
+  bool body(MethodDeclNode& method);
+  const ClassLayout* layout(ClassNode& cls);
+
+  /// Demands the signature of every declaration with this name so overload
+  /// resolution sees the complete set
+  void demand_overloads(NameId owner, NameId name);
+  /// Records a call made by the body being checked; its callee becomes
+  /// reachable
+  void note_call(const FunctionSymbol* callee);
+
+  /// Checks the body of entry and of every function reachable from it
+  bool check_reachable(MethodDeclNode& entry);
+  const std::vector<MethodDeclNode*>& reachable() const { return order; }
+
+  MethodDeclNode* declaration(const FunctionSymbol* fn) const {
+    auto it = decl_of.find(fn);
+    return it == decl_of.end() ? nullptr : it->second;
+  }
+
+  /// Drops a result and, transitively, every result that depended on it.
+  /// Dropped bodies of reachable functions are checked again by the next
+  /// check_reachable
+  void invalidate(QueryKind kind, const ASTNode* node);
+
+  size_t error_count() const { return errors; }
+  size_t executed_count() const { return executed; }
+
+ private:
+  enum class Status : uint8_t { Pending, Running, Done };
+
+  struct QueryState {
+    Status status = Status::Pending;
+    bool ok = false;
+    std::vector<QueryKey> dependents;
+  };
+
+  CompilerContext& ctx;
+  ProgramNode* program = nullptr;
+
+  std::unordered_map<QueryKey, QueryState, QueryKeyHash> cache;
+  std::vector<QueryKey> active;
+  size_t executed = 0;
+  size_t errors = 0;
+
+  std::unordered_map<NameId, std::vector<MethodDeclNode*>> decls_by_name;
+  std::unordered_map<const FunctionSymbol*, MethodDeclNode*> decl_of;
+  std::unordered_map<const ClassNode*, ClassLayout> layouts;
+  std::vector<StmtNode*> top_level;
+  std::vector<Symbol*> global_symbols;
+
+  std::vector<MethodDeclNode*> order;
+  std::vector<MethodDeclNode*> worklist;
+
+  template <typename Compute>
+  bool run(QueryKey key, Compute&& compute);
+
+  void bind_globals();
+};
+
+#endif  // QUERY_H_
@@ -0,0 +1,89 @@
+#ifndef REGALLOC_H_
+#define REGALLOC_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "ir/ir.hh"
+#include "x86.hh"
+
+// rax, rdx and r11 stay free for the code generator: division, return
+// values, syscalls and memory-to-memory moves need them
+inline constexpr x86::Reg kAllocatableRegs[] = {
+    x86::rcx, x86::rsi, x86::rdi, x86::r8,  x86::r9,  x86::r10,
+    x86::rbx, x86::r12, x86::r13, x86::r14, x86::r15};
+
+/// Where a virtual register lives at some point of a function
+struct Location {
+  enum class Kind : uint8_t { None, Register, Stack };
+
+  Kind kind = Kind::None;
+  x86::Reg reg = x86::rax;
+  uint32_t slot = 0;
+
+  static Location in(x86::Reg reg) { return {Kind::Register, reg, 0}; }
+  static Location stack(uint32_t slot) {
+    return {Kind::Stack, x86::rax, slot};
+  }
+
+  bool is_reg() const { return kind == Kind::Register; }
+  bool is_stack() const { return kind == Kind::Stack; }
+  bool operator==(const Location&) const = default;
+};
+
+struct Move {
+  Location from;
+  Location to;
+  bool wide = false;
+};
+
+/// Moves for a critical edge, emitted out of line
+struct EdgeStub {
+  ir::BlockId from;
+  ir::BlockId to;
+  std::vector<Move> moves;
+};
+
+/// Register assignment for one function. Instructions are numbered through
+/// the blocks in layout order; instruction k reads its operands at position
+/// 4k, clobbers registers (calls and prints) at 4k+1 and writes its results
+/// at 4k+2, so moves placed at 4k run before any of that. A virtual register
+/// may be split into pieces living in different places, the moves between
+/// them are listed here.
+struct Allocation {
+  struct Piece {
+    uint32_t from;
+    uint32_t to;
+    Location location;
+  };
+
+  std::vector<uint32_t> block_start;  // first instruction of each block
+  std::vector<std::vector<Piece>> pieces;  // per register, sorted
+
+  // each list is one parallel move
+  std::vector<std::vector<Move>> moves_before;  // per instruction
+  std::vector<std::vector<Move>> block_entry;   // edges into one-pred blocks
+  std::vector<std::vector<Move>> block_exit;    // before the terminator
+  std::vector<EdgeStub> stubs;
+
+  uint32_t spill_slots = 0;
+  std::vector<x86::Reg> callee_saved;  // used, so saved in the prologue
+
+  static bool clobbers(ir::Op op) {
+    return op == ir::Op::Call || op == ir::Op::Print;
+  }
+
+  Location at(ir::Reg reg, uint32_t position) const;
+  Location use(ir::Reg reg, uint32_t inst) const { return at(reg, 4 * inst); }
+  Location def(ir::Reg reg, uint32_t inst) const {
+    return at(reg, 4 * inst + 2);
+  }
+};
+
+/// Linear scan over live intervals with lifetime holes (Wimmer and
+/// Mössenböck). Intervals that do not fit are split, preferably on block
+/// boundaries outside loops, and the parts without a register go to a stack
+/// slot of their own.
+Allocation allocate_registers(const ir::Function& fn);
+
+#endif  // REGALLOC_H_
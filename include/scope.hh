@@ -1,37 +1,51 @@
 #ifndef SCOPE_H_
 #define SCOPE_H_
 
-#include <memory>
-#include <string>
-#include <unordered_map>
+#include <cstdint>
+#include <vector>
 
+#include "interner.hh"
 #include "symbol.hh"
 
-class Scope {
+/// Flat scoped symbol table. Every interned name owns one binding slot that
+/// holds its innermost visible symbol; declaring over an outer binding pushes
+/// the shadowed one onto an undo log that exit_scope() replays. Lookups are a
+/// single index regardless of nesting, and entering a scope only records a
+/// mark, so blocks without declarations never allocate.
+class ScopeTable {
  public:
-  explicit Scope(Scope* parent = nullptr) : parent(parent) {}
+  void enter_scope() {
+    marks.push_back(static_cast<uint32_t>(undo_log.size()));
+  }
+  void exit_scope();
+  size_t depth() const { return marks.size(); }
 
-  Symbol* declare(const std::string& name, const Type* type,
-                  SourceLocation loc);
+  /// Binds symbol in the innermost scope, fails if the name is already bound
+  /// there
+  bool bind(NameId name, Symbol* symbol);
 
-  VariableSymbol* declare(const std::string& name, const Type* type,
-                          bool is_mutable, SourceLocation loc);
+  Symbol* lookup(NameId name) const {
+    return name < bindings.size() ? bindings[name].symbol : nullptr;
+  }
+  Symbol* lookup_local(NameId name) const;
 
-  FunctionSymbol* declare(const std::string& name, const Type* return_type,
-                          const std::vector<const Type*> param_types,
-                          SourceLocation loc);
-
-  Symbol* lookup(const std::string& name, bool walkParent = true);
-  Symbol* lookup(const std::string& name, Scope* startingScope,
-                 bool walkParent = true);
-
-  Scope* get_parent() const { return parent; }
-
-  void dump() const;
+  void clear();
+  void dump(const NameInterner& names) const;
 
  private:
-  Scope* parent = nullptr;
-  std::unordered_map<std::string, std::unique_ptr<Symbol>> symbols;
+  struct Binding {
+    Symbol* symbol = nullptr;
+    uint32_t depth = 0;
+  };
+
+  struct Shadowed {
+    NameId name;
+    Binding previous;
+  };
+
+  std::vector<Binding> bindings;  // indexed by NameId
+  std::vector<Shadowed> undo_log;
+  std::vector<uint32_t> marks;  // undo_log size at each enter_scope()
 };
 
 #endif  // SCOPE_H_
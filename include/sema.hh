@@ -2,15 +2,23 @@
 #define SEMA_H_
 
 #include "ast.hh"
+#include "query.hh"
 #include "visitor/visitor.hh"
 
 class Sema {
  public:
-  Sema(CompilerContext& ctx) : ctx(ctx) {}
+  Sema(CompilerContext& ctx) : ctx(ctx), queries(ctx) {}
   ProgramNode* analyze(ProgramNode&);
 
+  QueryEngine& query_engine() { return queries; }
+  /// Functions reachable from main, in the order they were discovered
+  const std::vector<MethodDeclNode*>& reachable() const {
+    return queries.reachable();
+  }
+
  private:
   CompilerContext& ctx;
+  QueryEngine queries;
 };
 
 #endif  // SEMA_H_
@@ -1,22 +1,27 @@
 #ifndef SYMBOL_H_
 #define SYMBOL_H_
 
-#include <memory>
+#include <cstdint>
 #include <string>
 #include <vector>
 
+#include "interner.hh"
 #include "sourcelocation.hh"
 #include "type.hh"
 
+using SymbolId = uint32_t;
+
 struct Symbol {
+  SymbolId id = 0;  // index in the context's symbol arena
   std::string name;
+  NameId name_id = kInvalidName;
   const Type* type = nullptr;
   SourceLocation location;
 
-  int field_count;  // param for functions, field for structs
+  int field_count = 0;  // param for functions, field for structs
   std::vector<Symbol*> fields;
 
-  std::string owner_class;
+  NameId owner = kEmptyName;  // owning class, kEmptyName at global scope
 
   virtual ~Symbol() = default;
 };
@@ -27,13 +32,9 @@ struct VariableSymbol final : Symbol {
 
 struct FunctionSymbol final : Symbol {
   std::vector<const Type*> param_types;
-  std::vector<std::unique_ptr<FunctionSymbol>> overloads;
+  std::vector<FunctionSymbol*> overloads;
 };
 
-class Scope;
-
-struct ClassSymbol final : Symbol {
-  Scope* member_scope = nullptr;
-};
+struct ClassSymbol final : Symbol {};
 
 #endif  // SYMBOL_H_
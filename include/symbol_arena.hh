@@ -0,0 +1,62 @@
+#ifndef SYMBOL_ARENA_H_
+#define SYMBOL_ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "symbol.hh"
+
+/// Owns every symbol the compiler creates. Symbols are bump-allocated into
+/// fixed-size chunks, so pointers stay valid for the lifetime of the context
+/// and passes can hold plain Symbol* (or the dense SymbolId) instead of
+/// copies.
+class SymbolArena {
+ public:
+  SymbolArena() = default;
+  SymbolArena(const SymbolArena&) = delete;
+  SymbolArena& operator=(const SymbolArena&) = delete;
+
+  ~SymbolArena() {
+    for (auto it = symbols.rbegin(); it != symbols.rend(); ++it)
+      (*it)->~Symbol();
+  }
+
+  template <typename T>
+  T* create() {
+    static_assert(std::is_base_of_v<Symbol, T>);
+    static_assert(sizeof(T) <= kChunkSize);
+
+    T* symbol = new (allocate(sizeof(T), alignof(T))) T();
+    symbol->id = static_cast<SymbolId>(symbols.size());
+    symbols.push_back(symbol);
+    return symbol;
+  }
+
+  Symbol* get(SymbolId id) const {
+    return id < symbols.size() ? symbols[id] : nullptr;
+  }
+  size_t size() const { return symbols.size(); }
+
+ private:
+  static constexpr size_t kChunkSize = 16 * 1024;
+
+  std::vector<std::unique_ptr<std::byte[]>> chunks;
+  size_t offset = kChunkSize;
+  std::vector<Symbol*> symbols;
+
+  void* allocate(size_t size, size_t align) {
+    offset = (offset + align - 1) & ~(align - 1);
+    if (offset + size > kChunkSize) {
+      chunks.push_back(std::make_unique<std::byte[]>(kChunkSize));
+      offset = 0;
+    }
+    void* ptr = chunks.back().get() + offset;
+    offset += size;
+    return ptr;
+  }
+};
+
+#endif  // SYMBOL_ARENA_H_
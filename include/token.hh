@@ -3,6 +3,7 @@
 
 #include <string>
 
+#include "interner.hh"
 #include "sourcelocation.hh"
 
 #define TOKEN_LIST      \
@@ -86,11 +87,14 @@ enum class TokenType {
 class Token {
  public:
   Token() {}
-  Token(TokenType type, std::string value, SourceLocation loc)
-      : value(value), type(type), location(loc) {}
+  Token(TokenType type, std::string value, SourceLocation loc,
+        NameId name_id = kInvalidName)
+      : value(value), type(type), location(loc), name_id(name_id) {}
 
   TokenType getType() const { return type; }
   std::string getValue() const { return value; }
+  /// Interned spelling, only set for identifiers
+  NameId getNameId() const { return name_id; }
   int getLine() const { return location.line; }
   int getCol() const { return location.col; }
 
@@ -117,6 +121,8 @@ class Token {
   TokenType type;
   /// Location in source of token
   SourceLocation location;
+  /// Interned identifier, kInvalidName for everything else
+  NameId name_id = kInvalidName;
 };
 
 #endif  // TOKEN_H_
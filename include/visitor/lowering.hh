@@ -0,0 +1,83 @@
+#ifndef LOWERING_H_
+#define LOWERING_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include "ast.hh"
+#include "ir/ir.hh"
+#include "visitor.hh"
+
+/// Lowers checked method bodies to IR. Every local gets fixed virtual
+/// registers (two for a string: pointer and length), so the result is not
+/// in SSA form yet.
+class Lowering : public ASTVisitor {
+ public:
+  Lowering(CompilerContext& ctx, ir::Module& module)
+      : ASTVisitor(ctx), module(module) {}
+
+  /// Lowers the given methods, the first one becomes the module entry
+  void lower(const std::vector<MethodDeclNode*>& methods);
+
+ private:
+  // a lowered expression; len is only set for strings
+  struct Value {
+    ir::Reg reg = ir::kNoReg;
+    ir::Reg len = ir::kNoReg;
+  };
+
+  ir::Module& module;
+  ir::Builder* builder = nullptr;
+  const FunctionSymbol* current_function = nullptr;
+
+  std::unordered_map<const Symbol*, ir::FuncId> functions;
+  std::unordered_map<const Symbol*, Value> locals;
+  ir::FuncId streq = UINT32_MAX;
+
+  void declareFunction(MethodDeclNode& node);
+  void lowerMethodDecl(MethodDeclNode& node);
+
+  void lowerStatement(StmtNode& stmt);
+  Value lowerExpression(ExprNode& expr);
+
+  void lowerBlock(BlockNode& node);
+  void lowerIfStmt(IfStmtNode& node);
+  void lowerWhileStmt(WhileStmtNode& node);
+  void lowerReturn(ReturnStmtNode& node);
+  void lowerExprStmt(ExprStmtNode& node);
+
+  Value lowerVarDecl(VarDeclNode& node);
+  Value lowerBinaryExpr(BinaryExprNode& node);
+  Value lowerUnaryExpr(UnaryExprNode& node);
+  Value lowerLiteralExpr(LiteralExprNode& node);
+  Value lowerIdentifierExpr(IdentifierExprNode& node);
+  Value lowerAssignmentExpr(AssignmentExprNode& node);
+  Value lowerMethodCall(MethodCallNode& node);
+
+  Value defaultValue(const Type* type);
+  Value convert(Value value, const Type* from, const Type* to);
+  Value newVariable(const Type* type);
+  void assign(const Value& target, const Value& value);
+  ir::FuncId stringEquals();
+
+  ir::Ty scalar_ty(const Type* type) {
+    if (type == ctx.get_bool_type()) return ir::Ty::I1;
+    if (type == ctx.get_char_type()) return ir::Ty::I8;
+    if (type && type->is_pointer()) return ir::Ty::Ptr;
+    return ir::Ty::I32;
+  }
+
+  static bool is_string(const Type* type) {
+    return type && type->is_pointer();
+  }
+
+  void append_types(const Type* type, std::vector<ir::Ty>& out) {
+    if (!type || type->is_void()) return;
+    out.push_back(scalar_ty(type));
+    if (is_string(type)) out.push_back(ir::Ty::I64);
+  }
+
+  static std::string mangle(const FunctionSymbol& fn);
+};
+
+#endif  // LOWERING_H_
@@ -1,10 +1,6 @@
 #ifndef NAMERESOLVER_H_
 #define NAMERESOLVER_H_
 
-#include <string>
-#include <unordered_map>
-#include <vector>
-
 #include "ast.hh"
 #include "methodtable.hh"
 #include "visitor/visitor.hh"
@@ -14,6 +10,7 @@ class NameResolver : public ASTVisitor {
   NameResolver(CompilerContext& ctx) : ASTVisitor(ctx) {}
 
   void resolve(ProgramNode& program) { resolveProgram(program); }
+  void resolve(StmtNode& stmt) { resolveStatement(stmt); }
 
  private:
   void resolveStatement(StmtNode& stmt);
@@ -36,8 +33,7 @@ class NameResolver : public ASTVisitor {
   void resolveMethodCall(MethodCallNode& node);
   // void resolveArgument(ArgumentNode& node);
 
-  const std::vector<Symbol>* find_method_overloads(const std::string& owner,
-                                                   const std::string& name);
+  void bindVariable(ASTNode& node);
 };
 
 #endif  // NAMERESOLVER_H_
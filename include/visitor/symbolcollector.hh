@@ -9,6 +9,12 @@ class SymbolCollector : public ASTVisitor {
   SymbolCollector(CompilerContext& ctx) : ASTVisitor(ctx) {}
 
   void collect(ProgramNode& program) { collectProgram(program); }
+  void collect(StmtNode& stmt) { collectStatement(stmt); }
+
+  /// Declares the function and its parameters and registers the overload
+  FunctionSymbol* collectSignature(MethodDeclNode& node);
+  /// Declares the locals of a function whose signature is collected
+  void collectBody(MethodDeclNode& node);
 
  private:
   void collectStatement(StmtNode& stmt);
@@ -4,14 +4,21 @@
 #include "ast.hh"
 #include "visitor.hh"
 
+class QueryEngine;
+
 class TypeChecker : public ASTVisitor {
  public:
-  TypeChecker(CompilerContext& ctx) : ASTVisitor(ctx) {}
+  TypeChecker(CompilerContext& ctx, QueryEngine* queries = nullptr)
+      : ASTVisitor(ctx), queries(queries) {}
 
   void check(ProgramNode& program) { checkProgram(program); }
+  void check(StmtNode& stmt) { checkStatement(stmt); }
 
  private:
   FunctionSymbol* current_function = nullptr;
+  // when set, callee signatures are demanded from the query engine instead
+  // of assumed to be collected up front
+  QueryEngine* queries = nullptr;
 
   void checkStatement(StmtNode& stmt);
   const Type* checkExpression(ExprNode& expr);
@@ -1,7 +1,8 @@
 #ifndef VISITOR_H_
 #define VISITOR_H_
 
-#include <unordered_map>
+#include <string>
+#include <vector>
 
 #include "context.hh"
 #include "diagnostics.hh"
@@ -62,36 +63,12 @@ class ASTVisitor {
  protected:
   CompilerContext& ctx;
 
-  std::vector<std::unordered_map<std::string, Symbol>> scope_stack;
   std::vector<std::string> errors;
 
   std::string current_class;
   std::string current_method;
   std::string current_method_ret_type;
 
-  void push_scope() { scope_stack.emplace_back(); }
-  void pop_scope() {
-    if (!scope_stack.empty()) {
-      scope_stack.pop_back();
-    }
-  }
-
-  Symbol* lookup_symbol(const std::string& name) {
-    for (auto it = scope_stack.rbegin(); it != scope_stack.rend(); ++it) {
-      auto found = it->find(name);
-      if (found != it->end()) {
-        return &found->second;
-      }
-    }
-
-    if (!ctx.symbol_table.empty()) {
-      auto global_found = ctx.symbol_table.find(name);
-      if (global_found != ctx.symbol_table.end()) return &global_found->second;
-    }
-
-    return nullptr;
-  }
-
   TokenType builtin_type_name_to_type(std::string type_name) {
     if (type_name.find("[")) return TokenType::TOKEN_ARRAY;
 
@@ -103,31 +80,17 @@ class ASTVisitor {
     return TokenType::TOKEN_UNKNOWN;
   }
 
-  Symbol* add_symbol(const Symbol& symbol) {
-    if (!scope_stack.empty()) {
-      scope_stack.back()[symbol.name] = symbol;
-      return &scope_stack.back()[symbol.name];
-    } else if (!ctx.symbol_table.empty()) {
-      ctx.symbol_table[symbol.name] = symbol;
-      return &ctx.symbol_table[symbol.name];
-    }
-    return nullptr;
-  }
-
-  bool check_symbol(const std::string& name) const {
-    if (!scope_stack.empty()) {
-      return scope_stack.back().find(name) != scope_stack.back().end();
-    }
-    if (ctx.symbol_table.empty()) return false;
-    return ctx.symbol_table.find(name) != ctx.symbol_table.end();
-  }
-
   void report_error(const std::string& message, SourceLocation loc) {
     errors.push_back(message);
     Log::Compiler::semantic_error(message, loc.line, loc.col);
     Diagnostics::instance().report_error(message);
   }
 
+  void report_warning(const std::string& message, SourceLocation loc) {
+    Log::Compiler::semantic_warning(message, loc.line, loc.col);
+    Diagnostics::instance().report_warning(message);
+  }
+
   void report_error(const std::string& message, int line, int col) {
     errors.push_back(message);
     Log::Compiler::semantic_error(message, line, col);
@@ -0,0 +1,108 @@
+#ifndef VM_BYTECODE_H_
+#define VM_BYTECODE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ir/ir.hh"
+
+/// Register bytecode for the interpreter. Every function has a frame of
+/// 64-bit registers numbered like the IR's virtual registers, so
+/// parameters arrive in registers 0..params-1. Instructions have three
+/// operands a, b and c whose meaning depends on the opcode.
+namespace vm {
+
+inline constexpr uint32_t kNone = UINT32_MAX;
+
+#define BYTECODE_OPS \
+  X(Const)    /* a = constants[b] */                                   \
+  X(Move)     /* a = b */                                              \
+  X(Add32)    /* a = b + c, 32-bit */                                  \
+  X(Add64)                                                             \
+  X(Sub32)                                                             \
+  X(Sub64)                                                             \
+  X(Mul32)                                                             \
+  X(Mul64)                                                             \
+  X(Div32)                                                             \
+  X(Div64)                                                             \
+  X(Neg32)    /* a = -b */                                             \
+  X(Neg64)                                                             \
+  X(Shl32)    /* a = b << c, c is the shift count */                   \
+  X(Shl64)                                                             \
+  X(Sar32)    /* a = b >> c, signed */                                 \
+  X(Sar64)                                                             \
+  X(Shr32)    /* a = b >> c, unsigned */                               \
+  X(Shr64)                                                             \
+  X(Sext)     /* a = b sign-extended from 32 bits */                   \
+  X(Trunc)    /* a = low 32 bits of b */                               \
+  X(Eq)       /* a = b == c */                                         \
+  X(Ne)                                                                \
+  X(Lt)                                                                \
+  X(Le)                                                                \
+  X(Gt)                                                                \
+  X(Ge)                                                                \
+  X(Select)   /* a = b != 0 ? a : c, a holds the first choice */       \
+  X(LoadByte) /* a = byte at b + c */                                  \
+  X(String)   /* a = address of strings[b] */                          \
+  X(Call)     /* a[, calls[c+1]] = functions[b](calls[c+2..]) */       \
+  X(Print)    /* write(stdout, a, b) */                                \
+  X(Jump)     /* goto a */                                             \
+  X(Branch)   /* goto a != 0 ? b : c */                                \
+  X(Ret)      /* return [a[, b]] */
+
+enum class Op : uint8_t {
+#define X(name) name,
+  BYTECODE_OPS
+#undef X
+};
+
+inline constexpr size_t kOpCount = 0
+#define X(name) +1
+    BYTECODE_OPS
+#undef X
+    ;
+
+const char* op_name(Op op);
+
+struct Instr {
+  Op op;
+  uint32_t a = kNone;
+  uint32_t b = kNone;
+  uint32_t c = kNone;
+};
+
+struct Function {
+  std::string name;
+  uint32_t params = 0;
+  uint32_t results = 0;
+  uint32_t registers = 0;
+  std::vector<int64_t> constants;
+  // per call: argument count, second result (or kNone), then the arguments
+  std::vector<uint32_t> calls;
+  std::vector<Instr> code;
+};
+
+struct Program {
+  std::vector<Function> functions;
+  std::vector<std::string> strings;
+  uint32_t entry = 0;
+};
+
+/// Translates a module out of SSA form, one instruction per IR instruction
+/// except for jumps to the next block
+Program compile(const ir::Module& module);
+
+/// Checks that every register, constant, call, string and jump target an
+/// instruction names exists. Violations are appended to errors.
+bool verify(const Program& program, std::vector<std::string>& errors);
+
+/// .jxb files: the program in a little-endian binary layout
+bool write(const Program& program, const std::string& path);
+bool read(const std::string& path, Program& program, std::string& error);
+
+std::string print(const Program& program);
+
+}  // namespace vm
+
+#endif  // VM_BYTECODE_H_
@@ -0,0 +1,16 @@
+#ifndef VM_VM_H_
+#define VM_VM_H_
+
+#include "vm/bytecode.hh"
+
+namespace vm {
+
+/// Interprets a verified program from its entry function, dispatching with
+/// computed gotos where the compiler supports them. Returns false on a
+/// runtime error (division by zero or overflow, call stack exhaustion);
+/// otherwise exit_code is the entry function's return value.
+bool run(const Program& program, int& exit_code);
+
+}  // namespace vm
+
+#endif  // VM_VM_H_
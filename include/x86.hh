@@ -0,0 +1,196 @@
+#ifndef X86_H_
+#define X86_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// x86-64 registers and a structured form of the instructions the code
+/// generator emits. Registers and condition codes are numbered as the
+/// hardware encodes them.
+namespace x86 {
+
+enum Reg : uint8_t {
+  rax,
+  rcx,
+  rdx,
+  rbx,
+  rsp,
+  rbp,
+  rsi,
+  rdi,
+  r8,
+  r9,
+  r10,
+  r11,
+  r12,
+  r13,
+  r14,
+  r15,
+};
+
+inline constexpr int kRegCount = 16;
+
+inline const char* name64(Reg reg) {
+  static constexpr const char* names[] = {
+      "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+      "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"};
+  return names[reg];
+}
+
+inline const char* name32(Reg reg) {
+  static constexpr const char* names[] = {
+      "eax", "ecx", "edx",  "ebx",  "esp",  "ebp",  "esi",  "edi",
+      "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+  return names[reg];
+}
+
+inline const char* name8(Reg reg) {
+  static constexpr const char* names[] = {
+      "al",  "cl",  "dl",   "bl",   "spl",  "bpl",  "sil",  "dil",
+      "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+  return names[reg];
+}
+
+// SysV calling convention
+inline constexpr Reg kArgumentRegs[] = {rdi, rsi, rdx, rcx, r8, r9};
+
+inline bool is_callee_saved(Reg reg) {
+  return reg == rbx || reg == rsp || reg == rbp || reg >= r12;
+}
+
+enum class Cond : uint8_t {
+  E = 0x4,
+  NE = 0x5,
+  L = 0xc,
+  GE = 0xd,
+  LE = 0xe,
+  G = 0xf,
+};
+
+inline Cond invert(Cond cc) {
+  return static_cast<Cond>(static_cast<uint8_t>(cc) ^ 1);
+}
+
+const char* cond_name(Cond cc);
+
+struct Operand {
+  enum class Kind : uint8_t { None, Reg, Imm, Mem, Label };
+
+  Kind kind = Kind::None;
+  uint8_t size = 0;  // in bytes; 0 for a memory operand of lea
+  Reg reg = rax;     // the register, or the base of a memory operand
+  Reg index = rax;
+  uint8_t scale = 1;  // of the index: 1, 2, 4 or 8
+  bool has_index = false;
+  bool rip = false;  // memory at label, relative to rip
+  int32_t disp = 0;
+  uint32_t label = 0;
+  int64_t imm = 0;
+
+  static Operand r(Reg reg, uint8_t size) {
+    return {.kind = Kind::Reg, .size = size, .reg = reg};
+  }
+  static Operand r64(Reg reg) { return r(reg, 8); }
+  static Operand r32(Reg reg) { return r(reg, 4); }
+  static Operand r8(Reg reg) { return r(reg, 1); }
+  static Operand immediate(int64_t value) {
+    return {.kind = Kind::Imm, .imm = value};
+  }
+  static Operand mem(Reg base, int32_t disp, uint8_t size) {
+    return {.kind = Kind::Mem, .size = size, .reg = base, .disp = disp};
+  }
+  static Operand mem(Reg base, Reg index, uint8_t size, uint8_t scale = 1) {
+    return {.kind = Kind::Mem,
+            .size = size,
+            .reg = base,
+            .index = index,
+            .scale = scale,
+            .has_index = true};
+  }
+  static Operand rip_relative(uint32_t label) {
+    return {.kind = Kind::Mem, .rip = true, .label = label};
+  }
+  static Operand target(uint32_t label) {
+    return {.kind = Kind::Label, .label = label};
+  }
+
+  bool is_reg() const { return kind == Kind::Reg; }
+  bool is_mem() const { return kind == Kind::Mem; }
+  bool is_imm() const { return kind == Kind::Imm; }
+  bool operator==(const Operand&) const = default;
+};
+
+enum class Opcode : uint8_t {
+  Label,  // defines dst.label, aligned to src.imm bytes when that is set
+  Mov,
+  Movzx,
+  Movsxd,
+  Lea,
+  Add,
+  Sub,
+  Imul,
+  Neg,
+  Shl,
+  Sar,
+  Shr,
+  Xor,
+  Cmp,
+  Test,
+  Setcc,
+  Cmovcc,
+  Cdq,
+  Cqo,
+  Idiv,
+  Push,
+  Pop,
+  Jmp,
+  Jcc,
+  Call,
+  Ret,
+  Leave,
+  Syscall,
+};
+
+// an aligned label is left unaligned rather than padded by more than this,
+// like GNU as does for .p2align 4,,10
+inline constexpr uint32_t kMaxAlignPadding = 10;
+
+struct Inst {
+  Opcode op;
+  Cond cc = Cond::E;  // Setcc, Cmovcc and Jcc
+  Operand dst = {};
+  Operand src = {};
+};
+
+struct Label {
+  enum class Kind : uint8_t { Symbol, Block, Stub, Literal };
+
+  Kind kind;
+  uint32_t a = 0;  // symbol, function or literal index
+  uint32_t b = 0;  // block
+  uint32_t c = 0;  // stub target block
+};
+
+/// A whole program: text, labels and the read-only string literals
+struct Program {
+  std::vector<Inst> text;
+  std::vector<Label> labels;
+  std::vector<std::string> symbols;  // names of Symbol labels
+  std::vector<std::string> strings;
+  uint32_t entry = 0;  // label of _start
+
+  uint32_t new_label(Label label) {
+    labels.push_back(label);
+    return static_cast<uint32_t>(labels.size() - 1);
+  }
+};
+
+std::string label_name(const Program& program, uint32_t label);
+
+/// GNU as source (Intel syntax) for a program, built in one buffer
+std::string print(const Program& program);
+
+}  // namespace x86
+
+#endif  // X86_H_
@@ -62,45 +62,49 @@ void CompilerContext::report_error(const std::string& error_kind,
   Log::Compiler::lexer_error(message, location);
 }
 
-void CompilerContext::push_scope() {
-  auto new_scope = std::make_unique<Scope>(current_scope);
-  current_scope = new_scope.get();
-  scope_storage.push_back(std::move(new_scope));
-}
-
-void CompilerContext::pop_scope() {
-  if (Scope* parent = current_scope->get_parent()) current_scope = parent;
+template <typename T>
+T* CompilerContext::create_symbol(const std::string& name, const Type* type,
+                                  SourceLocation loc) {
+  NameId id = names.intern(name);
+  if (scopes.lookup_local(id)) return nullptr;
+
+  T* symbol = symbols.create<T>();
+  symbol->name = name;
+  symbol->name_id = id;
+  symbol->type = type;
+  symbol->location = loc;
+
+  scopes.bind(id, symbol);
+  return symbol;
 }
 
 Symbol* CompilerContext::declare(const std::string& name, const Type* type,
                                  SourceLocation loc) {
-  assert(current_scope);
-  return current_scope->declare(name, type, loc);
+  return create_symbol<Symbol>(name, type, loc);
 }
 
 VariableSymbol* CompilerContext::declare(const std::string& name,
                                          const Type* type, bool is_mutable,
                                          SourceLocation loc) {
-  assert(current_scope);
-  return current_scope->declare(name, type, is_mutable, loc);
+  VariableSymbol* var = create_symbol<VariableSymbol>(name, type, loc);
+  if (var) var->is_mutable = is_mutable;
+  return var;
 }
 
 FunctionSymbol* CompilerContext::declare(
     const std::string& name, const Type* type,
     const std::vector<const Type*> param_types, SourceLocation loc) {
-  assert(current_scope);
-  return current_scope->declare(name, type, param_types, loc);
+  FunctionSymbol* func = create_symbol<FunctionSymbol>(name, type, loc);
+  if (func) func->param_types = param_types;
+  return func;
 }
 
-Symbol* CompilerContext::lookup(const std::string& name, bool walkParent) {
-  assert(current_scope);
-  return current_scope->lookup(name);
+bool CompilerContext::bind(Symbol* symbol) {
+  assert(symbol);
+  return scopes.bind(symbol->name_id, symbol);
 }
 
-Symbol* CompilerContext::lookup(const std::string& name, Scope* startingScope,
-                                bool walkParent) {
-  Scope* scope = startingScope ? startingScope : current_scope;
-
-  assert(scope);
-  return scope->lookup(name, scope, walkParent);
+Symbol* CompilerContext::lookup(const std::string& name) const {
+  NameId id = names.find(name);
+  return id == kInvalidName ? nullptr : scopes.lookup(id);
 }
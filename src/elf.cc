@@ -0,0 +1,111 @@
+#include "elf.hh"
+
+#include <elf.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "log.hh"
+
+namespace {
+
+constexpr uint64_t kBaseAddress = 0x400000;
+constexpr uint64_t kPageSize = 0x1000;
+
+uint64_t align(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+template <typename T>
+void append(std::vector<uint8_t>& out, const T& value) {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+}  // namespace
+
+bool write_executable(const std::string& path, x86::Image image) {
+  const bool has_rodata = !image.rodata.empty();
+  const uint16_t segments = has_rodata ? 3 : 2;
+
+  // the first segment maps the headers along with the text
+  const uint64_t text_offset =
+      align(sizeof(Elf64_Ehdr) + segments * sizeof(Elf64_Phdr), 16);
+  const uint64_t text_end = text_offset + image.text.size();
+  const uint64_t rodata_offset = align(text_end, 16);
+  // same offset within the page, one page past the end of the text
+  const uint64_t text_address = kBaseAddress + text_offset;
+  const uint64_t rodata_address = kBaseAddress + rodata_offset + kPageSize;
+
+  image.relocate(text_address, rodata_address);
+
+  Elf64_Ehdr header{};
+  std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS] = ELFCLASS64;
+  header.e_ident[EI_DATA] = ELFDATA2LSB;
+  header.e_ident[EI_VERSION] = EV_CURRENT;
+  header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  header.e_type = ET_EXEC;
+  header.e_machine = EM_X86_64;
+  header.e_version = EV_CURRENT;
+  header.e_entry = text_address + image.entry;
+  header.e_phoff = sizeof(Elf64_Ehdr);
+  header.e_ehsize = sizeof(Elf64_Ehdr);
+  header.e_phentsize = sizeof(Elf64_Phdr);
+  header.e_phnum = segments;
+
+  Elf64_Phdr text{};
+  text.p_type = PT_LOAD;
+  text.p_flags = PF_R | PF_X;
+  text.p_offset = 0;
+  text.p_vaddr = text.p_paddr = kBaseAddress;
+  text.p_filesz = text.p_memsz = text_end;
+  text.p_align = kPageSize;
+
+  Elf64_Phdr rodata{};
+  rodata.p_type = PT_LOAD;
+  rodata.p_flags = PF_R;
+  rodata.p_offset = rodata_offset;
+  rodata.p_vaddr = rodata.p_paddr = rodata_address;
+  rodata.p_filesz = rodata.p_memsz = image.rodata.size();
+  rodata.p_align = kPageSize;
+
+  Elf64_Phdr stack{};
+  stack.p_type = PT_GNU_STACK;
+  stack.p_flags = PF_R | PF_W;
+  stack.p_align = 16;
+
+  std::vector<uint8_t> out;
+  out.reserve(rodata_offset + image.rodata.size());
+  append(out, header);
+  append(out, text);
+  if (has_rodata) append(out, rodata);
+  append(out, stack);
+  out.resize(text_offset);
+  out.insert(out.end(), image.text.begin(), image.text.end());
+  if (has_rodata) {
+    out.resize(rodata_offset);
+    out.insert(out.end(), image.rodata.begin(), image.rodata.end());
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) return false;
+  file.write(reinterpret_cast<const char*>(out.data()),
+             static_cast<std::streamsize>(out.size()));
+  if (!file) return false;
+  file.close();
+
+  std::error_code error;
+  std::filesystem::permissions(path,
+                               std::filesystem::perms::owner_exec |
+                                   std::filesystem::perms::group_exec |
+                                   std::filesystem::perms::others_exec,
+                               std::filesystem::perm_options::add, error);
+  if (error) LOG_WARN("Could not make {} executable: {}", path,
+                      error.message());
+  LOG_DEBUG("[ELF] Wrote {} bytes of text, {} of rodata to {}",
+            image.text.size(), image.rodata.size(), path);
+  return true;
+}
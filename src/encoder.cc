@@ -0,0 +1,428 @@
+#include "encoder.hh"
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <limits>
+
+#include "log.hh"
+
+namespace x86 {
+
+namespace {
+
+// which operands a form accepts; One is an immediate 1 the opcode implies
+enum class Class : uint8_t { None, R, R32, RM, M, One, I8, I32, I64 };
+
+// where the register of a form goes
+enum class Field : uint8_t {
+  None,
+  Reg,      // ModRM.reg holds the register operand, ModRM.rm the other
+  Digit,    // ModRM.reg holds an opcode extension, ModRM.rm the operand
+  PlusReg,  // the low bits of the opcode
+  Both,     // ModRM.reg and ModRM.rm both hold dst (imul r, r, imm)
+};
+
+enum class Width : uint8_t { Operand, Never, Always };
+
+struct Form {
+  Opcode op;
+  Class dst;
+  Class src;
+  uint16_t opcode;  // 0x0fXX for two-byte opcodes
+  Field field;
+  uint8_t digit = 0;
+  Width width = Width::Operand;
+};
+
+// first matching row wins, so the shorter encodings come first
+constexpr Form kForms[] = {
+    {Opcode::Mov, Class::RM, Class::R, 0x89, Field::Reg},
+    {Opcode::Mov, Class::R, Class::M, 0x8b, Field::Reg},
+    {Opcode::Mov, Class::R32, Class::I32, 0xb8, Field::PlusReg},
+    {Opcode::Mov, Class::RM, Class::I32, 0xc7, Field::Digit, 0},
+    {Opcode::Mov, Class::R, Class::I64, 0xb8, Field::PlusReg},
+    {Opcode::Movzx, Class::R, Class::RM, 0x0fb6, Field::Reg},
+    {Opcode::Movsxd, Class::R, Class::RM, 0x63, Field::Reg, 0, Width::Always},
+    {Opcode::Lea, Class::R, Class::M, 0x8d, Field::Reg},
+
+    {Opcode::Add, Class::RM, Class::R, 0x01, Field::Reg},
+    {Opcode::Add, Class::R, Class::M, 0x03, Field::Reg},
+    {Opcode::Add, Class::RM, Class::I8, 0x83, Field::Digit, 0},
+    {Opcode::Add, Class::RM, Class::I32, 0x81, Field::Digit, 0},
+    {Opcode::Sub, Class::RM, Class::R, 0x29, Field::Reg},
+    {Opcode::Sub, Class::R, Class::M, 0x2b, Field::Reg},
+    {Opcode::Sub, Class::RM, Class::I8, 0x83, Field::Digit, 5},
+    {Opcode::Sub, Class::RM, Class::I32, 0x81, Field::Digit, 5},
+    {Opcode::Xor, Class::RM, Class::R, 0x31, Field::Reg},
+    {Opcode::Xor, Class::R, Class::M, 0x33, Field::Reg},
+    {Opcode::Xor, Class::RM, Class::I8, 0x83, Field::Digit, 6},
+    {Opcode::Xor, Class::RM, Class::I32, 0x81, Field::Digit, 6},
+    {Opcode::Cmp, Class::RM, Class::R, 0x39, Field::Reg},
+    {Opcode::Cmp, Class::R, Class::M, 0x3b, Field::Reg},
+    {Opcode::Cmp, Class::RM, Class::I8, 0x83, Field::Digit, 7},
+    {Opcode::Cmp, Class::RM, Class::I32, 0x81, Field::Digit, 7},
+    {Opcode::Test, Class::RM, Class::R, 0x85, Field::Reg},
+    {Opcode::Test, Class::RM, Class::I32, 0xf7, Field::Digit, 0},
+
+    {Opcode::Imul, Class::R, Class::RM, 0x0faf, Field::Reg},
+    {Opcode::Imul, Class::R, Class::I8, 0x6b, Field::Both},
+    {Opcode::Imul, Class::R, Class::I32, 0x69, Field::Both},
+    {Opcode::Neg, Class::RM, Class::None, 0xf7, Field::Digit, 3},
+    {Opcode::Shl, Class::RM, Class::One, 0xd1, Field::Digit, 4},
+    {Opcode::Sar, Class::RM, Class::One, 0xd1, Field::Digit, 7},
+    {Opcode::Shr, Class::RM, Class::One, 0xd1, Field::Digit, 5},
+    {Opcode::Shl, Class::RM, Class::I8, 0xc1, Field::Digit, 4},
+    {Opcode::Sar, Class::RM, Class::I8, 0xc1, Field::Digit, 7},
+    {Opcode::Shr, Class::RM, Class::I8, 0xc1, Field::Digit, 5},
+    {Opcode::Idiv, Class::RM, Class::None, 0xf7, Field::Digit, 7},
+    {Opcode::Setcc, Class::RM, Class::None, 0x0f90, Field::Digit, 0},
+    {Opcode::Cmovcc, Class::R, Class::RM, 0x0f40, Field::Reg},
+    {Opcode::Cdq, Class::None, Class::None, 0x99, Field::None, 0,
+     Width::Never},
+    {Opcode::Cqo, Class::None, Class::None, 0x99, Field::None, 0,
+     Width::Always},
+
+    {Opcode::Push, Class::R, Class::None, 0x50, Field::PlusReg, 0,
+     Width::Never},
+    {Opcode::Push, Class::M, Class::None, 0xff, Field::Digit, 6,
+     Width::Never},
+    {Opcode::Push, Class::I8, Class::None, 0x6a, Field::None, 0,
+     Width::Never},
+    {Opcode::Push, Class::I32, Class::None, 0x68, Field::None, 0,
+     Width::Never},
+    {Opcode::Pop, Class::R, Class::None, 0x58, Field::PlusReg, 0,
+     Width::Never},
+    {Opcode::Pop, Class::M, Class::None, 0x8f, Field::Digit, 0,
+     Width::Never},
+    {Opcode::Ret, Class::None, Class::None, 0xc3, Field::None, 0,
+     Width::Never},
+    {Opcode::Leave, Class::None, Class::None, 0xc9, Field::None, 0,
+     Width::Never},
+    {Opcode::Syscall, Class::None, Class::None, 0x0f05, Field::None, 0,
+     Width::Never},
+};
+
+bool fits(int64_t value, int64_t min, int64_t max) {
+  return value >= min && value <= max;
+}
+
+bool accepts(Class c, const Operand& operand) {
+  switch (c) {
+    case Class::None:
+      return operand.kind == Operand::Kind::None;
+    case Class::R:
+      return operand.is_reg();
+    case Class::R32:
+      return operand.is_reg() && operand.size == 4;
+    case Class::RM:
+      return operand.is_reg() || operand.is_mem();
+    case Class::M:
+      return operand.is_mem();
+    case Class::One:
+      return operand.is_imm() && operand.imm == 1;
+    case Class::I8:
+      return operand.is_imm() && fits(operand.imm, -128, 127);
+    case Class::I32:
+      return operand.is_imm() &&
+             fits(operand.imm, std::numeric_limits<int32_t>::min(),
+                  std::numeric_limits<int32_t>::max());
+    case Class::I64:
+      return operand.is_imm();
+  }
+  return false;
+}
+
+uint8_t immediate_size(Class c) {
+  return c == Class::I8 ? 1 : c == Class::I32 ? 4 : c == Class::I64 ? 8 : 0;
+}
+
+struct Assembler {
+  const Program& program;
+  Image image;
+  std::vector<uint32_t> literal_offsets;  // by literal index
+
+  void byte(uint8_t value) { image.text.push_back(value); }
+
+  void bytes(uint64_t value, uint8_t count) {
+    for (uint8_t i = 0; i < count; ++i) byte((value >> (8 * i)) & 0xff);
+  }
+
+  // ModRM, SIB and displacement for an operand in ModRM.rm
+  void modrm(uint8_t reg, const Operand& rm) {
+    if (rm.is_reg()) {
+      byte(0xc0 | (reg & 7) << 3 | (rm.reg & 7));
+      return;
+    }
+    if (rm.rip) {
+      const Label& label = program.labels[rm.label];
+      if (label.kind != Label::Kind::Literal)
+        LOG_FATAL("[ENCODE] rip-relative operand must name a literal");
+      byte(0x05 | (reg & 7) << 3);
+      image.relocations.push_back(
+          {static_cast<uint32_t>(image.text.size()), 0,
+           literal_offsets[label.a] + static_cast<uint32_t>(rm.disp)});
+      bytes(0, 4);
+      return;
+    }
+
+    const uint8_t base = rm.reg & 7;
+    const bool sib = rm.has_index || base == 4;
+    uint8_t mod = 2;
+    if (rm.disp == 0 && base != 5)
+      mod = 0;
+    else if (fits(rm.disp, -128, 127))
+      mod = 1;
+
+    byte(mod << 6 | (reg & 7) << 3 | (sib ? 4 : base));
+    if (sib)
+      byte(std::countr_zero(rm.scale) << 6 |
+           (rm.has_index ? (rm.index & 7) : 4) << 3 | base);
+    if (mod == 1) bytes(static_cast<uint8_t>(rm.disp), 1);
+    if (mod == 2) bytes(static_cast<uint32_t>(rm.disp), 4);
+  }
+
+  void encode(const Inst& inst, const Form& form) {
+    const size_t start = image.text.size();
+
+    // the register (or only) operand, and the one in ModRM.rm
+    const Operand* reg = nullptr;
+    const Operand* rm = nullptr;
+    const Operand* imm = nullptr;
+    if (inst.src.is_imm()) imm = &inst.src;
+    if (inst.dst.is_imm()) imm = &inst.dst;
+    switch (form.field) {
+      case Field::Reg:
+        reg = form.dst == Class::R ? &inst.dst : &inst.src;
+        rm = form.dst == Class::R ? &inst.src : &inst.dst;
+        break;
+      case Field::Digit:
+        rm = &inst.dst;
+        break;
+      case Field::PlusReg:
+        reg = &inst.dst;
+        break;
+      case Field::Both:
+        reg = rm = &inst.dst;
+        break;
+      case Field::None:
+        break;
+    }
+
+    const Operand& sized = inst.dst.is_imm() ? inst.src : inst.dst;
+    bool w = form.width == Width::Always ||
+             (form.width == Width::Operand && sized.size == 8);
+    uint8_t rex = 0x40 | (w ? 8 : 0);
+    if (form.field == Field::PlusReg) {
+      if (reg->reg >= 8) rex |= 1;
+    } else {
+      if (reg && reg->reg >= 8) rex |= 4;
+      if (rm && rm->is_reg() && rm->reg >= 8) rex |= 1;
+      if (rm && rm->is_mem() && !rm->rip) {
+        if (rm->reg >= 8) rex |= 1;
+        if (rm->has_index && rm->index >= 8) rex |= 2;
+      }
+    }
+    // spl, bpl, sil and dil only exist with a REX prefix
+    bool byte_reg = false;
+    for (const Operand* operand : {reg, rm})
+      if (operand && operand->is_reg() && operand->size == 1 &&
+          operand->reg >= 4)
+        byte_reg = true;
+    if (rex != 0x40 || byte_reg) byte(rex);
+
+    uint16_t opcode = form.opcode;
+    if (inst.op == Opcode::Setcc || inst.op == Opcode::Cmovcc)
+      opcode += static_cast<uint8_t>(inst.cc);
+    if (form.field == Field::PlusReg) opcode += reg->reg & 7;
+    if (opcode > 0xff) byte(opcode >> 8);
+    byte(opcode & 0xff);
+
+    if (form.field == Field::Reg || form.field == Field::Both)
+      modrm(reg->reg, *rm);
+    else if (form.field == Field::Digit)
+      modrm(form.digit, *rm);
+
+    if (imm) {
+      Class c = inst.dst.is_imm() ? form.dst : form.src;
+      bytes(static_cast<uint64_t>(imm->imm), immediate_size(c));
+    }
+
+    // rip-relative displacements count from the end of the instruction
+    for (auto it = image.relocations.rbegin();
+         it != image.relocations.rend() && it->offset >= start; ++it)
+      it->next = static_cast<uint32_t>(image.text.size());
+  }
+
+  bool encode(const Inst& inst) {
+    for (const Form& form : kForms)
+      if (form.op == inst.op && accepts(form.dst, inst.dst) &&
+          accepts(form.src, inst.src)) {
+        encode(inst, form);
+        return true;
+      }
+    return false;
+  }
+};
+
+bool is_branch(const Inst& inst) {
+  return inst.op == Opcode::Jmp || inst.op == Opcode::Jcc ||
+         inst.op == Opcode::Call;
+}
+
+// calls always take a rel32, jumps a rel8 until that is out of range
+uint32_t branch_size(const Inst& inst, bool wide) {
+  if (inst.op == Opcode::Call) return 5;
+  if (!wide) return 2;
+  return inst.op == Opcode::Jmp ? 5 : 6;
+}
+
+// bytes before a label to reach its alignment, none if that is too many
+uint32_t padding(const Inst& label, uint32_t pc) {
+  if (!label.src.is_imm()) return 0;
+  const auto align = static_cast<uint32_t>(label.src.imm);
+  const uint32_t bytes = (align - pc % align) % align;
+  return bytes <= kMaxAlignPadding ? bytes : 0;
+}
+
+// the multi-byte nops GNU as pads with, as few as possible
+void append_nops(std::vector<uint8_t>& text, uint32_t count) {
+  static constexpr uint8_t kNops[][10] = {
+      {0x90},
+      {0x66, 0x90},
+      {0x0f, 0x1f, 0x00},
+      {0x0f, 0x1f, 0x40, 0x00},
+      {0x0f, 0x1f, 0x44, 0x00, 0x00},
+      {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+      {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+      {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+      {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+      {0x66, 0x2e, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+  };
+  while (count > 0) {
+    const uint32_t size = std::min<uint32_t>(count, std::size(kNops));
+    text.insert(text.end(), kNops[size - 1], kNops[size - 1] + size);
+    count -= size;
+  }
+}
+
+}  // namespace
+
+Image encode(const Program& program) {
+  Assembler assembler{program, {}, {}};
+  Image& image = assembler.image;
+
+  for (const std::string& text : program.strings) {
+    assembler.literal_offsets.push_back(
+        static_cast<uint32_t>(image.rodata.size()));
+    image.rodata.insert(image.rodata.end(), text.begin(), text.end());
+    image.rodata.push_back(0);
+  }
+
+  // everything but branches is encoded once, into a scratch text
+  const size_t count = program.text.size();
+  std::vector<uint32_t> start(count + 1);
+  for (size_t i = 0; i < count; ++i) {
+    start[i] = static_cast<uint32_t>(image.text.size());
+    const Inst& inst = program.text[i];
+    if (inst.op == Opcode::Label || is_branch(inst)) continue;
+    if (!assembler.encode(inst))
+      LOG_FATAL("[ENCODE] No encoding for instruction {}",
+                static_cast<int>(inst.op));
+  }
+  start[count] = static_cast<uint32_t>(image.text.size());
+
+  // lay out branches, widening those whose target is too far
+  std::vector<uint8_t> wide(count, false);
+  std::vector<uint32_t> address(count + 1);
+  std::vector<uint32_t> labels(program.labels.size());
+  for (bool changed = true; changed;) {
+    changed = false;
+    uint32_t pc = 0;
+    for (size_t i = 0; i < count; ++i) {
+      address[i] = pc;
+      const Inst& inst = program.text[i];
+      if (inst.op == Opcode::Label) {
+        pc += padding(inst, pc);
+        labels[inst.dst.label] = pc;
+      }
+      pc += is_branch(inst) ? branch_size(inst, wide[i])
+                            : start[i + 1] - start[i];
+    }
+    address[count] = pc;
+
+    for (size_t i = 0; i < count; ++i) {
+      const Inst& inst = program.text[i];
+      if (inst.op != Opcode::Jmp && inst.op != Opcode::Jcc) continue;
+      if (wide[i]) continue;
+      int64_t distance = int64_t{labels[inst.dst.label]} - address[i] - 2;
+      if (!fits(distance, -128, 127)) {
+        wide[i] = true;
+        changed = true;
+      }
+    }
+  }
+
+  std::vector<uint8_t> text;
+  text.reserve(address[count]);
+  std::vector<Image::Relocation> relocations;
+  size_t next_relocation = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const Inst& inst = program.text[i];
+    if (!is_branch(inst)) {
+      // encoded bytes move from start[i] to address[i]
+      int64_t shift = int64_t{address[i]} - start[i];
+      while (next_relocation < image.relocations.size() &&
+             image.relocations[next_relocation].offset < start[i + 1]) {
+        Image::Relocation relocation = image.relocations[next_relocation++];
+        relocation.offset = static_cast<uint32_t>(relocation.offset + shift);
+        relocation.next = static_cast<uint32_t>(relocation.next + shift);
+        relocations.push_back(relocation);
+      }
+      text.insert(text.end(), image.text.begin() + start[i],
+                  image.text.begin() + start[i + 1]);
+      if (inst.op == Opcode::Label)
+        append_nops(text, labels[inst.dst.label] - address[i]);
+      continue;
+    }
+
+    uint32_t size = branch_size(inst, wide[i]);
+    int64_t rel = int64_t{labels[inst.dst.label]} - address[i] - size;
+    const uint8_t cc = static_cast<uint8_t>(inst.cc);
+    if (inst.op == Opcode::Call) {
+      text.push_back(0xe8);
+    } else if (!wide[i]) {
+      text.push_back(inst.op == Opcode::Jmp ? 0xeb : 0x70 + cc);
+      text.push_back(static_cast<uint8_t>(rel));
+      continue;
+    } else if (inst.op == Opcode::Jmp) {
+      text.push_back(0xe9);
+    } else {
+      text.push_back(0x0f);
+      text.push_back(0x80 + cc);
+    }
+    for (int b = 0; b < 4; ++b)
+      text.push_back((static_cast<uint32_t>(rel) >> (8 * b)) & 0xff);
+  }
+
+  image.text = std::move(text);
+  image.relocations = std::move(relocations);
+  image.symbols.resize(program.symbols.size());
+  for (uint32_t label = 0; label < program.labels.size(); ++label)
+    if (program.labels[label].kind == Label::Kind::Symbol)
+      image.symbols[program.labels[label].a] = labels[label];
+  image.entry = labels[program.entry];
+  return image;
+}
+
+void Image::relocate(uint64_t text_address, uint64_t rodata_address) {
+  for (const Relocation& relocation : relocations) {
+    int64_t disp = static_cast<int64_t>(rodata_address + relocation.target) -
+                   static_cast<int64_t>(text_address + relocation.next);
+    uint32_t value = static_cast<uint32_t>(disp);
+    for (int b = 0; b < 4; ++b)
+      text[relocation.offset + b] = (value >> (8 * b)) & 0xff;
+  }
+}
+
+}  // namespace x86
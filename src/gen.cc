@@ -1,476 +1,476 @@
 #include "gen.hh"
 
-#include <cassert>
-#include <sstream>
-#include <string>
+#include <algorithm>
+#include <iterator>
 
-#include "ast.hh"
+#include "ir/cfg.hh"
 #include "log.hh"
-#include "token.hh"
-#include "token_utils.hh"
 
-std::string CodeGenerator::generate(const ProgramNode<NodeInfo>& root) {
+using x86::Operand;
+
+x86::Program CodeGenerator::generate(const ir::Module& mod) {
   LOG_DEBUG("[GEN] Resetting areas");
-  // reset
-  text_section.str("");
-  text_section.clear();
-  rodata_section.str("");
-  rodata_section.clear();
-  current_stack_offset = 0;
-  label_counter = 0;
-  setupRegisters();
-
-  LOG_DEBUG("[GEN] Boilerplate");
-  text_section << ".intel_syntax noprefix\n";
-  text_section << ".section .text\n";
-  text_section << ".global _start\n";
-  // Enter main function scope
-  enter_scope();
-
-  LOG_DEBUG("[GEN] Accepting nodes");
-  auto& root_noconst = const_cast<ProgramNode<NodeInfo>&>(root);
-  // root_noconst.accept(*this);
-
-  // Exit main function scope
-  exit_scope();
-
-  LOG_DEBUG("[GEN] Eval stack");
-  // if (!eval_stack.empty()) {
-  //   std::string top = eval_stack.back();
-  //   eval_stack.pop_back();
-  //   emitMove("rax", top);
-  //   freeRegister(top);
-  // } else {
-  //   emitMove("rax", "0");
-  // }
-
-  LOG_DEBUG("[GEN] Leaving");
-  // leave
-  // emit("leave");
-  // emit("ret\n");
-
-  // generate entrypoint
-  emitLabel("\n_start");
-  emitCall("global_main_");
-  emitMove("rdi", "eax");
-  // emitMove("rdi", "eax");
-  emitMove("rax", "60");
-  emit("syscall");
-  emit("\n");
-
-  std::ostringstream out;
-  out << text_section.str();
-  if (!literal_pool_emission.empty()) {
-    out << ".section .rodata\n";
-    for (auto& p : literal_pool_emission) {
-      emitRodataLiteral(p.first, p.second);
-    }
-    out << rodata_section.str();
-    out << "\n";
+  program = {};
+  module = &mod;
+
+  size_t inst_count = 0;
+  for (const ir::Function& fn : mod.functions)
+    for (const ir::Block& block : fn.blocks) inst_count += block.insts.size();
+  program.text.reserve(4 * inst_count + 16);
+
+  function_labels.clear();
+  for (const ir::Function& fn : mod.functions) {
+    program.symbols.push_back(fn.name);
+    function_labels.push_back(program.new_label(
+        {x86::Label::Kind::Symbol,
+         static_cast<uint32_t>(program.symbols.size() - 1)}));
   }
+  literal_labels.clear();
+  for (uint32_t id = 0; id < mod.strings.size(); ++id)
+    literal_labels.push_back(
+        program.new_label({x86::Label::Kind::Literal, id}));
+  program.strings = mod.strings;
 
-  return out.str();
-}
+  for (function_id = 0; function_id < mod.functions.size(); ++function_id)
+    generateFunction(mod.functions[function_id]);
 
-void CodeGenerator::visit(ProgramNode<NodeInfo>& node) {
-  LOG_DEBUG("Code generator: Visiting ProgramNode with {} children",
-            node.children.size());
-  // nop
-  // this is handled in the programnode struct
-}
+  generateEntryPoint();
 
-void CodeGenerator::visit(VarDeclNode<NodeInfo>& node) {
-  std::string name = node.identifier.getValue();
-  // If this is a string variable, allocate two slots and store descriptor.
-  bool isStringDecl = (node.extra.resolved_type == TokenType::TOKEN_STRING) ||
-                      (node.type_token.getValue() == "string");
-  if (isStringDecl) {
-    ensureStringVarSlots(name);
-    if (node.initializer) {
-      storeCurrentStringToVar(name);
-      // Var decl does not leave a value on eval stack; pop any marker if
-      // present.
-      if (!eval_stack.empty() && eval_stack.back() == "$str") {
-        eval_stack.pop_back();
-      }
-    } else {
-      // zero initialize - need to get slots first
-      auto [ptrOff, lenOff] = ensureStringVarSlots(name);
-      emit("mov QWORD PTR " + formatSlot(ptrOff) + ", 0");
-      emit("mov QWORD PTR " + formatSlot(lenOff) + ", 0");
-    }
-  } else {
-    std::string loc =
-        ptrType(TokenUtils::token_to_bit_size(node.extra.sym->type_name)) +
-        " " + formatSlot(node);
-    if (node.initializer) {
-      std::string r = eval_stack.back();
-      eval_stack.pop_back();
-      emitMove(loc, r);
-      freeRegister(r);
-    } else {
-      emitMove(loc, "0");
-    }
-  }
+  module = nullptr;
+  function = nullptr;
+  return std::move(program);
 }
 
-void CodeGenerator::visit(BinaryExprNode<NodeInfo>& node) {
-  std::string right = eval_stack.back();
-  eval_stack.pop_back();
-  std::string left = eval_stack.back();
-  eval_stack.pop_back();
-  std::string dest = left;
-
-  if (isComparisonOp(node.op.getType()))
-    emitCompare(left, right);
-  else {
-    std::string dest = left;
-    emitArithmetic(node.op.getType(), left, right, dest);
-    eval_stack.push_back(left);
+void CodeGenerator::generateFunction(const ir::Function& fn) {
+  LOG_DEBUG("[GEN] Generating function: {}", fn.name);
+  function = &fn;
+  allocation = allocate_registers(fn);
+
+  block_labels.clear();
+  for (ir::BlockId block = 0; block < fn.blocks.size(); ++block)
+    block_labels.push_back(
+        program.new_label({x86::Label::Kind::Block, function_id, block}));
+  stub_labels.clear();
+  for (const EdgeStub& stub : allocation.stubs)
+    stub_labels.push_back(program.new_label(
+        {x86::Label::Kind::Stub, function_id, stub.from, stub.to}));
+
+  use_counts.assign(fn.reg_types.size(), 0);
+  flag_readers.assign(fn.reg_types.size(), 0);
+  for (const ir::Block& block : fn.blocks)
+    for (const ir::Inst& inst : block.insts)
+      ir::for_each_use(fn, inst, [&](ir::Reg reg) { ++use_counts[reg]; });
+
+  // loop headers get aligned
+  loop_heads.assign(fn.blocks.size(), false);
+  const ir::CFG cfg(fn);
+  const ir::DominatorTree dom(fn, cfg);
+  for (const ir::Loop& loop : ir::LoopInfo(fn, cfg, dom).loops)
+    loop_heads[loop.header] = true;
+
+  emitLabel(function_labels[function_id]);
+  emitPrologue();
+
+  for (current_block = 0; current_block < fn.blocks.size(); ++current_block) {
+    if (loop_heads[current_block])
+      emit(Opcode::Label, Operand::target(block_labels[current_block]),
+           Operand::immediate(kLoopAlignment));
+    else
+      emitLabel(block_labels[current_block]);
+    emitParallelMove(allocation.block_entry[current_block]);
+    findFlagReaders(fn.blocks[current_block]);
+
+    current_inst = allocation.block_start[current_block];
+    for (const ir::Inst& inst : fn.blocks[current_block].insts) {
+      emitParallelMove(allocation.moves_before[current_inst]);
+      if (ir::is_terminator(inst.op))
+        emitParallelMove(allocation.block_exit[current_block]);
+      generateInst(inst);
+      ++current_inst;
+    }
   }
-  freeRegister(right);
-}
 
-void CodeGenerator::visit(LiteralExprNode<NodeInfo>& node) {
-  if (TokenUtils::token_implicit_cast(node.literal_token.getType(),
-                                      TokenType::TOKEN_INT)) {
-    eval_stack.push_back(node.literal_token.getValue());
-  } else if (node.literal_token.getType() == TokenType::TOKEN_STRING) {
-    // Load string literal into RAX (ptr) and RDX (len)
-    loadStringLiteral(node.literal_token.getValue());
-    eval_stack.push_back("$str");
-  } else {  // only support int for now
-    LOG_WARN("[GEN] Unsupported type: {}", node.literal_token.to_string());
-    std::string r = allocateRegister(true, false);
-    if (r.empty()) r = "rax";
-    emit("xor " + r + ", " + r);
-    eval_stack.push_back(r);
+  // critical edges that needed moves
+  for (size_t i = 0; i < allocation.stubs.size(); ++i) {
+    emitLabel(stub_labels[i]);
+    emitParallelMove(allocation.stubs[i].moves);
+    emit(Opcode::Jmp, Operand::target(block_labels[allocation.stubs[i].to]));
   }
 }
 
-void CodeGenerator::visit(IdentifierExprNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Visited ident");
-
-  std::string name = node.identifier.getValue();
-  if (isStringVariable(name)) {
-    loadStringFromVar(name);  // RAX/RDX
-    eval_stack.push_back("$str");
-  } else {
-    int bit_size = TokenUtils::token_to_bit_size(node.extra.sym->type_name);
-    std::string var_location = ptrType(bit_size) + " " + formatSlot(node);
-    std::string r = allocateRegister(true, bit_size <= 32);
-    if (r.empty()) r = "rax";
-    emitMove(r, var_location);
-    eval_stack.push_back(r);
-  }
-}
-
-void CodeGenerator::visit(IfStmtNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Visited ifstmt");
-  if (if_stack.empty()) return;
-  const auto& ctx = if_stack.back();
-  if (auto* cond =
-          dynamic_cast<BinaryExprNode<NodeInfo>*>(node.condition.get())) {
-    switch (cond->op.getType()) {
-      case TokenType::TOKEN_DEQ:
-        emitConditionalJump("ne", ctx.false_label);
-        break;
-      case TokenType::TOKEN_NEQ:
-        emitConditionalJump("e", ctx.false_label);
-        break;
-      case TokenType::TOKEN_GEQ:
-        emitConditionalJump("l", ctx.false_label);
-        break;
-      case TokenType::TOKEN_GT:
-        emitConditionalJump("le", ctx.false_label);
-        break;
-      case TokenType::TOKEN_LEQ:
-        emitConditionalJump("g", ctx.false_label);
-        break;
-      case TokenType::TOKEN_LT:
-        emitConditionalJump("ge", ctx.false_label);
-        break;
-      default:
-        LOG_ERROR("[GEN] Expected conditional operator, found {}",
-                  cond->op.to_string());
+void CodeGenerator::findFlagReaders(const ir::Block& block) {
+  reads_flags.assign(block.insts.size(), false);
+
+  // moves and constants in between are plain movs, which keep the flags,
+  // and so are selects on the same flags
+  ir::Reg compare = ir::kNoReg;
+  for (size_t i = 0; i < block.insts.size(); ++i) {
+    const ir::Inst& inst = block.insts[i];
+    if (ir::is_compare(inst.op)) {
+      compare = inst.dst;
+    } else if ((inst.op == ir::Op::Select || inst.op == ir::Op::CondBr) &&
+               inst.a == compare) {
+      reads_flags[i] = true;
+      ++flag_readers[compare];
+    } else if (inst.op != ir::Op::Copy && inst.op != ir::Op::Const &&
+               inst.op != ir::Op::Nop) {
+      compare = ir::kNoReg;
     }
   }
 }
 
-void CodeGenerator::visit(WhileStmtNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Visited whilestmt");
-  if (while_stack.empty()) return;
-  const auto& ctx = while_stack.back();
-  if (auto* cond =
-          dynamic_cast<BinaryExprNode<NodeInfo>*>(node.condition.get())) {
-    switch (cond->op.getType()) {
-      case TokenType::TOKEN_DEQ:
-        emitConditionalJump("ne", ctx.end_label);
-        break;
-      case TokenType::TOKEN_GEQ:
-        emitConditionalJump("l", ctx.end_label);
-        break;
-      case TokenType::TOKEN_GT:
-        emitConditionalJump("le", ctx.end_label);
-        break;
-      case TokenType::TOKEN_LEQ:
-        emitConditionalJump("g", ctx.end_label);
-        break;
-      case TokenType::TOKEN_LT:
-        emitConditionalJump("ge", ctx.end_label);
-        break;
-      default:
-        LOG_ERROR("[GEN] Expected conditional operator, found {}",
-                  cond->op.to_string());
-    }
-  }
-}
-
-void CodeGenerator::visit(BlockNode<NodeInfo>& node) { (void)node; }
-
-void CodeGenerator::visit(AssignmentExprNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Visited assignmentExpr");
-  std::string rhs_marker = eval_stack.back();
-  eval_stack.pop_back();
-
-  if (!eval_stack.empty()) {
-    std::string left_marker = eval_stack.back();
-    eval_stack.pop_back();
-    if (left_marker != "$str") {
-      freeRegister(left_marker);
-    }
+void CodeGenerator::emitPrologue() {
+  const ir::Function& fn = *function;
+  size_t slots = allocation.callee_saved.size() + allocation.spill_slots;
+  int64_t frame = (8 * slots + 15) & ~size_t{15};
+
+  emit(Opcode::Push, Operand::r64(x86::rbp));
+  emit(Opcode::Mov, Operand::r64(x86::rbp), Operand::r64(x86::rsp));
+  if (frame > 0)
+    emit(Opcode::Sub, Operand::r64(x86::rsp), Operand::immediate(frame));
+  for (size_t i = 0; i < allocation.callee_saved.size(); ++i)
+    emit(Opcode::Mov, slot(i, 8), Operand::r64(allocation.callee_saved[i]));
+
+  // incoming arguments: six in registers, the rest above the return address
+  pending_moves.clear();
+  for (ir::Reg param = 0; param < fn.params.size() && param < 6; ++param) {
+    Location home = allocation.at(param, 0);
+    if (home.kind != Location::Kind::None)
+      pending_moves.push_back(
+          {Location::in(x86::kArgumentRegs[param]), home, isWide(param)});
   }
-
-  if (auto* identifier =
-          dynamic_cast<IdentifierExprNode<NodeInfo>*>(node.left.get())) {
-    std::string var_name = identifier->identifier.getValue();
-    if (isStringVariable(var_name)) {
-      // RAX/RDX already hold the RHS string if rhs_marker == "$str"
-      if (rhs_marker != "$str") {
-        // If someone assigned an int to string (shouldn't happen if sema is
-        // correct), coerce to empty
-        loadStringLiteral("");
-      }
-      storeCurrentStringToVar(var_name);
-      // For assignment expression value, leave string in RAX/RDX but don't push
-      // marker to avoid accidental emission.
-    } else {
-      std::string var_location = formatSlot(*identifier);
-      // rhs_marker contains a register name
-      emitMove(var_location, rhs_marker);
-      eval_stack.push_back(rhs_marker);
-    }
-  } else {
-    LOG_WARN("[GEN] Unsupported assignmentExpr type");
+  emitParallelMove(std::span<const Move>(pending_moves));
+
+  for (ir::Reg param = 6; param < fn.params.size(); ++param) {
+    Location home = allocation.at(param, 0);
+    if (home.kind == Location::Kind::None) continue;
+    x86::Reg reg = home.is_reg() ? home.reg : x86::r11;
+    emit(Opcode::Mov, Operand::r64(reg),
+         Operand::mem(x86::rbp, 16 + 8 * (param - 6), 8));
+    emitMove(home, Location::in(reg), isWide(param));
   }
 }
 
-void CodeGenerator::visit(ASTNode<NodeInfo>& node) {
-  ASTVisitor<NodeInfo>::visit(node);
-}
-
-void CodeGenerator::visit(UnaryExprNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Visited unary expr");
-  std::string operand = eval_stack.back();
-  eval_stack.pop_back();
-
-  if (node.op.getType() == TokenType::TOKEN_MINUS) {
-    emit("neg " + operand);
-    eval_stack.push_back(operand);
-  }
+void CodeGenerator::emitEpilogue() {
+  for (size_t i = 0; i < allocation.callee_saved.size(); ++i)
+    emit(Opcode::Mov, Operand::r64(allocation.callee_saved[i]), slot(i, 8));
+  emit(Opcode::Leave);
+  emit(Opcode::Ret);
 }
 
-void CodeGenerator::visit(MethodCallNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Visited MethodCall");
-
-  if (node.expr) node.expr->accept(*this);
-
-  size_t arg_count = node.arg_list.size();
-  std::vector<std::string> arg_vals;
-  for (size_t i = 0; i < arg_count; ++i) {
-    arg_vals.push_back(eval_stack.back());
-    eval_stack.pop_back();
-  }
-  std::reverse(arg_vals.begin(), arg_vals.end());
-
-  std::vector<std::string> spilled;
-  spill_live_regs(spilled);
-
-  size_t reg_arg_count =
-      std::min(arg_count, function_arg_registers_abi32.size());
-  size_t stack_arg_count =
-      arg_count > reg_arg_count ? arg_count - reg_arg_count : 0;
-
-  for (size_t i = 0; i < stack_arg_count; ++i) {
-    LOG_DEBUG("arg_vals.size {}, arg_vals.size() - i {}", arg_vals.size(),
-
-              arg_vals.size() - i);
-    emit("push " + arg_vals[arg_vals.size() - i - 1]);
+void CodeGenerator::emitMove(const Location& to, const Location& from,
+                             bool wide) {
+  if (to == from) return;
+  if (from.kind == Location::Kind::None || to.kind == Location::Kind::None) {
+    LOG_FATAL("[GEN] Move of an unallocated value in {}", function->name);
+    return;
   }
 
-  size_t stack_bytes = stack_arg_count * 8;
-  // if ((stack_bytes % 16) != 0) {
-  //   emit("sub rsp, 8");  // align
-  //   stack_bytes += 8;
-  // }
-
-  std::vector<std::string> used_function_arg_regs;
-
-  for (size_t i = reg_arg_count; i-- > 0;) {
-    if (TokenUtils::token_to_bit_size(node.arg_list[i]->extra.sym->type_name) <=
-        32) {
-      emitMove(function_arg_registers32[i], arg_vals[i]);
-      used_function_arg_regs.push_back(function_arg_registers32[i]);
-    } else {
-      emitMove(function_arg_registers64[i], arg_vals[i]);
-      used_function_arg_regs.push_back(function_arg_registers64[i]);
-    }
-    freeRegister(arg_vals[i]);
-  }
-
-  // uhh currently only static, if instance use rdi reg
-
-  std::string owner = node.extra.sym->owner_class.empty()
-                          ? "global"
-                          : node.extra.sym->owner_class;
-
-  const Symbol* overload = ctx.method_table.find_overload(
-      owner, node.extra.sym->name, node.extra.sym->param_types);
-
-  emitCall(overload->method_key);
-
-  if (overload->type != TokenType::TOKEN_UNKNOWN) {
-    int bit_size = TokenUtils::token_to_bit_size(overload->type_name);
-    std::string reg = allocateRegister(true, bit_size <= 32);
-    emitMove(reg, bit_size <= 32 ? "eax" : "rax");
-    eval_stack.push_back(reg);
+  if (to.is_stack() && from.is_stack()) {
+    const Location r11 = Location::in(x86::r11);
+    emit(Opcode::Mov, operand(r11, wide), operand(from, wide));
+    emit(Opcode::Mov, operand(to, wide), operand(r11, wide));
+    return;
   }
-
-  if (stack_bytes > 0) emit("add rsp, " + std::to_string(stack_bytes));
-
-  for (auto reg : used_function_arg_regs) freeRegister(reg);
-
-  restore_spilled(spilled);
-
-  // free all registers args took
-
-  // eval_stack.push_back("rax");
+  emit(Opcode::Mov, operand(to, wide), operand(from, wide));
 }
 
-void CodeGenerator::visit(ArgumentNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Visited ArgumentNode");
-}
+void CodeGenerator::emitParallelMove(std::span<const Move> parallel) {
+  if (parallel.empty()) return;
 
-void CodeGenerator::visit(ParamNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Visited ParamNode");
-}
-
-void CodeGenerator::visit(ReturnStmtNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Visited returnstmt");
-  std::string marker = eval_stack.back();
-  eval_stack.pop_back();
-
-  if (marker != "$str") {
-    emitMove(TokenUtils::token_to_bit_size(node.ret->extra.sym->type_name,
-                                           node.ret->extra.sym->type) <= 32
-                 ? "eax"
-                 : "rax",
-             marker);
+  // the caller's moves may live in pending_moves already
+  Move buffer[16];
+  std::vector<Move> overflow;
+  Move* moves = buffer;
+  if (parallel.size() > std::size(buffer)) {
+    overflow.assign(parallel.begin(), parallel.end());
+    moves = overflow.data();
+  } else {
+    std::copy(parallel.begin(), parallel.end(), buffer);
   }
-}
-
-void CodeGenerator::visit(ClassNode<NodeInfo>& node) {
-  // Stub: not implemented yet
-}
 
-void CodeGenerator::visit(FieldDeclNode<NodeInfo>& node) {
-  // Stub: not implemented yet
-}
-
-void CodeGenerator::visit(MethodDeclNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Generating method: {}", node.identifier.getValue());
-  (void)node;
-}
+  size_t count = 0;
+  for (size_t i = 0; i < parallel.size(); ++i)
+    if (moves[i].from != moves[i].to) moves[count++] = moves[i];
+
+  auto read_by_other = [&](size_t index) {
+    for (size_t i = 0; i < count; ++i)
+      if (i != index && moves[i].from == moves[index].to) return true;
+    return false;
+  };
+
+  while (count > 0) {
+    size_t ready = 0;
+    while (ready < count && read_by_other(ready)) ++ready;
+    if (ready < count) {
+      emitMove(moves[ready].to, moves[ready].from, moves[ready].wide);
+      std::copy(moves + ready + 1, moves + count, moves + ready);
+      --count;
+      continue;
+    }
 
-void CodeGenerator::visit(ConstructorDeclNode<NodeInfo>& node) {
-  // Stub: not implemented yet
-}
-void CodeGenerator::visit(ExprStmtNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Visited exprstmt");
-  (void)node;
-  if (!eval_stack.empty() && eval_stack.back() == "$str") {
-    emitWriteCurrentString();
-    eval_stack.pop_back();
+    // only cycles are left: park one destination in rax and read it there
+    const Location blocked = moves[0].to;
+    const Location saved = Location::in(x86::rax);
+    bool wide = false;
+    for (size_t i = 0; i < count; ++i)
+      if (moves[i].from == blocked) wide = wide || moves[i].wide;
+    emitMove(saved, blocked, wide);
+    for (size_t i = 0; i < count; ++i)
+      if (moves[i].from == blocked) moves[i].from = saved;
   }
 }
 
-void CodeGenerator::enter(BlockNode<NodeInfo>&) { enter_scope(); }
-
-void CodeGenerator::exit(BlockNode<NodeInfo>&) { exit_scope(); }
-
-void CodeGenerator::enter(IfStmtNode<NodeInfo>& node) {
-  IfContext ctx;
-  ctx.false_label = generateUniqueLabel("if_false");
-  ctx.end_label = generateUniqueLabel("if_end");
-  ctx.has_else = (node.else_stmt != nullptr);
-  if_stack.push_back(ctx);
+x86::Cond CodeGenerator::emitTest(ir::Reg cond) {
+  const size_t index = current_inst - allocation.block_start[current_block];
+  if (reads_flags[index]) return flags_cc;
+
+  Location location = use(cond);
+  Operand tested = operand(location, isWide(cond));
+  if (location.is_reg())
+    emit(Opcode::Test, tested, tested);
+  else
+    emit(Opcode::Cmp, tested, Operand::immediate(0));
+  return x86::Cond::NE;
 }
 
-void CodeGenerator::before_else(IfStmtNode<NodeInfo>&) {
-  if (if_stack.empty()) return;
-  const auto& ctx = if_stack.back();
-  emitJump(ctx.end_label);
-  emitLabel(ctx.false_label);
+x86::Reg CodeGenerator::inRegister(const Location& location, x86::Reg scratch,
+                                   bool wide) {
+  if (location.is_reg()) return location.reg;
+  emitMove(Location::in(scratch), location, wide);
+  return scratch;
 }
 
-void CodeGenerator::exit(IfStmtNode<NodeInfo>&) {
-  if (if_stack.empty()) return;
-  const auto& ctx = if_stack.back();
-  if (ctx.has_else) {
-    emitLabel(ctx.end_label);
-  } else {
-    emitLabel(ctx.false_label);
+void CodeGenerator::generateInst(const ir::Inst& inst) {
+  using ir::Op;
+
+  const bool wide = ir::is_wide(inst.ty);
+  const Location rax = Location::in(x86::rax);
+
+  switch (inst.op) {
+    case Op::Nop:
+      break;
+    case Op::Const: {
+      Location dst = def(inst.dst);
+      int64_t value = wide ? inst.imm : static_cast<int32_t>(inst.imm);
+      if (dst.is_stack() && value != static_cast<int32_t>(value)) {
+        emit(Opcode::Mov, Operand::r64(x86::rax), Operand::immediate(value));
+        emitMove(dst, rax, wide);
+        break;
+      }
+      emit(Opcode::Mov, operand(dst, wide), Operand::immediate(value));
+      break;
+    }
+    case Op::Copy:
+      emitMove(def(inst.dst), use(inst.a), wide);
+      break;
+    case Op::Add:
+    case Op::Sub:
+    case Op::Mul: {
+      const Opcode op = inst.op == Op::Add   ? Opcode::Add
+                        : inst.op == Op::Sub ? Opcode::Sub
+                                             : Opcode::Imul;
+      Location dst = def(inst.dst);
+      Location a = use(inst.a);
+      Location b = use(inst.b);
+      if (dst.is_reg() && dst == b && inst.op != Op::Sub) {
+        emit(op, operand(dst, wide), operand(a, wide));
+      } else if (dst.is_reg() && dst != b) {
+        emitMove(dst, a, wide);
+        emit(op, operand(dst, wide), operand(b, wide));
+      } else {
+        emitMove(rax, a, wide);
+        emit(op, operand(rax, wide), operand(b, wide));
+        emitMove(dst, rax, wide);
+      }
+      break;
+    }
+    case Op::Div:
+      emitMove(rax, use(inst.a), wide);
+      emit(wide ? Opcode::Cqo : Opcode::Cdq);
+      emit(Opcode::Idiv, operand(use(inst.b), wide));
+      emitMove(def(inst.dst), rax, wide);
+      break;
+    case Op::Neg: {
+      Location dst = def(inst.dst);
+      emitMove(dst, use(inst.a), wide);
+      emit(Opcode::Neg, operand(dst, wide));
+      break;
+    }
+    case Op::Shl:
+    case Op::Sar:
+    case Op::Shr: {
+      const Opcode op = inst.op == Op::Shl   ? Opcode::Shl
+                        : inst.op == Op::Sar ? Opcode::Sar
+                                             : Opcode::Shr;
+      Location dst = def(inst.dst);
+      emitMove(dst, use(inst.a), wide);
+      emit(op, operand(dst, wide), Operand::immediate(inst.imm));
+      break;
+    }
+    case Op::Sext: {
+      Location dst = def(inst.dst);
+      x86::Reg reg = dst.is_reg() ? dst.reg : x86::rax;
+      emit(Opcode::Movsxd, Operand::r64(reg), operand(use(inst.a), false));
+      emitMove(dst, Location::in(reg), true);
+      break;
+    }
+    case Op::Trunc: {
+      // always a move, it clears the upper half
+      Location dst = def(inst.dst);
+      x86::Reg reg = inRegister(use(inst.a), x86::rax, true);
+      emit(Opcode::Mov, operand(dst, false), Operand::r32(reg));
+      break;
+    }
+    case Op::Eq:
+    case Op::Ne:
+    case Op::Lt:
+    case Op::Le:
+    case Op::Gt:
+    case Op::Ge: {
+      // operands may be narrower than 32 bits but are kept extended
+      bool wide_operands = isWide(inst.a);
+      Location a = use(inst.a);
+      Location b = use(inst.b);
+      if (a.is_stack() && b.is_stack()) {
+        emitMove(rax, a, wide_operands);
+        a = rax;
+      }
+      emit(Opcode::Cmp, operand(a, wide_operands), operand(b, wide_operands));
+
+      // readers of the flags need no boolean, it is only made for others
+      flags_cc = conditionCode(inst.op);
+      if (flag_readers[inst.dst] == use_counts[inst.dst]) break;
+      Location dst = def(inst.dst);
+      x86::Reg reg = dst.is_reg() ? dst.reg : x86::rax;
+      emitCond(Opcode::Setcc, conditionCode(inst.op), Operand::r8(reg));
+      emit(Opcode::Movzx, Operand::r32(reg), Operand::r8(reg));
+      emitMove(dst, Location::in(reg), false);
+      break;
+    }
+    case Op::Select: {
+      x86::Cond cc = emitTest(inst.a);
+      Location dst = def(inst.dst);
+      x86::Reg reg = dst.is_reg() ? dst.reg : x86::rax;
+      Location chosen = use(inst.b);
+      Location other = use(inst.c);
+      // cmov only loads into a register, which holds the other choice first
+      if (chosen == Location::in(reg)) {
+        std::swap(chosen, other);
+        cc = x86::invert(cc);
+      }
+      emitMove(Location::in(reg), other, wide);
+      emitCond(Opcode::Cmovcc, cc, operand(Location::in(reg), wide),
+               operand(chosen, wide));
+      emitMove(dst, Location::in(reg), wide);
+      break;
+    }
+    case Op::LoadByte: {
+      x86::Reg base = inRegister(use(inst.a), x86::rax, true);
+      x86::Reg index = inRegister(use(inst.b), x86::rdx, false);
+      Location dst = def(inst.dst);
+      x86::Reg reg = dst.is_reg() ? dst.reg : x86::rax;
+      emit(Opcode::Movzx, Operand::r32(reg), Operand::mem(base, index, 1));
+      emitMove(dst, Location::in(reg), false);
+      break;
+    }
+    case Op::StrAddr: {
+      Location dst = def(inst.dst);
+      x86::Reg reg = dst.is_reg() ? dst.reg : x86::rax;
+      emit(Opcode::Lea, Operand::r64(reg),
+           Operand::rip_relative(literal_labels[inst.imm]));
+      emitMove(dst, Location::in(reg), true);
+      break;
+    }
+    case Op::Call:
+      generateCall(inst);
+      break;
+    case Op::Phi:
+      LOG_FATAL("[GEN] Phi in {}, leave SSA before code generation",
+                function->name);
+      break;
+    case Op::Print:
+      emitParallelMove({{use(inst.a), Location::in(x86::rsi), true},   // buf
+                        {use(inst.b), Location::in(x86::rdx), true}});  // len
+      // write(stdout, buf, len)
+      emit(Opcode::Mov, Operand::r32(x86::rax), Operand::immediate(1));
+      emit(Opcode::Mov, Operand::r32(x86::rdi), Operand::immediate(1));
+      emit(Opcode::Syscall);
+      break;
+    case Op::Br:
+      emitJump(inst.target);
+      break;
+    case Op::CondBr: {
+      const x86::Cond cc = emitTest(inst.a);
+
+      // fall through to the next block on whichever side leads there,
+      // which is the loop body or the then branch as lowered
+      const uint32_t taken = edgeLabel(inst.target);
+      const uint32_t not_taken = edgeLabel(inst.other);
+      const uint32_t next = current_block + 1 < function->blocks.size()
+                                ? block_labels[current_block + 1]
+                                : UINT32_MAX;
+      if (taken == next) {
+        emitCond(Opcode::Jcc, x86::invert(cc), Operand::target(not_taken));
+        break;
+      }
+      emitCond(Opcode::Jcc, cc, Operand::target(taken));
+      if (not_taken != next) emit(Opcode::Jmp, Operand::target(not_taken));
+      break;
+    }
+    case Op::Ret: {
+      Move moves[2];
+      size_t count = 0;
+      if (inst.a != ir::kNoReg)
+        moves[count++] = {use(inst.a), rax, isWide(inst.a)};
+      if (inst.b != ir::kNoReg)
+        moves[count++] = {use(inst.b), Location::in(x86::rdx), isWide(inst.b)};
+      emitParallelMove(std::span<const Move>(moves, count));
+      emitEpilogue();
+      break;
+    }
   }
-  if_stack.pop_back();
 }
 
-void CodeGenerator::enter(WhileStmtNode<NodeInfo>&) {
-  WhileContext ctx;
-  ctx.start_label = generateUniqueLabel("loop_start");
-  ctx.end_label = generateUniqueLabel("loop_end");
-  while_stack.push_back(ctx);
-  emitLabel(ctx.start_label);
-}
-
-void CodeGenerator::exit(WhileStmtNode<NodeInfo>&) {
-  if (while_stack.empty()) return;
-  const auto& ctx = while_stack.back();
-  emitJump(ctx.start_label);
-  emitLabel(ctx.end_label);
-  while_stack.pop_back();
-}
+void CodeGenerator::generateCall(const ir::Inst& inst) {
+  auto args = function->args(inst);
+  size_t stack_args = args.size() > 6 ? args.size() - 6 : 0;
 
-void CodeGenerator::enter(MethodDeclNode<NodeInfo>& node) {
-  LOG_DEBUG("[GEN] Generating method: {}", node.identifier.getValue());
-  emitLabel(node.extra.sym->method_key);
-  emit("push rbp");
-  emitMove("rbp", "rsp");
-  emit("sub rsp, " + std::to_string(node.extra.frame_size));
-
-  for (size_t i = 0;
-       i < node.param_list.size() && i < function_arg_registers_abi32.size();
-       ++i) {
-    int bit_size =
-        TokenUtils::token_to_bit_size(node.param_list[i]->extra.sym->type_name);
-    std::string param_reg = bit_size <= 32 ? function_arg_registers32[i]
-                                           : function_arg_registers64[i];
-    std::string local_slot =
-        ptrType(bit_size) + " " + formatSlot(*node.param_list[i]);
-    emitMove(local_slot, param_reg);
+  // rsp stays 16-byte aligned at the call
+  int64_t stack_bytes = 8 * stack_args;
+  if (stack_args % 2 != 0) {
+    emit(Opcode::Sub, Operand::r64(x86::rsp), Operand::immediate(8));
+    stack_bytes += 8;
   }
+  for (size_t i = args.size(); i-- > 6;)
+    emit(Opcode::Push, operand(use(args[i]), true));
+
+  pending_moves.clear();
+  for (size_t i = 0; i < args.size() && i < 6; ++i)
+    pending_moves.push_back({use(args[i]),
+                             Location::in(x86::kArgumentRegs[i]),
+                             isWide(args[i])});
+  emitParallelMove(std::span<const Move>(pending_moves));
+
+  emit(Opcode::Call, Operand::target(function_labels[inst.callee]));
+  if (stack_bytes > 0)
+    emit(Opcode::Add, Operand::r64(x86::rsp), Operand::immediate(stack_bytes));
+
+  if (inst.dst != ir::kNoReg)
+    emitMove(def(inst.dst), Location::in(x86::rax), isWide(inst.dst));
+  if (inst.dst2 != ir::kNoReg)
+    emitMove(def(inst.dst2), Location::in(x86::rdx), isWide(inst.dst2));
 }
 
-void CodeGenerator::exit(MethodDeclNode<NodeInfo>&) {
-  // emit("pop rbp");
-  emitReturn();
+void CodeGenerator::generateEntryPoint() {
+  program.symbols.push_back("_start");
+  program.entry = program.new_label(
+      {x86::Label::Kind::Symbol,
+       static_cast<uint32_t>(program.symbols.size() - 1)});
+
+  emitLabel(program.entry);
+  emit(Opcode::Call, Operand::target(function_labels[module->entry]));
+  emit(Opcode::Mov, Operand::r32(x86::rdi), Operand::r32(x86::rax));
+  emit(Opcode::Mov, Operand::r32(x86::rax), Operand::immediate(60));  // exit
+  emit(Opcode::Syscall);
 }
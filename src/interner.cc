@@ -0,0 +1,57 @@
+#include "interner.hh"
+
+NameInterner::NameInterner() : slots(64, 0) { intern(""); }
+
+uint64_t NameInterner::hash(std::string_view name) {
+  // FNV-1a, identifiers are short so this beats anything fancier
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (unsigned char c : name) {
+    h ^= c;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+size_t NameInterner::probe(std::string_view name, uint64_t h) const {
+  size_t mask = slots.size() - 1;
+  size_t i = h & mask;
+  while (slots[i] != 0) {
+    NameId id = slots[i] - 1;
+    if (hashes[id] == h && names[id] == name) return i;
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+NameId NameInterner::find(std::string_view name) const {
+  size_t i = probe(name, hash(name));
+  return slots[i] ? slots[i] - 1 : kInvalidName;
+}
+
+NameId NameInterner::intern(std::string_view name) {
+  uint64_t h = hash(name);
+  size_t i = probe(name, h);
+  if (slots[i] != 0) return slots[i] - 1;
+
+  NameId id = static_cast<NameId>(names.size());
+  names.emplace_back(name);
+  hashes.push_back(h);
+  slots[i] = id + 1;
+
+  // keep the load factor under 1/2 so probe sequences stay short
+  if (names.size() * 2 > slots.size()) grow();
+  return id;
+}
+
+void NameInterner::grow() {
+  std::vector<uint32_t> old = std::move(slots);
+  slots.assign(old.size() * 2, 0);
+  size_t mask = slots.size() - 1;
+
+  for (uint32_t entry : old) {
+    if (entry == 0) continue;
+    size_t i = hashes[entry - 1] & mask;
+    while (slots[i] != 0) i = (i + 1) & mask;
+    slots[i] = entry;
+  }
+}
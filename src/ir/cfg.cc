@@ -0,0 +1,177 @@
+#include "ir/cfg.hh"
+
+#include <algorithm>
+
+namespace ir {
+
+CFG::CFG(const Function& fn)
+    : preds(fn.blocks.size()),
+      succs(fn.blocks.size()),
+      rpo_index(fn.blocks.size(), UINT32_MAX) {
+  for (BlockId id = 0; id < fn.blocks.size(); ++id) {
+    const Inst* term = fn.blocks[id].terminator();
+    if (!term) continue;
+    for (BlockId succ : successors(*term)) {
+      succs[id].push_back(succ);
+      preds[succ].push_back(id);
+    }
+  }
+
+  if (fn.blocks.empty()) return;
+
+  // iterative dfs, a block is finished once all its successors are
+  std::vector<BlockId> post_order;
+  std::vector<bool> visited(fn.blocks.size(), false);
+  std::vector<std::pair<BlockId, size_t>> stack = {{0, 0}};
+  visited[0] = true;
+  while (!stack.empty()) {
+    auto& [block, next] = stack.back();
+    if (next < succs[block].size()) {
+      BlockId succ = succs[block][next++];
+      if (!visited[succ]) {
+        visited[succ] = true;
+        stack.push_back({succ, 0});
+      }
+      continue;
+    }
+    post_order.push_back(block);
+    stack.pop_back();
+  }
+
+  rpo.assign(post_order.rbegin(), post_order.rend());
+  for (uint32_t i = 0; i < rpo.size(); ++i) rpo_index[rpo[i]] = i;
+}
+
+DominatorTree::DominatorTree(const Function& fn, const CFG& cfg)
+    : idom(fn.blocks.size(), kNoBlock),
+      children(fn.blocks.size()),
+      frontier(fn.blocks.size()),
+      pre(fn.blocks.size(), 0),
+      post(fn.blocks.size(), 0) {
+  if (cfg.rpo.empty()) return;
+
+  auto intersect = [&](BlockId a, BlockId b) {
+    while (a != b) {
+      while (cfg.rpo_index[a] > cfg.rpo_index[b]) a = idom[a];
+      while (cfg.rpo_index[b] > cfg.rpo_index[a]) b = idom[b];
+    }
+    return a;
+  };
+
+  const BlockId entry = cfg.rpo.front();
+  idom[entry] = entry;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (BlockId block : cfg.rpo) {
+      if (block == entry) continue;
+      BlockId dom = kNoBlock;
+      for (BlockId pred : cfg.preds[block]) {
+        if (idom[pred] == kNoBlock) continue;
+        dom = dom == kNoBlock ? pred : intersect(pred, dom);
+      }
+      if (dom != idom[block]) {
+        idom[block] = dom;
+        changed = true;
+      }
+    }
+  }
+
+  for (BlockId block : cfg.rpo)
+    if (block != entry) children[idom[block]].push_back(block);
+
+  // a join point is in the frontier of every block between each
+  // predecessor and the join's immediate dominator
+  for (BlockId block : cfg.rpo) {
+    if (cfg.preds[block].size() < 2) continue;
+    for (BlockId pred : cfg.preds[block]) {
+      if (!cfg.reachable(pred)) continue;
+      for (BlockId runner = pred; runner != idom[block];
+           runner = idom[runner]) {
+        auto& df = frontier[runner];
+        if (std::find(df.begin(), df.end(), block) == df.end())
+          df.push_back(block);
+      }
+    }
+  }
+
+  uint32_t clock = 0;
+  std::vector<std::pair<BlockId, size_t>> stack = {{entry, 0}};
+  pre[entry] = clock++;
+  while (!stack.empty()) {
+    auto& [block, next] = stack.back();
+    if (next < children[block].size()) {
+      BlockId child = children[block][next++];
+      pre[child] = clock++;
+      stack.push_back({child, 0});
+      continue;
+    }
+    post[block] = clock++;
+    stack.pop_back();
+  }
+
+  // unreachable blocks neither dominate nor are dominated by anything
+  for (BlockId id = 0; id < fn.blocks.size(); ++id) {
+    if (cfg.reachable(id)) continue;
+    pre[id] = UINT32_MAX;
+    post[id] = UINT32_MAX;
+  }
+}
+
+LoopInfo::LoopInfo(const Function& fn, const CFG& cfg,
+                   const DominatorTree& dom)
+    : loop_of(fn.blocks.size(), kNoLoop) {
+  std::vector<uint32_t> loop_at(fn.blocks.size(), kNoLoop);
+
+  for (BlockId header : cfg.rpo) {
+    for (BlockId latch : cfg.preds[header]) {
+      if (!cfg.reachable(latch) || !dom.dominates(header, latch)) continue;
+
+      if (loop_at[header] == kNoLoop) {
+        loop_at[header] = static_cast<uint32_t>(loops.size());
+        Loop& loop = loops.emplace_back();
+        loop.header = header;
+        loop.blocks.push_back(header);
+      }
+      Loop& loop = loops[loop_at[header]];
+      loop.latches.push_back(latch);
+
+      // everything that reaches the latch without passing the header
+      std::vector<BlockId> work = {latch};
+      while (!work.empty()) {
+        BlockId block = work.back();
+        work.pop_back();
+        if (std::find(loop.blocks.begin(), loop.blocks.end(), block) !=
+            loop.blocks.end())
+          continue;
+        loop.blocks.push_back(block);
+        for (BlockId pred : cfg.preds[block])
+          if (cfg.reachable(pred)) work.push_back(pred);
+      }
+    }
+  }
+
+  // larger loops enclose smaller ones, so sorting by size puts parents first
+  std::stable_sort(loops.begin(), loops.end(),
+                   [](const Loop& a, const Loop& b) {
+                     return a.blocks.size() > b.blocks.size();
+                   });
+
+  for (uint32_t i = 0; i < loops.size(); ++i) {
+    for (uint32_t j = i; j-- > 0;) {
+      if (contains(j, loops[i].header) && loops[j].header != loops[i].header) {
+        loops[i].parent = j;
+        loops[i].depth = loops[j].depth + 1;
+        break;
+      }
+    }
+    // inner loops are visited later and overwrite their blocks
+    for (BlockId block : loops[i].blocks) loop_of[block] = i;
+  }
+}
+
+bool LoopInfo::contains(uint32_t loop, BlockId block) const {
+  const auto& blocks = loops[loop].blocks;
+  return std::find(blocks.begin(), blocks.end(), block) != blocks.end();
+}
+
+}  // namespace ir
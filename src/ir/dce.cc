@@ -0,0 +1,84 @@
+#include "ir/passes.hh"
+
+namespace ir {
+
+namespace {
+
+struct Def {
+  BlockId block = kNoBlock;
+  uint32_t index = 0;
+};
+
+bool has_side_effects(const Function& fn, const std::vector<Def>& defs,
+                      const Inst& inst) {
+  switch (inst.op) {
+    case Op::Call:
+    case Op::Print:
+    case Op::Br:
+    case Op::CondBr:
+    case Op::Ret:
+      return true;
+    case Op::Div: {
+      // may trap, unless the divisor is a constant other than 0 and -1
+      const Def def = defs[inst.b];
+      if (def.block == kNoBlock) return true;
+      const Inst& divisor = fn.blocks[def.block].insts[def.index];
+      return divisor.op != Op::Const || divisor.imm == 0 || divisor.imm == -1;
+    }
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+Preserved eliminate_dead_code(Module& module, FuncId id, Analyses&) {
+  Function& fn = module.functions[id];
+
+  std::vector<Def> defs(fn.reg_types.size());
+  for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+    const auto& insts = fn.blocks[block].insts;
+    for (uint32_t i = 0; i < insts.size(); ++i) {
+      if (insts[i].dst != kNoReg) defs[insts[i].dst] = {block, i};
+      if (insts[i].dst2 != kNoReg) defs[insts[i].dst2] = {block, i};
+    }
+  }
+
+  // everything a side effect depends on is live, the rest is dead
+  std::vector<bool> live(fn.reg_types.size(), false);
+  std::vector<Reg> worklist;
+  auto mark = [&](Reg reg) {
+    if (live[reg]) return;
+    live[reg] = true;
+    worklist.push_back(reg);
+  };
+
+  for (const Block& block : fn.blocks) {
+    for (const Inst& inst : block.insts) {
+      if (!has_side_effects(fn, defs, inst)) continue;
+      if (inst.dst != kNoReg) mark(inst.dst);
+      if (inst.dst2 != kNoReg) mark(inst.dst2);
+      for_each_use(fn, inst, mark);
+    }
+  }
+
+  while (!worklist.empty()) {
+    const Def def = defs[worklist.back()];
+    worklist.pop_back();
+    if (def.block != kNoBlock)
+      for_each_use(fn, fn.blocks[def.block].insts[def.index], mark);
+  }
+
+  // trapping divisions marked their result, so it decides for them too
+  for (Block& block : fn.blocks)
+    std::erase_if(block.insts, [&](const Inst& inst) {
+      if (inst.op == Op::Call || inst.op == Op::Print ||
+          is_terminator(inst.op))
+        return false;
+      return !(inst.dst != kNoReg && live[inst.dst]) &&
+             !(inst.dst2 != kNoReg && live[inst.dst2]);
+    });
+  return kPreservesCfg;
+}
+
+}  // namespace ir
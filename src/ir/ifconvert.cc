@@ -0,0 +1,264 @@
+#include "ir/cfg.hh"
+#include "ir/passes.hh"
+
+namespace ir {
+
+namespace {
+
+// instructions besides constants the arms may add to every path through
+// the conditional
+constexpr size_t kMaxSpeculated = 4;
+// selects replacing the phis where the arms meet
+constexpr size_t kMaxSelects = 2;
+
+/// A conditional branch whose sides meet again in one block: a diamond
+/// when both go through an arm, a triangle when one goes there directly.
+struct Conditional {
+  BlockId head;
+  BlockId join;
+  BlockId on_true = kNoBlock;  // arms, kNoBlock for a direct edge
+  BlockId on_false = kNoBlock;
+  Reg cond;
+  bool merge = false;  // nothing else reaches the join
+};
+
+class Flattener {
+ public:
+  explicit Flattener(Function& fn)
+      : fn(fn), known(fn.reg_types.size(), false),
+        value(fn.reg_types.size(), 0) {
+    for (const Block& block : fn.blocks) {
+      for (const Inst& inst : block.insts) {
+        if (inst.op != Op::Const) continue;
+        known[inst.dst] = true;
+        value[inst.dst] = inst.imm;
+      }
+    }
+  }
+
+  /// Flattens the last conditional found, returns whether there was one.
+  /// Inner conditionals come later, so they go before the ones around them.
+  bool flatten_one() {
+    const CFG cfg(fn);
+    for (BlockId head = static_cast<BlockId>(fn.blocks.size()); head-- > 0;) {
+      Conditional conditional;
+      if (!cfg.reachable(head) || !match(cfg, head, conditional)) continue;
+      flatten(conditional);
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  Function& fn;
+  std::vector<bool> known;  // defined by a Const
+  std::vector<int64_t> value;
+
+  /// Whether running the instruction on a path that did not ask for it is
+  /// harmless: nothing that can trap, read memory or has side effects.
+  bool speculatable(const Inst& inst) const {
+    switch (inst.op) {
+      case Op::Const:
+      case Op::Copy:
+      case Op::Add:
+      case Op::Sub:
+      case Op::Mul:
+      case Op::Neg:
+      case Op::Shl:
+      case Op::Sar:
+      case Op::Shr:
+      case Op::Sext:
+      case Op::Trunc:
+      case Op::Eq:
+      case Op::Ne:
+      case Op::Lt:
+      case Op::Le:
+      case Op::Gt:
+      case Op::Ge:
+      case Op::Select:
+      case Op::StrAddr:
+        return true;
+      case Op::Div:
+        // selects made here define registers past the ones known
+        return inst.b < known.size() && known[inst.b] &&
+               value[inst.b] != 0 &&
+               static_cast<int32_t>(value[inst.b]) != -1;
+      default:
+        return false;
+    }
+  }
+
+  // a block only the head jumps to, which then jumps on unconditionally;
+  // its instructions, without constants, are added to size
+  bool is_arm(const CFG& cfg, BlockId head, BlockId block,
+              size_t& size) const {
+    if (block == head || cfg.preds[block].size() != 1) return false;
+    const Block& arm = fn.blocks[block];
+    const Inst* term = arm.terminator();
+    if (!term || term->op != Op::Br || term->target == block) return false;
+    for (size_t i = 0; i + 1 < arm.insts.size(); ++i) {
+      if (!speculatable(arm.insts[i])) return false;
+      if (arm.insts[i].op != Op::Const) ++size;
+    }
+    return true;
+  }
+
+  static size_t incoming(const Function& fn, const Inst& phi, BlockId block) {
+    for (size_t i = 0; i < fn.phi_size(phi); ++i)
+      if (fn.phi_block(phi, i) == block) return i;
+    return SIZE_MAX;
+  }
+
+  bool match(const CFG& cfg, BlockId head, Conditional& conditional) const {
+    const Inst* term = fn.blocks[head].terminator();
+    if (!term || term->op != Op::CondBr || term->target == term->other)
+      return false;
+    const BlockId t = term->target;
+    const BlockId f = term->other;
+    auto next = [&](BlockId arm) { return fn.blocks[arm].insts.back().target; };
+
+    size_t size = 0;
+    const bool t_arm = is_arm(cfg, head, t, size);
+    const bool f_arm = is_arm(cfg, head, f, size);
+    conditional = {.head = head, .join = kNoBlock, .cond = term->a};
+    if (t_arm && f_arm && next(t) == next(f)) {
+      conditional.join = next(t);
+      conditional.on_true = t;
+      conditional.on_false = f;
+    } else if (t_arm && next(t) == f) {
+      conditional.join = f;
+      conditional.on_true = t;
+      size = 0;
+      is_arm(cfg, head, t, size);
+    } else if (f_arm && next(f) == t) {
+      conditional.join = t;
+      conditional.on_false = f;
+      size = 0;
+      is_arm(cfg, head, f, size);
+    } else {
+      return false;
+    }
+    if (conditional.join == head || size > kMaxSpeculated) return false;
+    conditional.merge =
+        conditional.join != 0 && cfg.preds[conditional.join].size() == 2;
+
+    // both sides have to reach every phi where they meet
+    const BlockId from_true =
+        conditional.on_true != kNoBlock ? conditional.on_true : head;
+    const BlockId from_false =
+        conditional.on_false != kNoBlock ? conditional.on_false : head;
+    size_t selects = 0;
+    for (const Inst& phi : fn.blocks[conditional.join].insts) {
+      if (phi.op != Op::Phi) break;
+      const size_t a = incoming(fn, phi, from_true);
+      const size_t b = incoming(fn, phi, from_false);
+      if (a == SIZE_MAX || b == SIZE_MAX) return false;
+      if (fn.phi_value(phi, a) != fn.phi_value(phi, b)) ++selects;
+    }
+    return selects <= kMaxSelects;
+  }
+
+  void flatten(const Conditional& conditional) {
+    const BlockId head = conditional.head;
+    const BlockId from_true =
+        conditional.on_true != kNoBlock ? conditional.on_true : head;
+    const BlockId from_false =
+        conditional.on_false != kNoBlock ? conditional.on_false : head;
+
+    std::vector<Inst> insts = std::move(fn.blocks[head].insts);
+    insts.pop_back();
+    std::vector<Inst> arms;
+    for (BlockId arm : {conditional.on_true, conditional.on_false}) {
+      if (arm == kNoBlock) continue;
+      const auto& body = fn.blocks[arm].insts;
+      arms.insert(arms.end(), body.begin(), body.end() - 1);
+    }
+
+    // the arms go ahead of the compare making the condition where they can,
+    // so the selects read its flags in code generation
+    auto at = insts.end();
+    if (!insts.empty() && insts.back().dst == conditional.cond &&
+        is_compare(insts.back().op) && !uses(arms, conditional.cond))
+      at = insts.end() - 1;
+    insts.insert(at, arms.begin(), arms.end());
+
+    // the incoming edge kept is the one from the head if there is one, the
+    // others come from arms that are about to be removed
+    for (Inst& phi : fn.blocks[conditional.join].insts) {
+      if (phi.op != Op::Phi) break;
+      const size_t a = incoming(fn, phi, from_true);
+      const size_t b = incoming(fn, phi, from_false);
+      Reg result = fn.phi_value(phi, a);
+      if (result != fn.phi_value(phi, b)) {
+        const Reg dst = fn.new_reg(phi.ty);
+        insts.push_back({.op = Op::Select,
+                         .ty = phi.ty,
+                         .dst = dst,
+                         .a = conditional.cond,
+                         .b = result,
+                         .c = fn.phi_value(phi, b)});
+        result = dst;
+      }
+      const size_t kept = from_false == head ? b : a;
+      fn.phi_value(phi, kept) = result;
+      fn.phi_block(phi, kept) = head;
+    }
+    if (conditional.merge) {
+      merge(insts, conditional.join, head);
+    } else {
+      insts.push_back({.op = Op::Br, .target = conditional.join});
+    }
+    fn.blocks[head].insts = std::move(insts);
+    remove_unreachable_blocks(fn);
+  }
+
+  bool uses(const std::vector<Inst>& insts, Reg reg) const {
+    bool found = false;
+    for (const Inst& inst : insts)
+      for_each_use(fn, inst, [&](Reg use) { found = found || use == reg; });
+    return found;
+  }
+
+  // appends the join to the head now that the head is all that reaches it,
+  // its phis are left with one incoming value that replaces them
+  void merge(std::vector<Inst>& insts, BlockId join, BlockId head) {
+    std::vector<Inst> body = std::move(fn.blocks[join].insts);
+    std::vector<Reg> replace(fn.reg_types.size(), kNoReg);
+    size_t phis = 0;
+    for (; phis < body.size() && body[phis].op == Op::Phi; ++phis)
+      replace[body[phis].dst] =
+          fn.phi_value(body[phis], incoming(fn, body[phis], head));
+    insts.insert(insts.end(), body.begin() + phis, body.end());
+
+    auto rename = [&](Inst& inst) {
+      for_each_use(fn, inst, [&](Reg& use) {
+        if (replace[use] != kNoReg) use = replace[use];
+      });
+    };
+    if (phis > 0) {
+      for (Block& block : fn.blocks)
+        for (Inst& inst : block.insts) rename(inst);
+      for (Inst& inst : insts) rename(inst);
+    }
+
+    // the head is taken out of the function while it is rebuilt
+    for (BlockId succ : successors(insts.back())) {
+      for (Inst& phi : succ == head ? insts : fn.blocks[succ].insts) {
+        if (phi.op != Op::Phi) break;
+        for (size_t i = 0; i < fn.phi_size(phi); ++i)
+          if (fn.phi_block(phi, i) == join) fn.phi_block(phi, i) = head;
+      }
+    }
+  }
+};
+
+}  // namespace
+
+Preserved flatten_conditionals(Module& module, FuncId id, Analyses&) {
+  Flattener flattener(module.functions[id]);
+  bool changed = false;
+  while (flattener.flatten_one()) changed = true;
+  return changed ? kPreservesNothing : kPreservesAll;
+}
+
+}  // namespace ir
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <iterator>
+
+#include "ir/passes.hh"
+
+namespace ir {
+
+namespace {
+
+// instructions a call costs on top of its arguments: the call and return,
+// frame setup and the moves around it
+constexpr int kCallCost = 4;
+
+// inlining by size stops once a caller has grown this large
+constexpr size_t kMaxCallerSize = 2000;
+
+constexpr uint32_t kUnvisited = UINT32_MAX;
+
+size_t size_of(const Function& fn) {
+  size_t size = 0;
+  for (const Block& block : fn.blocks)
+    for (const Inst& inst : block.insts)
+      if (inst.op != Op::Phi && inst.op != Op::Nop) ++size;
+  return size;
+}
+
+/// Strongly connected components of the call graph (Tarjan), which come out
+/// with callees before their callers
+class CallGraph {
+ public:
+  explicit CallGraph(const Module& module)
+      : callees(module.functions.size()), recursive(module.functions.size()),
+        index(module.functions.size(), kUnvisited),
+        low(module.functions.size()), on_stack(module.functions.size()) {
+    for (FuncId fn = 0; fn < module.functions.size(); ++fn)
+      for (const Block& block : module.functions[fn].blocks)
+        for (const Inst& inst : block.insts)
+          if (inst.op == Op::Call) callees[fn].push_back(inst.callee);
+
+    for (FuncId fn = 0; fn < module.functions.size(); ++fn)
+      if (index[fn] == kUnvisited) visit(fn);
+  }
+
+  std::vector<std::vector<FuncId>> callees;
+  std::vector<FuncId> bottom_up;
+  std::vector<bool> recursive;
+
+ private:
+  std::vector<uint32_t> index;
+  std::vector<uint32_t> low;
+  std::vector<bool> on_stack;
+  std::vector<FuncId> stack;
+  uint32_t next = 0;
+
+  void visit(FuncId fn) {
+    index[fn] = low[fn] = next++;
+    stack.push_back(fn);
+    on_stack[fn] = true;
+
+    for (FuncId callee : callees[fn]) {
+      if (callee == fn) recursive[fn] = true;
+      if (index[callee] == kUnvisited) {
+        visit(callee);
+        low[fn] = std::min(low[fn], low[callee]);
+      } else if (on_stack[callee]) {
+        low[fn] = std::min(low[fn], index[callee]);
+      }
+    }
+    if (low[fn] != index[fn]) return;
+
+    auto root = std::find(stack.begin(), stack.end(), fn);
+    const bool cycle = stack.end() - root > 1;
+    for (auto it = root; it != stack.end(); ++it) {
+      on_stack[*it] = false;
+      if (cycle) recursive[*it] = true;
+      bottom_up.push_back(*it);
+    }
+    stack.erase(root, stack.end());
+  }
+};
+
+class Inliner {
+ public:
+  Inliner(Module& module, int threshold)
+      : module(module), graph(module), threshold(threshold),
+        sites(module.functions.size()), sizes(module.functions.size()) {
+    for (const auto& callees : graph.callees)
+      for (FuncId callee : callees) ++sites[callee];
+  }
+
+  bool run() {
+    bool changed = false;
+    for (FuncId fn : graph.bottom_up) {
+      Function& body = module.functions[fn];
+      if (inline_into(fn)) {
+        remove_unreachable_blocks(body);
+        graph.callees[fn].clear();
+        for (const Block& block : body.blocks)
+          for (const Inst& inst : block.insts)
+            if (inst.op == Op::Call) graph.callees[fn].push_back(inst.callee);
+        changed = true;
+      }
+      sizes[fn] = size_of(body);
+    }
+    if (changed) remove_uncalled_functions();
+    return changed;
+  }
+
+ private:
+  Module& module;
+  CallGraph graph;
+  int threshold;
+  std::vector<uint32_t> sites;
+  std::vector<size_t> sizes;
+
+  bool should_inline(FuncId caller, size_t caller_size, const Inst& call) {
+    const FuncId callee = call.callee;
+    if (callee == caller || graph.recursive[callee]) return false;
+
+    // the entry block has no predecessors to fill in phis for
+    const Function& body = module.functions[callee];
+    if (body.blocks.empty() || body.blocks[0].insts.empty() ||
+        body.blocks[0].insts[0].op == Op::Phi)
+      return false;
+
+    // the only copy of the body moves into its caller
+    if (sites[callee] == 1 && callee != module.entry) return true;
+
+    const int cost = static_cast<int>(sizes[callee]);
+    const int benefit = kCallCost + static_cast<int>(call.count);
+    return cost - benefit <= threshold && caller_size < kMaxCallerSize;
+  }
+
+  bool inline_into(FuncId caller) {
+    Function& fn = module.functions[caller];
+    size_t caller_size = size_of(fn);
+    bool changed = false;
+
+    for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+      for (size_t i = 0; i < fn.blocks[block].insts.size(); ++i) {
+        const Inst& call = fn.blocks[block].insts[i];
+        if (call.op != Op::Call || !should_inline(caller, caller_size, call))
+          continue;
+
+        const FuncId callee = call.callee;
+        --sites[callee];
+        for (FuncId nested : graph.callees[callee]) ++sites[nested];
+        caller_size += sizes[callee];
+
+        // the inlined blocks were inlined into already, continue after them
+        block = inline_call(fn, block, i, module.functions[callee]) - 1;
+        changed = true;
+        break;
+      }
+    }
+    return changed;
+  }
+
+  /// Replaces the call at index of block with a copy of the callee's body.
+  /// The block is split after the call; the copy goes in between and its
+  /// returns jump to the second half. Returns the id of that second half.
+  static BlockId inline_call(Function& fn, BlockId block, size_t index,
+                             const Function& callee) {
+    const Inst call = fn.blocks[block].insts[index];
+    const std::span<const Reg> call_args = fn.args(call);
+    const std::vector<Reg> args(call_args.begin(), call_args.end());
+
+    const BlockId first = block + 1;
+    const BlockId tail = first + static_cast<BlockId>(callee.blocks.size());
+
+    // blocks after the caller's move up to make room
+    auto moved = [&](BlockId id) {
+      return id != kNoBlock && id > block ? id + (tail - block) : id;
+    };
+    for (Block& b : fn.blocks) {
+      for (Inst& inst : b.insts) {
+        inst.target = moved(inst.target);
+        inst.other = moved(inst.other);
+        if (inst.op == Op::Phi)
+          for (size_t i = 0; i < fn.phi_size(inst); ++i)
+            fn.phi_block(inst, i) = moved(fn.phi_block(inst, i));
+      }
+    }
+
+    auto& head = fn.blocks[block].insts;
+    Block tail_block;
+    tail_block.insts.assign(head.begin() + index + 1, head.end());
+    head.resize(index);
+
+    // parameters become the arguments, other registers get fresh names
+    std::vector<Reg> regs(callee.reg_types.size());
+    for (Reg reg = 0; reg < regs.size(); ++reg) {
+      const Ty ty = callee.reg_types[reg];
+      if (reg < callee.params.size() && fn.reg_types[args[reg]] == ty) {
+        regs[reg] = args[reg];
+        continue;
+      }
+      regs[reg] = fn.new_reg(ty);
+      if (reg < callee.params.size())
+        head.push_back(
+            {.op = Op::Copy, .ty = ty, .dst = regs[reg], .a = args[reg]});
+    }
+    head.push_back({.op = Op::Br, .target = first});
+
+    struct Return {
+      Reg a;
+      Reg b;
+      BlockId from;
+    };
+    std::vector<Return> returns;
+    std::vector<Block> body(callee.blocks.size());
+    for (BlockId id = 0; id < callee.blocks.size(); ++id) {
+      for (Inst inst : callee.blocks[id].insts) {
+        for (Reg* reg : {&inst.dst, &inst.dst2, &inst.a, &inst.b, &inst.c})
+          if (*reg != kNoReg) *reg = regs[*reg];
+        if (inst.target != kNoBlock) inst.target += first;
+        if (inst.other != kNoBlock) inst.other += first;
+
+        if (inst.op == Op::Call || inst.op == Op::Phi) {
+          const auto operand = static_cast<uint32_t>(fn.operands.size());
+          for (uint32_t i = 0; i < inst.count; ++i) {
+            Reg value = callee.operands[inst.first + i];
+            bool is_block = inst.op == Op::Phi && i % 2 == 1;
+            fn.operands.push_back(is_block ? value + first : regs[value]);
+          }
+          inst.first = operand;
+        }
+
+        if (inst.op == Op::Ret) {
+          returns.push_back({inst.a, inst.b, first + id});
+          inst = {.op = Op::Br, .target = tail};
+        }
+        body[id].insts.push_back(inst);
+      }
+    }
+
+    // results: a copy after a single return, phis in the tail otherwise
+    for (auto [dst, value] : {std::pair{call.dst, &Return::a},
+                              std::pair{call.dst2, &Return::b}}) {
+      if (dst == kNoReg || returns.empty()) continue;
+      const Ty ty = fn.reg_types[dst];
+      if (returns.size() == 1) {
+        auto& insts = body[returns[0].from - first].insts;
+        insts.insert(insts.end() - 1, {.op = Op::Copy,
+                                       .ty = ty,
+                                       .dst = dst,
+                                       .a = returns[0].*value});
+        continue;
+      }
+
+      Inst phi = {.op = Op::Phi,
+                  .ty = ty,
+                  .dst = dst,
+                  .first = static_cast<uint32_t>(fn.operands.size()),
+                  .count = static_cast<uint32_t>(2 * returns.size())};
+      for (const Return& ret : returns) {
+        fn.operands.push_back(ret.*value);
+        fn.operands.push_back(ret.from);
+      }
+      tail_block.insts.insert(tail_block.insts.begin(), phi);
+    }
+
+    body.push_back(std::move(tail_block));
+    fn.blocks.insert(fn.blocks.begin() + first,
+                     std::make_move_iterator(body.begin()),
+                     std::make_move_iterator(body.end()));
+
+    // edges out of the caller's block now leave from the tail
+    for (BlockId succ : successors(fn.blocks[tail].insts.back())) {
+      for (Inst& phi : fn.blocks[succ].insts) {
+        if (phi.op != Op::Phi) break;
+        for (size_t i = 0; i < fn.phi_size(phi); ++i)
+          if (fn.phi_block(phi, i) == block) fn.phi_block(phi, i) = tail;
+      }
+    }
+    return tail;
+  }
+
+  void remove_uncalled_functions() {
+    std::vector<FuncId> remap(module.functions.size(), kUnvisited);
+    std::vector<FuncId> stack = {module.entry};
+    remap[module.entry] = 0;
+    while (!stack.empty()) {
+      FuncId fn = stack.back();
+      stack.pop_back();
+      for (const Block& block : module.functions[fn].blocks) {
+        for (const Inst& inst : block.insts) {
+          if (inst.op != Op::Call || remap[inst.callee] != kUnvisited)
+            continue;
+          remap[inst.callee] = 0;
+          stack.push_back(inst.callee);
+        }
+      }
+    }
+
+    FuncId next = 0;
+    for (FuncId fn = 0; fn < module.functions.size(); ++fn)
+      if (remap[fn] != kUnvisited) remap[fn] = next++;
+    if (next == module.functions.size()) return;
+
+    std::vector<Function> kept;
+    kept.reserve(next);
+    for (FuncId fn = 0; fn < module.functions.size(); ++fn) {
+      if (remap[fn] == kUnvisited) continue;
+      for (Block& block : module.functions[fn].blocks)
+        for (Inst& inst : block.insts)
+          if (inst.op == Op::Call) inst.callee = remap[inst.callee];
+      kept.push_back(std::move(module.functions[fn]));
+    }
+    module.functions = std::move(kept);
+    module.entry = remap[module.entry];
+  }
+};
+
+}  // namespace
+
+Preserved inline_functions(Module& module, Analyses& analyses) {
+  Inliner inliner(module, analyses.options.inline_threshold);
+  return inliner.run() ? kPreservesNothing : kPreservesAll;
+}
+
+}  // namespace ir
@@ -0,0 +1,413 @@
+#include "ir/ir.hh"
+
+#include <sstream>
+
+namespace ir {
+
+Inst& Builder::append(Inst inst) {
+  auto& insts = fn.blocks[current].insts;
+  insts.push_back(inst);
+  return insts.back();
+}
+
+Reg Builder::constant(Ty ty, int64_t value) {
+  Reg dst = fn.new_reg(ty);
+  append({.op = Op::Const, .ty = ty, .dst = dst, .imm = value});
+  return dst;
+}
+
+Reg Builder::copy(Ty ty, Reg src) {
+  Reg dst = fn.new_reg(ty);
+  append({.op = Op::Copy, .ty = ty, .dst = dst, .a = src});
+  return dst;
+}
+
+void Builder::copy_to(Reg dst, Reg src) {
+  append({.op = Op::Copy, .ty = fn.reg_types[dst], .dst = dst, .a = src});
+}
+
+Reg Builder::unary(Op op, Ty ty, Reg a) {
+  Reg dst = fn.new_reg(ty);
+  append({.op = op, .ty = ty, .dst = dst, .a = a});
+  return dst;
+}
+
+Reg Builder::binary(Op op, Ty ty, Reg a, Reg b) {
+  Reg dst = fn.new_reg(ty);
+  append({.op = op, .ty = ty, .dst = dst, .a = a, .b = b});
+  return dst;
+}
+
+Reg Builder::load_byte(Reg base, Reg index) {
+  Reg dst = fn.new_reg(Ty::I8);
+  append({.op = Op::LoadByte, .ty = Ty::I8, .dst = dst, .a = base, .b = index});
+  return dst;
+}
+
+Reg Builder::string_address(uint32_t string_id) {
+  Reg dst = fn.new_reg(Ty::Ptr);
+  append({.op = Op::StrAddr, .ty = Ty::Ptr, .dst = dst, .imm = string_id});
+  return dst;
+}
+
+Inst& Builder::call(FuncId callee, std::span<const Reg> args,
+                    std::span<const Ty> results) {
+  Inst inst{.op = Op::Call, .callee = callee};
+  inst.first = static_cast<uint32_t>(fn.operands.size());
+  inst.count = static_cast<uint32_t>(args.size());
+  fn.operands.insert(fn.operands.end(), args.begin(), args.end());
+
+  if (!results.empty()) {
+    inst.ty = results[0];
+    inst.dst = fn.new_reg(results[0]);
+  }
+  if (results.size() > 1) inst.dst2 = fn.new_reg(results[1]);
+  return append(inst);
+}
+
+void Builder::print(Reg ptr, Reg len) {
+  append({.op = Op::Print, .a = ptr, .b = len});
+}
+
+void Builder::br(BlockId target) {
+  append({.op = Op::Br, .target = target});
+}
+
+void Builder::cond_br(Reg cond, BlockId target, BlockId other) {
+  append({.op = Op::CondBr, .a = cond, .target = target, .other = other});
+}
+
+void Builder::ret(Reg a, Reg b) { append({.op = Op::Ret, .a = a, .b = b}); }
+
+const char* op_name(Op op) {
+  switch (op) {
+    case Op::Nop:
+      return "nop";
+    case Op::Const:
+      return "const";
+    case Op::Copy:
+      return "copy";
+    case Op::Add:
+      return "add";
+    case Op::Sub:
+      return "sub";
+    case Op::Mul:
+      return "mul";
+    case Op::Div:
+      return "div";
+    case Op::Neg:
+      return "neg";
+    case Op::Shl:
+      return "shl";
+    case Op::Sar:
+      return "sar";
+    case Op::Shr:
+      return "shr";
+    case Op::Sext:
+      return "sext";
+    case Op::Trunc:
+      return "trunc";
+    case Op::Eq:
+      return "eq";
+    case Op::Ne:
+      return "ne";
+    case Op::Lt:
+      return "lt";
+    case Op::Le:
+      return "le";
+    case Op::Gt:
+      return "gt";
+    case Op::Ge:
+      return "ge";
+    case Op::Select:
+      return "select";
+    case Op::LoadByte:
+      return "loadb";
+    case Op::StrAddr:
+      return "straddr";
+    case Op::Call:
+      return "call";
+    case Op::Phi:
+      return "phi";
+    case Op::Print:
+      return "print";
+    case Op::Br:
+      return "br";
+    case Op::CondBr:
+      return "condbr";
+    case Op::Ret:
+      return "ret";
+  }
+  return "<unknown>";
+}
+
+const char* ty_name(Ty ty) {
+  switch (ty) {
+    case Ty::Void:
+      return "void";
+    case Ty::I1:
+      return "i1";
+    case Ty::I8:
+      return "i8";
+    case Ty::I32:
+      return "i32";
+    case Ty::I64:
+      return "i64";
+    case Ty::Ptr:
+      return "ptr";
+  }
+  return "<unknown>";
+}
+
+static void print_reg(std::ostream& out, Reg reg) {
+  if (reg == kNoReg)
+    out << "%?";
+  else
+    out << "%" << reg;
+}
+
+static void print_inst(std::ostream& out, const Module& module,
+                       const Function& fn, const Inst& inst) {
+  out << "  ";
+  if (inst.dst != kNoReg) {
+    print_reg(out, inst.dst);
+    out << ":" << ty_name(fn.reg_types[inst.dst]);
+    if (inst.dst2 != kNoReg) {
+      out << ", ";
+      print_reg(out, inst.dst2);
+      out << ":" << ty_name(fn.reg_types[inst.dst2]);
+    }
+    out << " = ";
+  }
+  out << op_name(inst.op);
+
+  switch (inst.op) {
+    case Op::Const:
+      out << " " << inst.imm;
+      break;
+    case Op::StrAddr:
+      out << " .str" << inst.imm;
+      break;
+    case Op::Shl:
+    case Op::Sar:
+    case Op::Shr:
+      out << " ";
+      print_reg(out, inst.a);
+      out << ", " << inst.imm;
+      break;
+    case Op::Call: {
+      out << " "
+          << (inst.callee < module.functions.size()
+                  ? module.functions[inst.callee].name
+                  : "<bad callee>")
+          << "(";
+      auto args = fn.args(inst);
+      for (size_t i = 0; i < args.size(); ++i) {
+        if (i > 0) out << ", ";
+        print_reg(out, args[i]);
+      }
+      out << ")";
+      break;
+    }
+    case Op::Phi:
+      for (size_t i = 0; i < fn.phi_size(inst); ++i) {
+        out << (i > 0 ? ", [" : " [");
+        print_reg(out, fn.phi_value(inst, i));
+        out << ", b" << fn.phi_block(inst, i) << "]";
+      }
+      break;
+    case Op::Br:
+      out << " b" << inst.target;
+      break;
+    case Op::CondBr:
+      out << " ";
+      print_reg(out, inst.a);
+      out << ", b" << inst.target << ", b" << inst.other;
+      break;
+    default:
+      if (inst.a != kNoReg) {
+        out << " ";
+        print_reg(out, inst.a);
+      }
+      if (inst.b != kNoReg) {
+        out << ", ";
+        print_reg(out, inst.b);
+      }
+      if (inst.c != kNoReg) {
+        out << ", ";
+        print_reg(out, inst.c);
+      }
+      break;
+  }
+  out << "\n";
+}
+
+std::string print(const Module& module, const Function& fn) {
+  std::ostringstream out;
+  out << "func " << fn.name << "(";
+  for (size_t i = 0; i < fn.params.size(); ++i) {
+    if (i > 0) out << ", ";
+    out << "%" << i << ":" << ty_name(fn.params[i]);
+  }
+  out << ")";
+  if (!fn.results.empty()) {
+    out << " -> ";
+    for (size_t i = 0; i < fn.results.size(); ++i) {
+      if (i > 0) out << ", ";
+      out << ty_name(fn.results[i]);
+    }
+  }
+  out << " {\n";
+
+  for (BlockId id = 0; id < fn.blocks.size(); ++id) {
+    out << "b" << id << ":\n";
+    for (const Inst& inst : fn.blocks[id].insts)
+      print_inst(out, module, fn, inst);
+  }
+  out << "}\n";
+  return out.str();
+}
+
+std::string print(const Module& module) {
+  std::ostringstream out;
+  for (size_t i = 0; i < module.strings.size(); ++i)
+    out << ".str" << i << " = \"" << module.strings[i] << "\"\n";
+  if (!module.strings.empty()) out << "\n";
+
+  for (const Function& fn : module.functions) out << print(module, fn) << "\n";
+  return out.str();
+}
+
+bool verify(const Module& module, std::vector<std::string>& errors) {
+  size_t initial = errors.size();
+
+  for (const Function& fn : module.functions) {
+    auto fail = [&](BlockId block, const std::string& message) {
+      errors.push_back(fn.name + ": b" + std::to_string(block) + ": " +
+                       message);
+    };
+    auto check_reg = [&](BlockId block, Reg reg) {
+      if (reg != kNoReg && reg >= fn.reg_types.size())
+        fail(block, "register %" + std::to_string(reg) + " out of range");
+    };
+
+    if (fn.blocks.empty()) {
+      errors.push_back(fn.name + ": function has no blocks");
+      continue;
+    }
+    if (fn.reg_types.size() < fn.params.size())
+      errors.push_back(fn.name + ": parameters have no registers");
+
+    for (BlockId id = 0; id < fn.blocks.size(); ++id) {
+      const auto& insts = fn.blocks[id].insts;
+      if (!fn.blocks[id].terminator()) fail(id, "missing terminator");
+
+      for (size_t i = 0; i < insts.size(); ++i) {
+        const Inst& inst = insts[i];
+        if (is_terminator(inst.op) && i + 1 != insts.size())
+          fail(id, "terminator in the middle of a block");
+        if (inst.op == Op::Phi && i > 0 && insts[i - 1].op != Op::Phi)
+          fail(id, "phi after a non-phi instruction");
+        if (inst.op == Op::Phi) {
+          if (inst.first + inst.count > fn.operands.size() || inst.count % 2)
+            fail(id, "phi operands out of range");
+          else
+            for (size_t k = 0; k < fn.phi_size(inst); ++k) {
+              check_reg(id, fn.phi_value(inst, k));
+              if (fn.phi_block(inst, k) >= fn.blocks.size())
+                fail(id, "phi incoming from missing block");
+            }
+        }
+
+        check_reg(id, inst.dst);
+        check_reg(id, inst.dst2);
+        check_reg(id, inst.a);
+        check_reg(id, inst.b);
+        check_reg(id, inst.c);
+
+        if (inst.op == Op::Br || inst.op == Op::CondBr) {
+          if (inst.target >= fn.blocks.size())
+            fail(id, "branch to missing block");
+          if (inst.op == Op::CondBr && inst.other >= fn.blocks.size())
+            fail(id, "branch to missing block");
+        }
+
+        if (inst.op == Op::StrAddr &&
+            static_cast<size_t>(inst.imm) >= module.strings.size())
+          fail(id, "string literal out of range");
+
+        if (inst.op == Op::Call) {
+          if (inst.callee >= module.functions.size()) {
+            fail(id, "call to missing function");
+            continue;
+          }
+          const Function& callee = module.functions[inst.callee];
+          if (inst.first + inst.count > fn.operands.size()) {
+            fail(id, "call operands out of range");
+            continue;
+          }
+          if (inst.count != callee.params.size())
+            fail(id, "call to " + callee.name + " has wrong argument count");
+          for (Reg arg : fn.args(inst)) check_reg(id, arg);
+        }
+      }
+    }
+  }
+
+  return errors.size() == initial;
+}
+
+void remove_unreachable_blocks(Function& fn) {
+  std::vector<BlockId> remap(fn.blocks.size(), kNoBlock);
+  std::vector<BlockId> stack = {0};
+  remap[0] = 0;
+
+  // mark, numbering in discovery order is fixed up below
+  while (!stack.empty()) {
+    BlockId id = stack.back();
+    stack.pop_back();
+    const Inst* term = fn.blocks[id].terminator();
+    if (!term) continue;
+    for (BlockId succ : {term->target, term->other}) {
+      if (succ == kNoBlock || remap[succ] != kNoBlock) continue;
+      remap[succ] = 0;
+      stack.push_back(succ);
+    }
+  }
+
+  // keep the original order so fall-through layout is preserved
+  BlockId next = 0;
+  for (BlockId id = 0; id < fn.blocks.size(); ++id)
+    if (remap[id] != kNoBlock) remap[id] = next++;
+  if (next == fn.blocks.size()) return;
+
+  std::vector<Block> kept;
+  kept.reserve(next);
+  for (BlockId id = 0; id < fn.blocks.size(); ++id) {
+    if (remap[id] == kNoBlock) continue;
+    Block& block = fn.blocks[id];
+    if (!block.insts.empty()) {
+      Inst& term = block.insts.back();
+      if (term.target != kNoBlock) term.target = remap[term.target];
+      if (term.other != kNoBlock) term.other = remap[term.other];
+    }
+
+    // edges from removed blocks disappear from the phis
+    for (Inst& inst : block.insts) {
+      if (inst.op != Op::Phi) break;
+      size_t live = 0;
+      for (size_t i = 0; i < fn.phi_size(inst); ++i) {
+        BlockId pred = remap[fn.phi_block(inst, i)];
+        if (pred == kNoBlock) continue;
+        fn.phi_value(inst, live) = fn.phi_value(inst, i);
+        fn.phi_block(inst, live) = pred;
+        ++live;
+      }
+      inst.count = static_cast<uint32_t>(2 * live);
+    }
+    kept.push_back(std::move(block));
+  }
+  fn.blocks = std::move(kept);
+}
+
+}  // namespace ir
@@ -0,0 +1,188 @@
+#include <algorithm>
+
+#include "ir/cfg.hh"
+#include "ir/passes.hh"
+
+namespace ir {
+
+namespace {
+
+class Hoister {
+ public:
+  Hoister(Function& fn, const CFG& cfg, const LoopInfo& info)
+      : fn(fn), loops(info.loops), order(cfg.rpo),
+        def_block(fn.reg_types.size(), kNoBlock) {
+    for (const Loop& loop : loops) {
+      auto& members = blocks_of.emplace_back(fn.blocks.size(), false);
+      for (BlockId block : loop.blocks) members[block] = true;
+    }
+    for (BlockId block = 0; block < fn.blocks.size(); ++block)
+      for (const Inst& inst : fn.blocks[block].insts)
+        if (inst.dst != kNoReg) def_block[inst.dst] = block;
+  }
+
+  void run() {
+    // inner loops first, what they hoist may leave the outer loop as well
+    for (uint32_t loop = static_cast<uint32_t>(loops.size()); loop-- > 0;) {
+      BlockId preheader = find_preheader(loop);
+      if (preheader != kNoBlock) hoist(loop, preheader);
+    }
+  }
+
+  bool added_blocks = false;
+
+ private:
+  Function& fn;
+  std::vector<Loop> loops;
+  std::vector<std::vector<bool>> blocks_of;
+  std::vector<BlockId> order;  // reverse post-order, with new preheaders
+  std::vector<BlockId> def_block;
+
+  bool inside(uint32_t loop, BlockId block) const {
+    return block != kNoBlock && blocks_of[loop][block];
+  }
+
+  /// The block all entries into the loop come from, split off the edge from
+  /// the single outside predecessor if that has other successors.
+  BlockId find_preheader(uint32_t loop) {
+    const BlockId header = loops[loop].header;
+    BlockId outside = kNoBlock;
+    for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+      const Inst* term = fn.blocks[block].terminator();
+      if (!term || inside(loop, block)) continue;
+      for (BlockId succ : successors(*term)) {
+        if (succ != header) continue;
+        if (outside != kNoBlock && outside != block) return kNoBlock;
+        outside = block;
+      }
+    }
+    if (outside == kNoBlock) return kNoBlock;
+
+    Inst& term = fn.blocks[outside].insts.back();
+    if (term.op == Op::Br) return outside;
+
+    const BlockId preheader = fn.new_block();
+    fn.blocks[preheader].insts.push_back({.op = Op::Br, .target = header});
+    if (term.target == header) term.target = preheader;
+    if (term.other == header) term.other = preheader;
+    for (Inst& phi : fn.blocks[header].insts) {
+      if (phi.op != Op::Phi) break;
+      for (size_t i = 0; i < fn.phi_size(phi); ++i)
+        if (fn.phi_block(phi, i) == outside) fn.phi_block(phi, i) = preheader;
+    }
+
+    // it belongs to the loops around this one
+    for (auto& members : blocks_of) members.push_back(false);
+    for (uint32_t parent = loops[loop].parent; parent != kNoLoop;
+         parent = loops[parent].parent)
+      blocks_of[parent][preheader] = true;
+    order.insert(std::find(order.begin(), order.end(), header), preheader);
+    added_blocks = true;
+    return preheader;
+  }
+
+  bool movable(const Inst& inst) const {
+    switch (inst.op) {
+      case Op::Const:
+      case Op::Copy:
+      case Op::Add:
+      case Op::Sub:
+      case Op::Mul:
+      case Op::Neg:
+      case Op::Shl:
+      case Op::Sar:
+      case Op::Shr:
+      case Op::Sext:
+      case Op::Trunc:
+      case Op::Eq:
+      case Op::Ne:
+      case Op::Lt:
+      case Op::Le:
+      case Op::Gt:
+      case Op::Ge:
+      case Op::Select:
+      case Op::StrAddr:
+        return true;
+      case Op::Div: {
+        // only when running it early cannot trap
+        const BlockId block = def_block[inst.b];
+        if (block == kNoBlock) return false;
+        for (const Inst& def : fn.blocks[block].insts)
+          if (def.dst == inst.b)
+            return def.op == Op::Const && def.imm != 0 && def.imm != -1;
+        return false;
+      }
+      default:
+        // loads may depend on a bounds check inside the loop
+        return false;
+    }
+  }
+
+  void hoist(uint32_t loop, BlockId preheader) {
+    struct Candidate {
+      BlockId block;
+      size_t index;
+    };
+    std::vector<Candidate> candidates;
+    std::vector<bool> invariant(fn.reg_types.size(), false);
+
+    for (BlockId block : order) {
+      if (!inside(loop, block)) continue;
+      const auto& insts = fn.blocks[block].insts;
+      for (size_t i = 0; i < insts.size(); ++i) {
+        const Inst& inst = insts[i];
+        if (!movable(inst)) continue;
+        bool operands_invariant = true;
+        for_each_use(fn, inst, [&](Reg reg) {
+          operands_invariant &=
+              invariant[reg] || !inside(loop, def_block[reg]);
+        });
+        if (!operands_invariant) continue;
+        invariant[inst.dst] = true;
+        candidates.push_back({block, i});
+      }
+    }
+
+    // constants are cheaper to rematerialize than to keep in a register
+    // across the loop, so they only move along with a user
+    std::vector<bool> moved(fn.reg_types.size(), false);
+    for (size_t i = candidates.size(); i-- > 0;) {
+      const auto [block, index] = candidates[i];
+      const Inst& inst = fn.blocks[block].insts[index];
+      if (inst.op == Op::Const && !moved[inst.dst]) continue;
+      moved[inst.dst] = true;
+      for_each_use(fn, inst, [&](Reg reg) { moved[reg] = true; });
+    }
+
+    std::vector<Inst> hoisted;
+    for (const Candidate& candidate : candidates) {
+      Inst& inst = fn.blocks[candidate.block].insts[candidate.index];
+      if (!moved[inst.dst]) continue;
+      hoisted.push_back(inst);
+      def_block[inst.dst] = preheader;
+      inst.op = Op::Nop;
+    }
+    if (hoisted.empty()) return;
+
+    for (BlockId block : order)
+      if (inside(loop, block))
+        std::erase_if(fn.blocks[block].insts,
+                      [](const Inst& inst) { return inst.op == Op::Nop; });
+    auto& insts = fn.blocks[preheader].insts;
+    insts.insert(insts.end() - 1, hoisted.begin(), hoisted.end());
+  }
+};
+
+}  // namespace
+
+Preserved hoist_loop_invariants(Module& module, FuncId fn,
+                                Analyses& analyses) {
+  const LoopInfo& loops = analyses.loops(fn);
+  if (loops.loops.empty()) return kPreservesAll;
+
+  Hoister hoister(module.functions[fn], analyses.cfg(fn), loops);
+  hoister.run();
+  return hoister.added_blocks ? kPreservesNothing : kPreservesCfg;
+}
+
+}  // namespace ir
@@ -0,0 +1,313 @@
+#include <limits>
+#include <unordered_set>
+
+#include "ir/passes.hh"
+
+namespace ir {
+
+namespace {
+
+// Unknown until a definition is reached, Varying once two different values
+// (or a value that is not a compile time constant) were seen
+struct Value {
+  enum Kind : uint8_t { Unknown, Constant, Varying } kind = Unknown;
+  int64_t constant = 0;
+
+  bool operator==(const Value&) const = default;
+};
+
+constexpr Value kVarying = {Value::Varying, 0};
+
+Value constant(Ty ty, int64_t value) {
+  // narrow values are kept sign-extended from 32 bits, like the VM does
+  if (!is_wide(ty))
+    value = static_cast<int32_t>(static_cast<uint32_t>(value));
+  return {Value::Constant, value};
+}
+
+Value meet(Value a, Value b) {
+  if (a.kind == Value::Unknown) return b;
+  if (b.kind == Value::Unknown) return a;
+  return a == b ? a : kVarying;
+}
+
+Value fold(const Inst& inst, Value a, Value b) {
+  if (a.kind == Value::Varying || b.kind == Value::Varying) return kVarying;
+  if (a.kind == Value::Unknown || b.kind == Value::Unknown) return {};
+
+  // arithmetic wraps, so do it unsigned
+  const auto x = static_cast<uint64_t>(a.constant);
+  const auto y = static_cast<uint64_t>(b.constant);
+  switch (inst.op) {
+    case Op::Add:
+      return constant(inst.ty, static_cast<int64_t>(x + y));
+    case Op::Sub:
+      return constant(inst.ty, static_cast<int64_t>(x - y));
+    case Op::Mul:
+      return constant(inst.ty, static_cast<int64_t>(x * y));
+    case Op::Div: {
+      // left to trap at run time
+      const int64_t min = is_wide(inst.ty)
+                              ? std::numeric_limits<int64_t>::min()
+                              : std::numeric_limits<int32_t>::min();
+      if (b.constant == 0 || (b.constant == -1 && a.constant == min))
+        return kVarying;
+      return constant(inst.ty, a.constant / b.constant);
+    }
+    case Op::Neg:
+      return constant(inst.ty, static_cast<int64_t>(0 - x));
+    case Op::Shl:
+      return constant(inst.ty, static_cast<int64_t>(x << y));
+    case Op::Sar:
+      return constant(inst.ty, a.constant >> y);
+    case Op::Shr:
+      if (!is_wide(inst.ty))
+        return constant(inst.ty, static_cast<uint32_t>(x) >> y);
+      return constant(inst.ty, static_cast<int64_t>(x >> y));
+    case Op::Eq:
+      return constant(inst.ty, a.constant == b.constant);
+    case Op::Ne:
+      return constant(inst.ty, a.constant != b.constant);
+    case Op::Lt:
+      return constant(inst.ty, a.constant < b.constant);
+    case Op::Le:
+      return constant(inst.ty, a.constant <= b.constant);
+    case Op::Gt:
+      return constant(inst.ty, a.constant > b.constant);
+    case Op::Ge:
+      return constant(inst.ty, a.constant >= b.constant);
+    default:
+      return kVarying;
+  }
+}
+
+class Propagator {
+ public:
+  explicit Propagator(Function& fn)
+      : fn(fn), values(fn.reg_types.size()), users(fn.reg_types.size()),
+        visited(fn.blocks.size(), false) {
+    for (Reg param = 0; param < fn.params.size(); ++param)
+      values[param] = kVarying;
+
+    for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+      const auto& insts = fn.blocks[block].insts;
+      for (uint32_t i = 0; i < insts.size(); ++i)
+        for_each_use(fn, insts[i], [&](Reg reg) {
+          users[reg].push_back({block, i});
+        });
+    }
+  }
+
+  void run() {
+    edges.push_back({kNoBlock, 0});
+    while (!edges.empty() || !changed.empty()) {
+      while (!edges.empty()) {
+        auto [from, to] = edges.back();
+        edges.pop_back();
+        if (!executable.insert(key(from, to)).second) continue;
+
+        // a block's instructions only need a first visit, its phis are
+        // revisited for every newly executable edge
+        const bool first = !visited[to];
+        visited[to] = true;
+        for (const Inst& inst : fn.blocks[to].insts) {
+          if (inst.op != Op::Phi && !first) break;
+          visit(to, inst);
+        }
+      }
+
+      while (!changed.empty()) {
+        Reg reg = changed.back();
+        changed.pop_back();
+        for (auto [block, index] : users[reg])
+          if (visited[block]) visit(block, fn.blocks[block].insts[index]);
+      }
+    }
+  }
+
+  /// Rewrites constant registers and branches, returns whether any branch
+  /// changed
+  bool rewrite() {
+    bool cfg_changed = false;
+    for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+      if (!visited[block]) continue;
+      auto& insts = fn.blocks[block].insts;
+
+      // phis stay at the head of the block, so constants replacing some of
+      // them are placed after the rest
+      std::vector<Inst> rewritten;
+      rewritten.reserve(insts.size());
+      std::vector<Inst> folded_phis;
+      for (const Inst& inst : insts) {
+        if (inst.op == Op::Phi && is_constant(inst.dst)) {
+          folded_phis.push_back(as_constant(inst));
+          continue;
+        }
+        if (inst.op != Op::Phi && !folded_phis.empty()) {
+          rewritten.insert(rewritten.end(), folded_phis.begin(),
+                           folded_phis.end());
+          folded_phis.clear();
+        }
+
+        if (inst.op == Op::CondBr && is_constant(inst.a)) {
+          BlockId taken = values[inst.a].constant != 0 ? inst.target
+                                                       : inst.other;
+          BlockId dropped = taken == inst.target ? inst.other : inst.target;
+          if (dropped != taken) remove_incoming(dropped, block);
+          rewritten.push_back({.op = Op::Br, .target = taken});
+          cfg_changed = true;
+        } else if (inst.op != Op::Const && inst.dst != kNoReg &&
+                   inst.dst2 == kNoReg && is_constant(inst.dst)) {
+          rewritten.push_back(as_constant(inst));
+        } else {
+          rewritten.push_back(inst);
+        }
+      }
+      insts = std::move(rewritten);
+    }
+
+    if (cfg_changed) remove_unreachable_blocks(fn);
+    return cfg_changed;
+  }
+
+ private:
+  struct Use {
+    BlockId block;
+    uint32_t index;
+  };
+
+  Function& fn;
+  std::vector<Value> values;
+  std::vector<std::vector<Use>> users;
+  std::vector<bool> visited;
+
+  std::unordered_set<uint64_t> executable;
+  std::vector<std::pair<BlockId, BlockId>> edges;
+  std::vector<Reg> changed;
+
+  static uint64_t key(BlockId from, BlockId to) {
+    return uint64_t{from} << 32 | to;
+  }
+
+  bool is_constant(Reg reg) const {
+    return values[reg].kind == Value::Constant;
+  }
+
+  Inst as_constant(const Inst& inst) const {
+    return {.op = Op::Const,
+            .ty = inst.ty,
+            .dst = inst.dst,
+            .imm = values[inst.dst].constant};
+  }
+
+  void set(Reg reg, Value value) {
+    // values only move down the lattice
+    value = meet(values[reg], value);
+    if (value == values[reg]) return;
+    values[reg] = value;
+    changed.push_back(reg);
+  }
+
+  void visit(BlockId block, const Inst& inst) {
+    switch (inst.op) {
+      case Op::Phi: {
+        Value value;
+        for (size_t i = 0; i < fn.phi_size(inst); ++i)
+          if (executable.contains(key(fn.phi_block(inst, i), block)))
+            value = meet(value, values[fn.phi_value(inst, i)]);
+        set(inst.dst, value);
+        break;
+      }
+      case Op::Br:
+        edges.push_back({block, inst.target});
+        break;
+      case Op::CondBr: {
+        const Value cond = values[inst.a];
+        if (cond.kind == Value::Unknown) break;
+        if (cond.kind == Value::Varying || cond.constant != 0)
+          edges.push_back({block, inst.target});
+        if (cond.kind == Value::Varying || cond.constant == 0)
+          edges.push_back({block, inst.other});
+        break;
+      }
+      case Op::Const:
+        set(inst.dst, constant(inst.ty, inst.imm));
+        break;
+      case Op::Copy:
+        // widening copies are not folded, their extension is up to the
+        // backend
+        if (!is_wide(fn.reg_types[inst.a]) && is_wide(inst.ty))
+          set(inst.dst, kVarying);
+        else if (values[inst.a].kind == Value::Constant)
+          set(inst.dst, constant(inst.ty, values[inst.a].constant));
+        else
+          set(inst.dst, values[inst.a]);
+        break;
+      case Op::Neg:
+        set(inst.dst, fold(inst, values[inst.a], constant(inst.ty, 0)));
+        break;
+      case Op::Shl:
+      case Op::Sar:
+      case Op::Shr:
+        set(inst.dst, fold(inst, values[inst.a], {Value::Constant, inst.imm}));
+        break;
+      case Op::Sext:
+      case Op::Trunc:
+        // narrow constants are kept sign-extended, truncating wraps
+        if (values[inst.a].kind == Value::Constant)
+          set(inst.dst, constant(Ty::I32, values[inst.a].constant));
+        else
+          set(inst.dst, values[inst.a]);
+        break;
+      case Op::Add:
+      case Op::Sub:
+      case Op::Mul:
+      case Op::Div:
+      case Op::Eq:
+      case Op::Ne:
+      case Op::Lt:
+      case Op::Le:
+      case Op::Gt:
+      case Op::Ge:
+        set(inst.dst, fold(inst, values[inst.a], values[inst.b]));
+        break;
+      case Op::Select: {
+        // a known condition picks a side, otherwise both have to agree
+        const Value cond = values[inst.a];
+        if (cond.kind == Value::Constant)
+          set(inst.dst, values[cond.constant != 0 ? inst.b : inst.c]);
+        else if (cond.kind == Value::Varying)
+          set(inst.dst, meet(values[inst.b], values[inst.c]));
+        break;
+      }
+      default:
+        if (inst.dst != kNoReg) set(inst.dst, kVarying);
+        if (inst.dst2 != kNoReg) set(inst.dst2, kVarying);
+        break;
+    }
+  }
+
+  void remove_incoming(BlockId block, BlockId pred) {
+    for (Inst& phi : fn.blocks[block].insts) {
+      if (phi.op != Op::Phi) break;
+      size_t live = 0;
+      for (size_t i = 0; i < fn.phi_size(phi); ++i) {
+        if (fn.phi_block(phi, i) == pred) continue;
+        fn.phi_value(phi, live) = fn.phi_value(phi, i);
+        fn.phi_block(phi, live) = fn.phi_block(phi, i);
+        ++live;
+      }
+      phi.count = static_cast<uint32_t>(2 * live);
+    }
+  }
+};
+
+}  // namespace
+
+Preserved propagate_constants(Module& module, FuncId fn, Analyses&) {
+  Propagator propagator(module.functions[fn]);
+  propagator.run();
+  return propagator.rewrite() ? kPreservesNothing : kPreservesCfg;
+}
+
+}  // namespace ir
@@ -0,0 +1,448 @@
+#include "ir/ssa.hh"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "ir/cfg.hh"
+
+namespace ir {
+
+namespace {
+
+constexpr uint32_t kNone = UINT32_MAX;
+
+class Renamer {
+ public:
+  Renamer(Function& fn, const CFG& cfg, const DominatorTree& dom,
+          const std::vector<uint32_t>& def_count)
+      : fn(fn), cfg(cfg), dom(dom), def_count(def_count),
+        current(fn.reg_types.size(), kNoReg) {
+    for (Reg param = 0; param < fn.params.size(); ++param)
+      current[param] = param;
+  }
+
+  void run() {
+    rename(0);
+
+    // values read before any assignment on some path start out as zero
+    auto& entry = fn.blocks[0].insts;
+    auto at = std::find_if(entry.begin(), entry.end(), [](const Inst& inst) {
+      return inst.op != Op::Phi;
+    });
+    entry.insert(at, undef_insts.begin(), undef_insts.end());
+  }
+
+ private:
+  struct Shadowed {
+    Reg reg;
+    Reg previous;
+  };
+
+  Function& fn;
+  const CFG& cfg;
+  const DominatorTree& dom;
+  const std::vector<uint32_t>& def_count;
+
+  // current SSA name of every original register, restored on the way back
+  // up the dominator tree from an undo log
+  std::vector<Reg> current;
+  std::vector<Shadowed> undo_log;
+
+  std::unordered_map<Reg, Reg> undefs;
+  std::vector<Inst> undef_insts;
+
+  void set(Reg reg, Reg name) {
+    undo_log.push_back({reg, current[reg]});
+    current[reg] = name;
+  }
+
+  Reg lookup(Reg reg) {
+    if (current[reg] != kNoReg) return current[reg];
+
+    auto [it, inserted] = undefs.try_emplace(reg, kNoReg);
+    if (inserted) {
+      Ty ty = fn.reg_types[reg];
+      it->second = fn.new_reg(ty);
+      undef_insts.push_back(
+          {.op = Op::Const, .ty = ty, .dst = it->second, .imm = 0});
+    }
+    return it->second;
+  }
+
+  Reg define(Reg reg) {
+    // single assignments keep their name, parameters are already defined
+    if (def_count[reg] <= 1 && reg >= fn.params.size()) {
+      set(reg, reg);
+      return reg;
+    }
+    Reg name = fn.new_reg(fn.reg_types[reg]);
+    set(reg, name);
+    return name;
+  }
+
+  void rename(BlockId block) {
+    size_t mark = undo_log.size();
+
+    for (Inst& inst : fn.blocks[block].insts) {
+      if (inst.op == Op::Phi) {
+        inst.dst = define(inst.dst);
+        continue;
+      }
+
+      for_each_use(fn, inst, [&](Reg& reg) { reg = lookup(reg); });
+
+      // a copy only introduces a new name for a value that already has one
+      if (inst.op == Op::Copy &&
+          fn.reg_types[inst.dst] == fn.reg_types[inst.a]) {
+        set(inst.dst, inst.a);
+        inst.op = Op::Nop;
+        continue;
+      }
+
+      if (inst.dst != kNoReg) inst.dst = define(inst.dst);
+      if (inst.dst2 != kNoReg) inst.dst2 = define(inst.dst2);
+    }
+
+    std::vector<BlockId> succs = cfg.succs[block];
+    std::sort(succs.begin(), succs.end());
+    succs.erase(std::unique(succs.begin(), succs.end()), succs.end());
+    for (BlockId succ : succs) {
+      for (Inst& phi : fn.blocks[succ].insts) {
+        if (phi.op != Op::Phi) break;
+        for (size_t i = 0; i < fn.phi_size(phi); ++i)
+          if (fn.phi_block(phi, i) == block)
+            fn.phi_value(phi, i) = lookup(fn.phi_value(phi, i));
+      }
+    }
+
+    for (BlockId child : dom.children[block]) rename(child);
+
+    while (undo_log.size() > mark) {
+      current[undo_log.back().reg] = undo_log.back().previous;
+      undo_log.pop_back();
+    }
+  }
+};
+
+void remove_nops(Function& fn) {
+  for (Block& block : fn.blocks)
+    std::erase_if(block.insts,
+                  [](const Inst& inst) { return inst.op == Op::Nop; });
+}
+
+// a phi whose incomings are all the same value (or itself) is that value
+bool remove_trivial_phis(Function& fn) {
+  std::vector<Reg> replace(fn.reg_types.size(), kNoReg);
+  bool changed = false;
+
+  auto resolve = [&](Reg reg) {
+    while (replace[reg] != kNoReg) reg = replace[reg];
+    return reg;
+  };
+
+  for (Block& block : fn.blocks) {
+    for (Inst& phi : block.insts) {
+      if (phi.op != Op::Phi) break;
+
+      Reg same = kNoReg;
+      bool trivial = true;
+      for (size_t i = 0; i < fn.phi_size(phi) && trivial; ++i) {
+        Reg value = resolve(fn.phi_value(phi, i));
+        if (value == phi.dst || value == same) continue;
+        if (same != kNoReg) trivial = false;
+        same = value;
+      }
+      if (!trivial || same == kNoReg) continue;
+
+      replace[phi.dst] = same;
+      phi.op = Op::Nop;
+      changed = true;
+    }
+  }
+
+  if (!changed) return false;
+  for (Block& block : fn.blocks)
+    for (Inst& inst : block.insts)
+      for_each_use(fn, inst, [&](Reg& reg) { reg = resolve(reg); });
+  remove_nops(fn);
+  return true;
+}
+
+// phis only feeding other phis (or nothing) are dead
+void remove_dead_phis(Function& fn) {
+  std::vector<bool> live(fn.reg_types.size(), false);
+  std::unordered_map<Reg, Inst*> phi_of;
+  std::vector<Reg> work;
+
+  for (Block& block : fn.blocks) {
+    for (Inst& inst : block.insts) {
+      if (inst.op == Op::Phi) {
+        phi_of[inst.dst] = &inst;
+        continue;
+      }
+      for_each_use(fn, inst, [&](Reg reg) {
+        if (!live[reg]) {
+          live[reg] = true;
+          work.push_back(reg);
+        }
+      });
+    }
+  }
+
+  while (!work.empty()) {
+    auto it = phi_of.find(work.back());
+    work.pop_back();
+    if (it == phi_of.end()) continue;
+    for_each_use(fn, *it->second, [&](Reg reg) {
+      if (!live[reg]) {
+        live[reg] = true;
+        work.push_back(reg);
+      }
+    });
+  }
+
+  for (auto& [reg, phi] : phi_of)
+    if (!live[reg]) phi->op = Op::Nop;
+  remove_nops(fn);
+}
+
+}  // namespace
+
+void construct_ssa(Function& fn) {
+  if (fn.blocks.empty()) return;
+
+  remove_unreachable_blocks(fn);
+  CFG cfg(fn);
+  DominatorTree dom(fn, cfg);
+
+  const size_t reg_count = fn.reg_types.size();
+  const size_t block_count = fn.blocks.size();
+
+  std::vector<uint32_t> def_count(reg_count, 0);
+  std::vector<std::vector<BlockId>> def_blocks(reg_count);
+  for (Reg param = 0; param < fn.params.size(); ++param) {
+    def_count[param] = 1;
+    def_blocks[param].push_back(0);
+  }
+
+  // only registers read before being written in some block can need a phi
+  std::vector<bool> live_in(reg_count, false);
+  std::vector<uint32_t> written_in(reg_count, kNone);
+
+  for (BlockId block = 0; block < block_count; ++block) {
+    for (const Inst& inst : fn.blocks[block].insts) {
+      for_each_use(fn, inst, [&](Reg reg) {
+        if (written_in[reg] != block) live_in[reg] = true;
+      });
+      for (Reg dst : {inst.dst, inst.dst2}) {
+        if (dst == kNoReg) continue;
+        ++def_count[dst];
+        written_in[dst] = block;
+        if (def_blocks[dst].empty() || def_blocks[dst].back() != block)
+          def_blocks[dst].push_back(block);
+      }
+    }
+  }
+
+  std::vector<std::vector<Inst>> phis(block_count);
+  std::vector<uint32_t> has_phi(block_count, kNone);
+  std::vector<uint32_t> queued(block_count, kNone);
+
+  for (Reg reg = 0; reg < reg_count; ++reg) {
+    if (def_count[reg] < 2 || !live_in[reg]) continue;
+
+    std::vector<BlockId> work = def_blocks[reg];
+    for (BlockId block : work) queued[block] = reg;
+
+    while (!work.empty()) {
+      BlockId block = work.back();
+      work.pop_back();
+
+      for (BlockId join : dom.frontier[block]) {
+        if (has_phi[join] == reg) continue;
+        has_phi[join] = reg;
+
+        Inst phi{.op = Op::Phi, .ty = fn.reg_types[reg], .dst = reg};
+        phi.first = static_cast<uint32_t>(fn.operands.size());
+        phi.count = static_cast<uint32_t>(2 * cfg.preds[join].size());
+        for (BlockId pred : cfg.preds[join]) {
+          fn.operands.push_back(reg);
+          fn.operands.push_back(pred);
+        }
+        phis[join].push_back(phi);
+        // the phi is itself a definition
+        ++def_count[reg];
+
+        if (queued[join] != reg) {
+          queued[join] = reg;
+          work.push_back(join);
+        }
+      }
+    }
+  }
+
+  for (BlockId block = 0; block < block_count; ++block) {
+    auto& insts = fn.blocks[block].insts;
+    insts.insert(insts.begin(), phis[block].begin(), phis[block].end());
+  }
+
+  Renamer(fn, cfg, dom, def_count).run();
+
+  remove_nops(fn);
+  while (remove_trivial_phis(fn)) {
+  }
+  remove_dead_phis(fn);
+}
+
+void destruct_ssa(Function& fn) {
+  CFG cfg(fn);
+  const size_t block_count = fn.blocks.size();
+
+  // a copy for one edge must not run on the others, so critical edges into
+  // phi blocks get a block of their own
+  for (BlockId block = 0; block < block_count; ++block) {
+    if (fn.blocks[block].insts.empty() ||
+        fn.blocks[block].insts.front().op != Op::Phi)
+      continue;
+
+    std::vector<BlockId> preds = cfg.preds[block];
+    std::sort(preds.begin(), preds.end());
+    preds.erase(std::unique(preds.begin(), preds.end()), preds.end());
+
+    for (BlockId pred : preds) {
+      if (cfg.succs[pred].size() < 2) continue;
+
+      BlockId split = fn.new_block();
+      fn.blocks[split].insts.push_back({.op = Op::Br, .target = block});
+
+      Inst& term = fn.blocks[pred].insts.back();
+      if (term.target == block) term.target = split;
+      if (term.other == block) term.other = split;
+
+      for (Inst& phi : fn.blocks[block].insts) {
+        if (phi.op != Op::Phi) break;
+        for (size_t i = 0; i < fn.phi_size(phi); ++i)
+          if (fn.phi_block(phi, i) == pred) fn.phi_block(phi, i) = split;
+      }
+    }
+  }
+
+  for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+    auto& insts = fn.blocks[block].insts;
+    size_t phi_count = 0;
+    while (phi_count < insts.size() && insts[phi_count].op == Op::Phi)
+      ++phi_count;
+    if (phi_count == 0) continue;
+
+    // all phis of a block read their operands at once: one parallel copy
+    // per predecessor
+    std::unordered_map<BlockId, std::vector<std::pair<Reg, Reg>>> moves;
+    for (size_t p = 0; p < phi_count; ++p) {
+      const Inst& phi = insts[p];
+      std::vector<BlockId> seen;
+      for (size_t i = 0; i < fn.phi_size(phi); ++i) {
+        BlockId pred = fn.phi_block(phi, i);
+        if (std::find(seen.begin(), seen.end(), pred) != seen.end()) continue;
+        seen.push_back(pred);
+        if (fn.phi_value(phi, i) != phi.dst)
+          moves[pred].push_back({phi.dst, fn.phi_value(phi, i)});
+      }
+    }
+    insts.erase(insts.begin(), insts.begin() + phi_count);
+
+    for (auto& [pred, pending] : moves) {
+      std::vector<Inst> copies;
+      auto copy = [&](Reg dst, Reg src) {
+        copies.push_back(
+            {.op = Op::Copy, .ty = fn.reg_types[dst], .dst = dst, .a = src});
+      };
+
+      while (!pending.empty()) {
+        bool emitted = false;
+        for (size_t i = 0; i < pending.size(); ++i) {
+          Reg dst = pending[i].first;
+          bool read_later = std::any_of(
+              pending.begin(), pending.end(),
+              [&](const auto& move) { return move.second == dst; });
+          if (read_later) continue;
+
+          copy(dst, pending[i].second);
+          pending.erase(pending.begin() + i);
+          emitted = true;
+          break;
+        }
+        if (emitted) continue;
+
+        // only cycles are left: save one destination and redirect its
+        // readers, which frees that move
+        Reg dst = pending.front().first;
+        Reg saved = fn.new_reg(fn.reg_types[dst]);
+        copy(saved, dst);
+        for (auto& move : pending)
+          if (move.second == dst) move.second = saved;
+      }
+
+      auto& pred_insts = fn.blocks[pred].insts;
+      pred_insts.insert(pred_insts.end() - 1, copies.begin(), copies.end());
+    }
+  }
+}
+
+bool verify_ssa(const Function& fn, std::vector<std::string>& errors) {
+  size_t initial = errors.size();
+  CFG cfg(fn);
+  DominatorTree dom(fn, cfg);
+
+  std::vector<BlockId> def_block(fn.reg_types.size(), kNoBlock);
+  std::vector<uint32_t> def_index(fn.reg_types.size(), 0);
+  for (Reg param = 0; param < fn.params.size(); ++param) def_block[param] = 0;
+
+  auto fail = [&](BlockId block, const std::string& message) {
+    errors.push_back(fn.name + ": b" + std::to_string(block) + ": " + message);
+  };
+
+  for (BlockId block : cfg.rpo) {
+    const auto& insts = fn.blocks[block].insts;
+    for (uint32_t i = 0; i < insts.size(); ++i) {
+      for (Reg dst : {insts[i].dst, insts[i].dst2}) {
+        if (dst == kNoReg) continue;
+        if (def_block[dst] != kNoBlock)
+          fail(block, "%" + std::to_string(dst) + " defined twice");
+        def_block[dst] = block;
+        def_index[dst] = i + 1;  // parameters sit at index 0 of the entry
+      }
+    }
+  }
+
+  auto available = [&](Reg reg, BlockId block, uint32_t index) {
+    BlockId defined = def_block[reg];
+    if (defined == kNoBlock) return false;
+    if (defined == block) return def_index[reg] <= index;
+    return dom.dominates(defined, block);
+  };
+
+  for (BlockId block : cfg.rpo) {
+    const auto& insts = fn.blocks[block].insts;
+    for (uint32_t i = 0; i < insts.size(); ++i) {
+      const Inst& inst = insts[i];
+      if (inst.op == Op::Phi) {
+        for (size_t k = 0; k < fn.phi_size(inst); ++k) {
+          BlockId pred = fn.phi_block(inst, k);
+          if (!available(fn.phi_value(inst, k), pred, UINT32_MAX))
+            fail(block, "phi operand %" +
+                            std::to_string(fn.phi_value(inst, k)) +
+                            " not available in b" + std::to_string(pred));
+        }
+        continue;
+      }
+      for_each_use(fn, inst, [&](Reg reg) {
+        if (!available(reg, block, i))
+          fail(block, "%" + std::to_string(reg) + " used before definition");
+      });
+    }
+  }
+
+  return errors.size() == initial;
+}
+
+}  // namespace ir
@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+#include "ir/cfg.hh"
+#include "ir/passes.hh"
+
+namespace ir {
+
+namespace {
+
+// a multiply is replaced by at most this many shifts and adds, counting
+// x + (x << 1..3) as one since the backend turns it into a single lea
+constexpr int kMaxMultiplyCost = 2;
+
+/// A basic induction variable: i = phi [init, preheader], [next, latch]
+/// with next = i + step or i - step, step invariant in the loop
+struct Induction {
+  Reg phi;
+  Reg init;
+  Reg step;
+  Op op;
+  size_t entry;  // index of the incoming value from the preheader
+};
+
+class Reducer {
+ public:
+  explicit Reducer(Function& fn)
+      : fn(fn), def_block(fn.reg_types.size(), kNoBlock),
+        known(fn.reg_types.size(), false), value(fn.reg_types.size(), 0) {
+    for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+      for (const Inst& inst : fn.blocks[block].insts) {
+        if (inst.dst != kNoReg) def_block[inst.dst] = block;
+        if (inst.op != Op::Const) continue;
+        known[inst.dst] = true;
+        value[inst.dst] = normalize(inst.ty, inst.imm);
+      }
+    }
+  }
+
+  bool changed = false;
+
+  /// Multiplies of an induction variable by an invariant become a second
+  /// induction variable stepping by the product.
+  void reduce_loop(const Loop& loop, BlockId preheader) {
+    std::vector<bool> inside(fn.blocks.size(), false);
+    for (BlockId block : loop.blocks) inside[block] = true;
+    auto invariant = [&](Reg reg) {
+      return known[reg] || def_block[reg] == kNoBlock ||
+             !inside[def_block[reg]];
+    };
+
+    struct Reduced {
+      Reg phi;
+      Reg factor;
+      Reg result;
+    };
+    std::vector<Reduced> reduced;
+    std::vector<Reg> renamed(fn.reg_types.size(), kNoReg);
+
+    for (BlockId block : loop.blocks) {
+      for (size_t i = 0; i < fn.blocks[block].insts.size(); ++i) {
+        const Inst mul = fn.blocks[block].insts[i];
+        if (mul.op != Op::Mul) continue;
+        Induction iv;
+        Reg factor = mul.b;
+        if (!find_induction(loop, preheader, inside, mul.a, iv)) {
+          factor = mul.a;
+          if (!find_induction(loop, preheader, inside, mul.b, iv)) continue;
+        }
+        if (!invariant(factor) || !invariant(iv.step) ||
+            fn.reg_types[iv.phi] != mul.ty)
+          continue;
+        // before anything is inserted into the block
+        fn.blocks[block].insts[i].op = Op::Nop;
+
+        Reg result = kNoReg;
+        for (const Reduced& r : reduced)
+          if (r.phi == iv.phi && same_value(r.factor, factor))
+            result = r.result;
+        if (result == kNoReg) {
+          result = add_induction(loop, preheader, iv, factor, mul.ty);
+          reduced.push_back({iv.phi, factor, result});
+        }
+        renamed.resize(fn.reg_types.size(), kNoReg);
+        renamed[mul.dst] = result;
+        changed = true;
+      }
+    }
+    if (reduced.empty()) return;
+
+    for (Block& block : fn.blocks) {
+      std::erase_if(block.insts,
+                    [](const Inst& inst) { return inst.op == Op::Nop; });
+      for (Inst& inst : block.insts)
+        for_each_use(fn, inst, [&](Reg& reg) {
+          if (reg < renamed.size() && renamed[reg] != kNoReg)
+            reg = renamed[reg];
+        });
+    }
+  }
+
+  /// Multiplies and signed divisions by constants become shifts, adds and
+  /// a multiply by a magic number.
+  void reduce_constant_operands() {
+    std::vector<Inst> out;
+    for (Block& block : fn.blocks) {
+      out.clear();
+      for (const Inst& inst : block.insts) {
+        const bool reduced =
+            (inst.op == Op::Mul && known[inst.b] &&
+             multiply(out, inst, inst.a, value[inst.b])) ||
+            (inst.op == Op::Mul && known[inst.a] &&
+             multiply(out, inst, inst.b, value[inst.a])) ||
+            (inst.op == Op::Div && known[inst.b] && divide(out, inst));
+        if (!reduced) out.push_back(inst);
+        changed |= reduced;
+      }
+      block.insts.swap(out);
+    }
+  }
+
+ private:
+  Function& fn;
+  std::vector<BlockId> def_block;
+  std::vector<bool> known;  // defined by a Const
+  std::vector<int64_t> value;
+
+  // narrow values are kept sign-extended from 32 bits
+  static int64_t normalize(Ty ty, int64_t value) {
+    if (is_wide(ty)) return value;
+    return static_cast<int32_t>(static_cast<uint32_t>(value));
+  }
+
+  bool same_value(Reg a, Reg b) const {
+    return a == b || (known[a] && known[b] && value[a] == value[b]);
+  }
+
+  Reg new_reg(Ty ty) {
+    const Reg reg = fn.new_reg(ty);
+    def_block.push_back(kNoBlock);
+    known.push_back(false);
+    value.push_back(0);
+    return reg;
+  }
+
+  Reg constant(std::vector<Inst>& out, Ty ty, int64_t imm) {
+    const Reg reg = new_reg(ty);
+    known[reg] = true;
+    value[reg] = normalize(ty, imm);
+    out.push_back({.op = Op::Const, .ty = ty, .dst = reg, .imm = value[reg]});
+    return reg;
+  }
+
+  bool find_induction(const Loop& loop, BlockId preheader,
+                      const std::vector<bool>& inside, Reg reg,
+                      Induction& iv) const {
+    if (def_block[reg] != loop.header || loop.latches.size() != 1) return false;
+    for (const Inst& phi : fn.blocks[loop.header].insts) {
+      if (phi.op != Op::Phi) break;
+      if (phi.dst != reg) continue;
+      if (fn.phi_size(phi) != 2) return false;
+
+      iv.phi = reg;
+      iv.entry = fn.phi_block(phi, 0) == preheader ? 0 : 1;
+      if (fn.phi_block(phi, iv.entry) != preheader ||
+          fn.phi_block(phi, 1 - iv.entry) != loop.latches[0])
+        return false;
+      iv.init = fn.phi_value(phi, iv.entry);
+      const Reg next = fn.phi_value(phi, 1 - iv.entry);
+
+      const BlockId block = def_block[next];
+      if (block == kNoBlock || !inside[block]) return false;
+      for (const Inst& inst : fn.blocks[block].insts) {
+        if (inst.dst != next) continue;
+        iv.op = inst.op;
+        if (inst.op == Op::Add && inst.a == reg)
+          iv.step = inst.b;
+        else if ((inst.op == Op::Add && inst.b == reg) ||
+                 (inst.op == Op::Sub && inst.a == reg && inst.b != reg))
+          iv.step = inst.op == Op::Add ? inst.a : inst.b;
+        else
+          return false;
+        return iv.step != reg;
+      }
+      return false;
+    }
+    return false;
+  }
+
+  /// j = phi [init * factor, preheader], [j +/- step * factor, latch], with
+  /// the update placed right after the one of the original variable
+  Reg add_induction(const Loop& loop, BlockId preheader, const Induction& iv,
+                    Reg factor, Ty ty) {
+    std::vector<Inst> setup;
+    auto times = [&](Reg reg) {
+      if (known[reg] && known[factor])
+        return constant(setup, ty, static_cast<int64_t>(
+                                       static_cast<uint64_t>(value[reg]) *
+                                       static_cast<uint64_t>(value[factor])));
+      // constants inside the loop are rematerialized in the preheader
+      Reg a = reg;
+      Reg b = factor;
+      for (Reg* operand : {&a, &b})
+        if (known[*operand] && def_block[*operand] != preheader)
+          *operand = constant(setup, ty, value[*operand]);
+      const Reg product = new_reg(ty);
+      setup.push_back(
+          {.op = Op::Mul, .ty = ty, .dst = product, .a = a, .b = b});
+      return product;
+    };
+    const Reg initial = times(iv.init);
+    const Reg stride = times(iv.step);
+    auto& pre = fn.blocks[preheader].insts;
+    pre.insert(pre.end() - 1, setup.begin(), setup.end());
+    for (const Inst& inst : setup) def_block[inst.dst] = preheader;
+
+    const Reg phi = new_reg(ty);
+    const Reg next = new_reg(ty);
+    Inst update = {.op = iv.op, .ty = ty, .dst = next, .a = phi, .b = stride};
+    const Reg original = [&] {
+      for (const Inst& inst : fn.blocks[loop.header].insts)
+        if (inst.dst == iv.phi) return fn.phi_value(inst, 1 - iv.entry);
+      return kNoReg;
+    }();
+    auto& insts = fn.blocks[def_block[original]].insts;
+    for (size_t i = 0; i < insts.size(); ++i) {
+      if (insts[i].dst != original) continue;
+      insts.insert(insts.begin() + i + 1, update);
+      break;
+    }
+    def_block[next] = def_block[original];
+
+    Inst merge = {.op = Op::Phi,
+                  .ty = ty,
+                  .dst = phi,
+                  .first = static_cast<uint32_t>(fn.operands.size()),
+                  .count = 4};
+    for (size_t i = 0; i < 2; ++i) {
+      fn.operands.push_back(i == iv.entry ? initial : next);
+      fn.operands.push_back(i == iv.entry ? preheader : loop.latches[0]);
+    }
+    auto& header = fn.blocks[loop.header].insts;
+    header.insert(header.begin(), merge);
+    def_block[phi] = loop.header;
+    return phi;
+  }
+
+  // dst = x * c as shifts and adds: c = ±(2^j ± 1) << k
+  bool multiply(std::vector<Inst>& out, const Inst& inst, Reg x, int64_t c) {
+    const Ty ty = inst.ty;
+    c = normalize(ty, c);
+    if (c == 0) {
+      out.push_back({.op = Op::Const, .ty = ty, .dst = inst.dst, .imm = 0});
+      return true;
+    }
+    if (c == 1 || c == -1) {
+      out.push_back({.op = c == 1 ? Op::Copy : Op::Neg,
+                     .ty = ty,
+                     .dst = inst.dst,
+                     .a = x});
+      return true;
+    }
+
+    const bool negative = c < 0;
+    uint64_t magnitude = static_cast<uint64_t>(c);
+    if (negative) magnitude = 0 - magnitude;
+    if (!is_wide(ty)) magnitude &= 0xffffffff;
+    const int shift = std::countr_zero(magnitude);
+    const uint64_t odd = magnitude >> shift;
+
+    Op combine = Op::Nop;  // with x, after shifting it by j
+    int j = 0;
+    int cost = negative + (odd != 1 && shift > 0);
+    if (odd == 1) {
+      cost += 1;
+    } else if (std::has_single_bit(odd - 1)) {
+      combine = Op::Add;
+      j = std::countr_zero(odd - 1);
+      cost += j <= 3 ? 1 : 2;
+    } else if (std::has_single_bit(odd + 1)) {
+      combine = Op::Sub;
+      j = std::countr_zero(odd + 1);
+      cost += 2;
+    } else {
+      return false;
+    }
+    if (cost > kMaxMultiplyCost) return false;
+
+    // each step writes the result directly if it is the last one
+    int steps = (odd != 1 ? 2 : 0) + (shift > 0) + negative;
+    Reg current = x;
+    auto emit = [&](Op op, Reg a, Reg b, int64_t imm) {
+      const Reg dst = --steps == 0 ? inst.dst : new_reg(ty);
+      out.push_back({.op = op, .ty = ty, .dst = dst, .a = a, .b = b,
+                     .imm = imm});
+      current = dst;
+    };
+    if (combine != Op::Nop) {
+      emit(Op::Shl, x, kNoReg, j);
+      emit(combine, current, x, 0);
+    }
+    if (shift > 0) emit(Op::Shl, current, kNoReg, shift);
+    if (negative) emit(Op::Neg, current, kNoReg, 0);
+    return true;
+  }
+
+  // signed 32-bit division by a constant, rounding toward zero
+  bool divide(std::vector<Inst>& out, const Inst& inst) {
+    if (inst.ty != Ty::I32) return false;
+    const int64_t c = value[inst.b];
+    const Reg x = inst.a;
+    if (c == 1) {
+      out.push_back({.op = Op::Copy, .ty = Ty::I32, .dst = inst.dst, .a = x});
+      return true;
+    }
+    // division by zero and the overflow of min / -1 still trap
+    if (c == 0 || c == -1 || c == std::numeric_limits<int32_t>::min())
+      return false;
+
+    const bool negative = c < 0;
+    const auto d = static_cast<uint32_t>(negative ? -c : c);
+    auto emit = [&](Op op, Ty ty, Reg a, Reg b, int64_t imm = 0,
+                    Reg dst = kNoReg) {
+      if (dst == kNoReg) dst = new_reg(ty);
+      out.push_back({.op = op, .ty = ty, .dst = dst, .a = a, .b = b,
+                     .imm = imm});
+      return dst;
+    };
+    const Reg quotient = negative ? new_reg(Ty::I32) : inst.dst;
+
+    if (std::has_single_bit(d)) {
+      // shifting rounds down, so negative dividends are biased by d - 1
+      const int k = std::countr_zero(d);
+      const Reg sign = k == 1 ? x : emit(Op::Sar, Ty::I32, x, kNoReg, 31);
+      const Reg bias = emit(Op::Shr, Ty::I32, sign, kNoReg, 32 - k);
+      const Reg biased = emit(Op::Add, Ty::I32, x, bias);
+      emit(Op::Sar, Ty::I32, biased, kNoReg, k, quotient);
+    } else {
+      // Granlund and Montgomery: with l = ceil(log2 d) and
+      // m = 2^(31 + l) / d + 1, x / d = (x * m) >> (31 + l), plus one for
+      // negative x. m needs 33 bits signed, so the product is 64-bit.
+      const int l = std::bit_width(d - 1);
+      const auto m = static_cast<int64_t>((uint64_t{1} << (31 + l)) / d + 1);
+      const Reg wide = emit(Op::Sext, Ty::I64, x, kNoReg);
+      const Reg magic = constant(out, Ty::I64, m);
+      const Reg product = emit(Op::Mul, Ty::I64, wide, magic);
+      const Reg high = emit(Op::Sar, Ty::I64, product, kNoReg, 31 + l);
+      const Reg rounded = emit(Op::Trunc, Ty::I32, high, kNoReg);
+      const Reg sign = emit(Op::Sar, Ty::I32, x, kNoReg, 31);
+      emit(Op::Sub, Ty::I32, rounded, sign, 0, quotient);
+    }
+
+    if (negative)
+      out.push_back(
+          {.op = Op::Neg, .ty = Ty::I32, .dst = inst.dst, .a = quotient});
+    return true;
+  }
+};
+
+BlockId find_preheader(const Function& fn, const CFG& cfg, const Loop& loop) {
+  BlockId preheader = kNoBlock;
+  for (BlockId pred : cfg.preds[loop.header]) {
+    if (std::find(loop.blocks.begin(), loop.blocks.end(), pred) !=
+        loop.blocks.end())
+      continue;
+    if (preheader != kNoBlock) return kNoBlock;
+    preheader = pred;
+  }
+  if (preheader == kNoBlock || fn.blocks[preheader].insts.back().op != Op::Br)
+    return kNoBlock;
+  return preheader;
+}
+
+}  // namespace
+
+Preserved reduce_strength(Module& module, FuncId id, Analyses& analyses) {
+  Function& fn = module.functions[id];
+  Reducer reducer(fn);
+
+  const CFG& cfg = analyses.cfg(id);
+  for (const Loop& loop : analyses.loops(id).loops) {
+    const BlockId preheader = find_preheader(fn, cfg, loop);
+    if (preheader != kNoBlock) reducer.reduce_loop(loop, preheader);
+  }
+  reducer.reduce_constant_operands();
+  return reducer.changed ? kPreservesCfg : kPreservesAll;
+}
+
+}  // namespace ir
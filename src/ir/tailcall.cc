@@ -0,0 +1,180 @@
+#include "ir/passes.hh"
+
+namespace ir {
+
+namespace {
+
+// a self call whose result is returned as is, or combined with a value
+// computed without it through an associative operator
+struct Site {
+  BlockId block;
+  size_t call;
+  size_t combine = 0;  // index of the Add or Mul when accumulating
+  Op op = Op::Nop;
+  Reg operand = kNoReg;
+};
+
+bool is_pure(Op op) {
+  return op != Op::Call && op != Op::Print && op != Op::Div &&
+         !is_terminator(op);
+}
+
+bool reads(const Function& fn, const Inst& inst, Reg a, Reg b = kNoReg) {
+  bool found = false;
+  for_each_use(fn, inst, [&](Reg reg) { found |= reg == a || reg == b; });
+  return found;
+}
+
+bool find_site(const Function& fn, FuncId self, BlockId block, Site& site) {
+  const auto& insts = fn.blocks[block].insts;
+  const Inst* ret = fn.blocks[block].terminator();
+  if (!ret || ret->op != Op::Ret || insts.size() < 2) return false;
+
+  // the last call of the block
+  size_t index = insts.size() - 1;
+  while (index > 0 && insts[index - 1].op != Op::Call) --index;
+  if (index-- == 0 || insts[index].callee != self) return false;
+  const Inst& call = insts[index];
+  site = {block, index};
+
+  // what runs between the call and the return has to be free of side
+  // effects, so it can run before the next iteration instead
+  for (size_t i = index + 1; i + 1 < insts.size(); ++i) {
+    const Inst& inst = insts[i];
+    if (!is_pure(inst.op)) return false;
+    if (site.op != Op::Nop && reads(fn, inst, ret->a)) return false;
+    if (!reads(fn, inst, call.dst, call.dst2)) continue;
+
+    if (site.op != Op::Nop || call.dst2 != kNoReg ||
+        (inst.op != Op::Add && inst.op != Op::Mul) || inst.a == inst.b ||
+        inst.dst != ret->a)
+      return false;
+    site.combine = i;
+    site.op = inst.op;
+    site.operand = inst.a == call.dst ? inst.b : inst.a;
+  }
+  return site.op != Op::Nop || (ret->a == call.dst && ret->b == call.dst2);
+}
+
+}  // namespace
+
+Preserved eliminate_tail_calls(Module& module, FuncId self, Analyses&) {
+  Function& fn = module.functions[self];
+
+  std::vector<Site> sites;
+  Op accumulate = Op::Nop;
+  for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+    Site site;
+    if (!find_site(fn, self, block, site)) continue;
+    // one accumulator, so every accumulating site has to agree on it
+    if (site.op != Op::Nop) {
+      if (accumulate != Op::Nop && site.op != accumulate) continue;
+      accumulate = site.op;
+    }
+    sites.push_back(site);
+  }
+  if (sites.empty()) return kPreservesAll;
+
+  // a new entry block falls into the old one, which becomes the loop header
+  for (Block& block : fn.blocks) {
+    for (Inst& inst : block.insts) {
+      if (inst.target != kNoBlock) ++inst.target;
+      if (inst.other != kNoBlock) ++inst.other;
+      if (inst.op == Op::Phi)
+        for (size_t i = 0; i < fn.phi_size(inst); ++i) ++fn.phi_block(inst, i);
+    }
+  }
+  fn.blocks.insert(fn.blocks.begin(), Block{});
+  for (Site& site : sites) ++site.block;
+  constexpr BlockId kHeader = 1;
+
+  // parameters are read through phis in the header from here on
+  const auto params = static_cast<Reg>(fn.params.size());
+  std::vector<Reg> renamed(params);
+  for (Reg param = 0; param < params; ++param)
+    renamed[param] = fn.new_reg(fn.reg_types[param]);
+  for (Block& block : fn.blocks)
+    for (Inst& inst : block.insts)
+      for_each_use(fn, inst, [&](Reg& reg) {
+        if (reg < params) reg = renamed[reg];
+      });
+  for (Site& site : sites)
+    if (site.operand < params) site.operand = renamed[site.operand];
+
+  // one incoming value from the entry, then one per site
+  std::vector<Inst> phis;
+  std::vector<Reg> incoming(sites.size());
+  auto add_phi = [&](Ty ty, Reg dst, Reg initial) {
+    phis.push_back({.op = Op::Phi,
+                    .ty = ty,
+                    .dst = dst,
+                    .first = static_cast<uint32_t>(fn.operands.size()),
+                    .count = static_cast<uint32_t>(2 * (sites.size() + 1))});
+    fn.operands.push_back(initial);
+    fn.operands.push_back(0);
+    for (size_t i = 0; i < sites.size(); ++i) {
+      fn.operands.push_back(incoming[i]);
+      fn.operands.push_back(sites[i].block);
+    }
+  };
+
+  for (Reg param = 0; param < params; ++param) {
+    for (size_t i = 0; i < sites.size(); ++i) {
+      const Inst& call = fn.blocks[sites[i].block].insts[sites[i].call];
+      incoming[i] = fn.args(call)[param];
+    }
+    add_phi(fn.reg_types[param], renamed[param], param);
+  }
+
+  Reg acc = kNoReg;
+  if (accumulate != Op::Nop) {
+    const Ty ty = fn.results[0];
+    const Reg identity = fn.new_reg(ty);
+    fn.blocks[0].insts.push_back({.op = Op::Const,
+                                  .ty = ty,
+                                  .dst = identity,
+                                  .imm = accumulate == Op::Add ? 0 : 1});
+    acc = fn.new_reg(ty);
+    for (size_t i = 0; i < sites.size(); ++i)
+      incoming[i] = sites[i].op != Op::Nop ? fn.new_reg(ty) : acc;
+    add_phi(ty, acc, identity);
+  }
+  fn.blocks[0].insts.push_back({.op = Op::Br, .target = kHeader});
+
+  // each site folds its operand into the accumulator and loops
+  for (size_t i = 0; i < sites.size(); ++i) {
+    const Site& site = sites[i];
+    auto& insts = fn.blocks[site.block].insts;
+    insts.pop_back();
+    if (site.op != Op::Nop) insts.erase(insts.begin() + site.combine);
+    insts.erase(insts.begin() + site.call);
+    if (site.op != Op::Nop)
+      insts.push_back({.op = site.op,
+                       .ty = fn.results[0],
+                       .dst = incoming[i],
+                       .a = acc,
+                       .b = site.operand});
+    insts.push_back({.op = Op::Br, .target = kHeader});
+  }
+
+  // and the remaining returns apply it
+  if (acc != kNoReg) {
+    for (Block& block : fn.blocks) {
+      if (block.insts.empty() || block.insts.back().op != Op::Ret) continue;
+      Inst& ret = block.insts.back();
+      const Reg value = ret.a;
+      ret.a = fn.new_reg(fn.results[0]);
+      block.insts.insert(block.insts.end() - 1, {.op = accumulate,
+                                                 .ty = fn.results[0],
+                                                 .dst = ret.a,
+                                                 .a = acc,
+                                                 .b = value});
+    }
+  }
+
+  auto& header = fn.blocks[kHeader].insts;
+  header.insert(header.begin(), phis.begin(), phis.end());
+  return kPreservesNothing;
+}
+
+}  // namespace ir
@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "ir/cfg.hh"
+#include "ir/passes.hh"
+
+namespace ir {
+
+namespace {
+
+// an unrolled loop body stays within this many instructions
+constexpr size_t kMaxUnrolledSize = 64;
+// copies of the body per iteration of a partially unrolled loop, halved
+// until they fit the budget
+constexpr uint32_t kUnrollFactor = 4;
+// loops known to run at most this many times are unrolled completely
+constexpr uint32_t kMaxFullUnrollTrips = 16;
+
+/// A single-block loop stepping a 32-bit induction variable by a constant,
+/// which keeps going while `next cmp bound` holds for the stepped value
+struct CountedLoop {
+  BlockId header;
+  BlockId preheader;  // ends in a jump to the header
+  BlockId exit;
+  Reg init;
+  Reg next;
+  Reg bound;  // defined outside the loop, or a constant
+  int64_t step;
+  Op cmp;
+  Reg cond;     // the terminator's operand
+  size_t size;  // instructions besides constants, phis and the terminator
+};
+
+Op negate(Op op) {
+  switch (op) {
+    case Op::Eq: return Op::Ne;
+    case Op::Ne: return Op::Eq;
+    case Op::Lt: return Op::Ge;
+    case Op::Le: return Op::Gt;
+    case Op::Gt: return Op::Le;
+    default: return Op::Lt;
+  }
+}
+
+// the same comparison with the operands swapped
+Op swap(Op op) {
+  switch (op) {
+    case Op::Lt: return Op::Gt;
+    case Op::Le: return Op::Ge;
+    case Op::Gt: return Op::Lt;
+    case Op::Ge: return Op::Le;
+    default: return op;
+  }
+}
+
+bool holds(Op op, int64_t a, int64_t b) {
+  switch (op) {
+    case Op::Lt: return a < b;
+    case Op::Le: return a <= b;
+    case Op::Gt: return a > b;
+    default: return a >= b;
+  }
+}
+
+class Unroller {
+ public:
+  explicit Unroller(Function& fn)
+      : fn(fn), def_block(fn.reg_types.size(), kNoBlock),
+        known(fn.reg_types.size(), false), value(fn.reg_types.size(), 0) {
+    for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+      for (const Inst& inst : fn.blocks[block].insts) {
+        if (inst.dst != kNoReg) def_block[inst.dst] = block;
+        if (inst.dst2 != kNoReg) def_block[inst.dst2] = block;
+        if (inst.op != Op::Const) continue;
+        known[inst.dst] = true;
+        value[inst.dst] = inst.imm;
+      }
+    }
+  }
+
+  bool changed = false;
+
+  bool match(const Loop& loop, const CFG& cfg, CountedLoop& counted) const {
+    if (loop.blocks.size() != 1) return false;
+    const BlockId header = loop.header;
+    const Block& block = fn.blocks[header];
+    const Inst* term = block.terminator();
+    if (!term || term->op != Op::CondBr || term->target == term->other)
+      return false;
+    counted.header = header;
+    counted.exit = term->target == header ? term->other : term->target;
+    counted.cond = term->a;
+
+    counted.preheader = kNoBlock;
+    for (BlockId pred : cfg.preds[header]) {
+      if (pred == header) continue;
+      if (counted.preheader != kNoBlock) return false;
+      counted.preheader = pred;
+    }
+    if (counted.preheader == kNoBlock ||
+        fn.blocks[counted.preheader].insts.back().op != Op::Br)
+      return false;
+
+    counted.size = 0;
+    const Inst* compare = nullptr;
+    for (const Inst& inst : block.insts) {
+      if (inst.op == Op::Phi && fn.phi_size(inst) != 2) return false;
+      if (inst.op != Op::Phi && inst.op != Op::Const && !is_terminator(inst.op))
+        ++counted.size;
+      if (inst.dst == counted.cond && is_compare(inst.op)) compare = &inst;
+    }
+    if (!compare) return false;
+
+    // the loop continues while the compare holds, with the stepped
+    // induction variable on the left
+    counted.cmp = term->target == header ? compare->op : negate(compare->op);
+    Reg other = compare->b;
+    if (!find_induction(counted, compare->a)) {
+      if (!find_induction(counted, compare->b)) return false;
+      counted.cmp = swap(counted.cmp);
+      other = compare->a;
+    }
+    counted.bound = other;
+    if (def_block[other] == header && !known[other]) return false;
+
+    // monotonic towards the bound, so the trip count follows from it
+    if (counted.step > 0)
+      return counted.cmp == Op::Lt || counted.cmp == Op::Le;
+    return counted.cmp == Op::Gt || counted.cmp == Op::Ge;
+  }
+
+  /// How often a loop entered with known values runs, 0 if unknown or
+  /// more than can be unrolled completely.
+  uint32_t trip_count(const CountedLoop& loop) const {
+    if (!known[loop.init] || !known[loop.bound]) return 0;
+    // both are 32-bit, whatever width the constants were written with
+    int64_t i = static_cast<int32_t>(value[loop.init]);
+    const int64_t bound = static_cast<int32_t>(value[loop.bound]);
+    for (uint32_t trips = 1; trips <= kMaxFullUnrollTrips; ++trips) {
+      i = static_cast<int32_t>(static_cast<uint32_t>(i + loop.step));
+      if (!holds(loop.cmp, i, bound)) return trips;
+    }
+    return 0;
+  }
+
+  /// Replaces the loop with one copy of its body per iteration.
+  void unroll_fully(const CountedLoop& loop, uint32_t trips) {
+    std::vector<Reg> map(fn.reg_types.size(), kNoReg);
+    std::vector<Inst> body;
+    enter(loop, map, entry_values(loop));
+    for (uint32_t trip = 0; trip < trips; ++trip) {
+      if (trip > 0) enter(loop, map, carried_values(loop, map));
+      clone_body(loop, map, body);
+    }
+    body.push_back({.op = Op::Br, .target = loop.exit});
+
+    for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+      if (block == loop.header) continue;
+      for (Inst& inst : fn.blocks[block].insts)
+        for_each_use(fn, inst, [&](Reg& reg) { reg = lookup(map, reg); });
+    }
+    fn.blocks[loop.header].insts = std::move(body);
+    changed = true;
+  }
+
+  /// Runs `factor` copies of the body per iteration while at least that
+  /// many iterations are left, checked by widening the induction variable
+  /// so the test cannot overflow. The original loop runs the remainder.
+  void unroll(const CountedLoop& loop, uint32_t factor) {
+    const BlockId header = loop.header;
+    const BlockId check = fn.new_block();
+    const BlockId body = fn.new_block();
+    const BlockId rest = fn.new_block();
+
+    // check: room = sext(i) + (factor - 1) * step cmp sext(bound)
+    std::vector<Inst> insts;
+    const Reg bound = new_reg(Ty::I64);
+    if (known[loop.bound])
+      insts.push_back({.op = Op::Const,
+                       .ty = Ty::I64,
+                       .dst = bound,
+                       .imm = static_cast<int32_t>(value[loop.bound])});
+    else
+      insts.push_back(
+          {.op = Op::Sext, .ty = Ty::I64, .dst = bound, .a = loop.bound});
+    const Reg offset = new_reg(Ty::I64);
+    insts.push_back({.op = Op::Const,
+                     .ty = Ty::I64,
+                     .dst = offset,
+                     .imm = (factor - 1) * loop.step});
+    auto room = [&](Reg reg) {
+      const Reg wide = new_reg(Ty::I64);
+      const Reg last = new_reg(Ty::I64);
+      const Reg cond = new_reg(Ty::I1);
+      insts.push_back({.op = Op::Sext, .ty = Ty::I64, .dst = wide, .a = reg});
+      insts.push_back(
+          {.op = Op::Add, .ty = Ty::I64, .dst = last, .a = wide, .b = offset});
+      insts.push_back(
+          {.op = loop.cmp, .ty = Ty::I1, .dst = cond, .a = last, .b = bound});
+      return cond;
+    };
+    const Reg enough = room(loop.init);
+    insts.push_back(
+        {.op = Op::CondBr, .a = enough, .target = body, .other = header});
+    fn.blocks[check].insts = std::move(insts);
+
+    // body: phis, the copies, then the same check on the stepped value
+    std::vector<Reg> map(fn.reg_types.size(), kNoReg);
+    std::vector<Reg> phis;
+    std::vector<Reg> initial = entry_values(loop);
+    insts.clear();
+    for (Reg init : initial) {
+      const Reg phi = new_reg(fn.reg_types[init]);
+      phis.push_back(phi);
+      insts.push_back({.op = Op::Phi,
+                       .ty = fn.reg_types[phi],
+                       .dst = phi,
+                       .first = static_cast<uint32_t>(fn.operands.size()),
+                       .count = 4});
+      fn.operands.insert(fn.operands.end(), {init, check, kNoReg, body});
+    }
+    enter(loop, map, phis);
+    for (uint32_t copy = 0; copy < factor; ++copy) {
+      if (copy > 0) enter(loop, map, carried_values(loop, map));
+      clone_body(loop, map, insts);
+    }
+    const std::vector<Reg> carried = carried_values(loop, map);
+    for (size_t i = 0; i < phis.size(); ++i)
+      fn.phi_value(insts[i], 1) = carried[i];
+    const Reg again = room(lookup(map, loop.next));
+    insts.push_back(
+        {.op = Op::CondBr, .a = again, .target = body, .other = rest});
+    fn.blocks[body].insts = std::move(insts);
+
+    // rest: the original test decides between the remainder and the exit
+    Inst test = fn.blocks[header].insts.back();
+    test.a = lookup(map, loop.cond);
+    fn.blocks[rest].insts.push_back(test);
+
+    fn.blocks[loop.preheader].insts.back().target = check;
+    size_t index = 0;
+    for (Inst& phi : fn.blocks[header].insts) {
+      if (phi.op != Op::Phi) break;
+      for (size_t i = 0; i < 2; ++i)
+        if (fn.phi_block(phi, i) == loop.preheader)
+          fn.phi_block(phi, i) = check;
+      add_incoming(phi, carried[index++], rest);
+    }
+    for (Inst& phi : fn.blocks[loop.exit].insts) {
+      if (phi.op != Op::Phi) break;
+      for (size_t i = 0; i < fn.phi_size(phi); ++i) {
+        if (fn.phi_block(phi, i) != header) continue;
+        add_incoming(phi, lookup(map, fn.phi_value(phi, i)), rest);
+        break;
+      }
+    }
+
+    // other uses after the loop now see one of two definitions
+    std::vector<Reg> merged(fn.reg_types.size(), kNoReg);
+    std::vector<Inst> merges;
+    auto outside = [&](BlockId block) {
+      return block != header && block != check && block != body &&
+             block != rest;
+    };
+    for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+      if (!outside(block)) continue;
+      for (Inst& inst : fn.blocks[block].insts) {
+        if (block == loop.exit && inst.op == Op::Phi) continue;
+        for_each_use(fn, inst, [&](Reg& reg) {
+          if (def_block[reg] != header) return;
+          if (merged[reg] == kNoReg) {
+            merged[reg] = new_reg(fn.reg_types[reg]);
+            merges.push_back({.op = Op::Phi,
+                              .ty = fn.reg_types[reg],
+                              .dst = merged[reg],
+                              .first =
+                                  static_cast<uint32_t>(fn.operands.size()),
+                              .count = 4});
+            fn.operands.insert(fn.operands.end(),
+                               {reg, header, lookup(map, reg), rest});
+          }
+          reg = merged[reg];
+        });
+      }
+    }
+    auto& exit = fn.blocks[loop.exit].insts;
+    exit.insert(exit.begin(), merges.begin(), merges.end());
+    changed = true;
+  }
+
+  /// Whether results of the loop are used past the exit other than by its
+  /// phis, which only works when the loop is the exit's one predecessor.
+  bool used_after(const CountedLoop& loop) const {
+    for (BlockId block = 0; block < fn.blocks.size(); ++block) {
+      if (block == loop.header) continue;
+      for (const Inst& inst : fn.blocks[block].insts) {
+        if (block == loop.exit && inst.op == Op::Phi) continue;
+        bool used = false;
+        for_each_use(fn, inst,
+                     [&](Reg reg) { used |= def_block[reg] == loop.header; });
+        if (used) return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  Function& fn;
+  std::vector<BlockId> def_block;
+  std::vector<bool> known;  // defined by a Const
+  std::vector<int64_t> value;
+
+  Reg new_reg(Ty ty) {
+    const Reg reg = fn.new_reg(ty);
+    def_block.push_back(kNoBlock);
+    known.push_back(false);
+    value.push_back(0);
+    return reg;
+  }
+
+  static Reg lookup(const std::vector<Reg>& map, Reg reg) {
+    return reg < map.size() && map[reg] != kNoReg ? map[reg] : reg;
+  }
+
+  /// next = iv + step or iv - step, for a phi of the loop carrying next
+  bool find_induction(CountedLoop& loop, Reg next) const {
+    if (next == kNoReg || def_block[next] != loop.header ||
+        fn.reg_types[next] != Ty::I32)
+      return false;
+    const auto& insts = fn.blocks[loop.header].insts;
+    const auto def = std::find_if(insts.begin(), insts.end(),
+                                  [&](const Inst& i) { return i.dst == next; });
+    if (def == insts.end() || (def->op != Op::Add && def->op != Op::Sub))
+      return false;
+
+    for (const Inst& phi : insts) {
+      if (phi.op != Op::Phi) break;
+      const size_t latch = fn.phi_block(phi, 0) == loop.header ? 0 : 1;
+      if (fn.phi_value(phi, latch) != next) continue;
+      Reg step = kNoReg;
+      if (def->a == phi.dst)
+        step = def->b;
+      else if (def->op == Op::Add && def->b == phi.dst)
+        step = def->a;
+      if (step == kNoReg || !known[step] || value[step] == 0) return false;
+      loop.init = fn.phi_value(phi, 1 - latch);
+      loop.next = next;
+      loop.step = def->op == Op::Add ? value[step] : -value[step];
+      return true;
+    }
+    return false;
+  }
+
+  std::vector<Reg> entry_values(const CountedLoop& loop) const {
+    std::vector<Reg> values;
+    for (const Inst& phi : fn.blocks[loop.header].insts) {
+      if (phi.op != Op::Phi) break;
+      values.push_back(fn.phi_value(
+          phi, fn.phi_block(phi, 0) == loop.preheader ? 0 : 1));
+    }
+    return values;
+  }
+
+  // what the phis receive after the copy of the body mapped so far
+  std::vector<Reg> carried_values(const CountedLoop& loop,
+                                  const std::vector<Reg>& map) const {
+    std::vector<Reg> values;
+    for (const Inst& phi : fn.blocks[loop.header].insts) {
+      if (phi.op != Op::Phi) break;
+      values.push_back(lookup(
+          map, fn.phi_value(phi, fn.phi_block(phi, 0) == loop.header ? 0 : 1)));
+    }
+    return values;
+  }
+
+  void enter(const CountedLoop& loop, std::vector<Reg>& map,
+             const std::vector<Reg>& values) const {
+    size_t index = 0;
+    for (const Inst& phi : fn.blocks[loop.header].insts) {
+      if (phi.op != Op::Phi) break;
+      map[phi.dst] = values[index++];
+    }
+  }
+
+  /// Appends a copy of the body reading the registers mapped so far, and
+  /// maps its results to the copies.
+  void clone_body(const CountedLoop& loop, std::vector<Reg>& map,
+                  std::vector<Inst>& out) {
+    const size_t count = fn.blocks[loop.header].insts.size();
+    for (size_t i = 0; i < count; ++i) {
+      const Inst& inst = fn.blocks[loop.header].insts[i];
+      if (inst.op == Op::Phi || is_terminator(inst.op)) continue;
+      Inst copy = inst;
+      if (copy.op == Op::Call) {
+        copy.first = static_cast<uint32_t>(fn.operands.size());
+        for (uint32_t arg = 0; arg < inst.count; ++arg)
+          fn.operands.push_back(fn.operands[inst.first + arg]);
+      }
+      for_each_use(fn, copy, [&](Reg& reg) { reg = lookup(map, reg); });
+      for (Reg Inst::*result : {&Inst::dst, &Inst::dst2}) {
+        const Reg original = inst.*result;
+        if (original == kNoReg) continue;
+        copy.*result = map[original] = new_reg(fn.reg_types[original]);
+        if (copy.op == Op::Const) {
+          known[copy.dst] = true;
+          value[copy.dst] = copy.imm;
+        }
+      }
+      out.push_back(copy);
+    }
+  }
+
+  // phis keep their operands contiguous, so they move to the end of the pool
+  void add_incoming(Inst& phi, Reg reg, BlockId block) {
+    const auto first = static_cast<uint32_t>(fn.operands.size());
+    for (uint32_t i = 0; i < phi.count; ++i)
+      fn.operands.push_back(fn.operands[phi.first + i]);
+    fn.operands.push_back(reg);
+    fn.operands.push_back(block);
+    phi.first = first;
+    phi.count += 2;
+  }
+};
+
+}  // namespace
+
+Preserved unroll_loops(Module& module, FuncId id, Analyses& analyses) {
+  Function& fn = module.functions[id];
+  const LoopInfo& loops = analyses.loops(id);
+  if (loops.loops.empty()) return kPreservesAll;
+
+  Unroller unroller(fn);
+  const CFG& cfg = analyses.cfg(id);
+  // the predecessors are not updated, so loops sharing an exit with one
+  // unrolled before are left alone
+  std::vector<bool> touched(fn.blocks.size(), false);
+  for (const Loop& loop : loops.loops) {
+    CountedLoop counted;
+    if (!unroller.match(loop, cfg, counted) || touched[counted.exit]) continue;
+
+    const uint32_t trips = unroller.trip_count(counted);
+    if (trips > 0 && trips * counted.size <= kMaxUnrolledSize) {
+      unroller.unroll_fully(counted, trips);
+    } else {
+      uint32_t factor = kUnrollFactor;
+      while (factor > 1 && factor * counted.size > kMaxUnrolledSize)
+        factor /= 2;
+      if (factor < 2 || (cfg.preds[counted.exit].size() > 1 &&
+                         unroller.used_after(counted)))
+        continue;
+      unroller.unroll(counted, factor);
+    }
+    touched[counted.exit] = true;
+  }
+  return unroller.changed ? kPreservesNothing : kPreservesAll;
+}
+
+}  // namespace ir
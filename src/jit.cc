@@ -0,0 +1,50 @@
+#include "jit.hh"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "log.hh"
+
+bool run_in_process(x86::Image image, uint32_t entry, int& exit_code) {
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t text_size = (image.text.size() + page - 1) & ~(page - 1);
+  const size_t rodata_size = (image.rodata.size() + page - 1) & ~(page - 1);
+  const size_t size = text_size + rodata_size;
+
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    LOG_ERROR("[JIT] mmap of {} bytes failed: {}", size, std::strerror(errno));
+    return false;
+  }
+  auto* text = static_cast<uint8_t*>(memory);
+  uint8_t* rodata = text + text_size;
+
+  image.relocate(reinterpret_cast<uint64_t>(text),
+                 reinterpret_cast<uint64_t>(rodata));
+  std::memcpy(text, image.text.data(), image.text.size());
+  if (!image.rodata.empty())
+    std::memcpy(rodata, image.rodata.data(), image.rodata.size());
+
+  if (mprotect(text, text_size, PROT_READ | PROT_EXEC) != 0 ||
+      (rodata_size > 0 && mprotect(rodata, rodata_size, PROT_READ) != 0)) {
+    LOG_ERROR("[JIT] mprotect failed: {}", std::strerror(errno));
+    munmap(memory, size);
+    return false;
+  }
+
+  // the program writes to fd 1 itself, so earlier output has to be out
+  std::cout.flush();
+  std::fflush(stdout);
+
+  auto function = reinterpret_cast<int (*)()>(text + entry);
+  exit_code = function();
+
+  munmap(memory, size);
+  return true;
+}
@@ -159,7 +159,7 @@ Token Lexer::identifier() {
     return make_token(*type, buf);
   }
   // if (in.peek() == '(') return make_token(TokenType::)
-  return make_token(TokenType::TOKEN_ID, buf);
+  return Token(TokenType::TOKEN_ID, buf, location, context.intern(buf));
 }
 
 Token Lexer::number() {
@@ -171,6 +171,12 @@ void semantic_error(const std::string& message, int line, int col) {
   ss << "Semantic error at line " << line << ", col " << col << ": " << message;
   Logger::error(ss.str());
 }
+
+void semantic_warning(const std::string& message, int line, int col) {
+  std::stringstream ss;
+  ss << "Warning at line " << line << ", col " << col << ": " << message;
+  Logger::warn(ss.str());
+}
 }  // namespace Log::Compiler
 
 // AST printing functions using ast_utils
@@ -1,26 +1,118 @@
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <string>
 
 #include "diagnostics.hh"
+#include "elf.hh"
+#include "encoder.hh"
 #include "gen.hh"
+#include "ir/ir.hh"
+#include "ir/ssa.hh"
+#include "jit.hh"
 #include "lexer.hh"
 #include "log.hh"
 #include "parser.hh"
+#include "pass_manager.hh"
 #include "sema.hh"
+#include "visitor/lowering.hh"
 #include "visitor/visitor.hh"
+#include "vm/bytecode.hh"
+#include "vm/vm.hh"
 
 void print_usage(char** argv) {
-  LOG_FATAL("USAGE: {} <path-to-file>\n", argv[0]);
+  LOG_FATAL(
+      "USAGE: {} [-S <output.s>] [-o <executable>] [--run] [--vm] "
+      "[--jxb <output.jxb>] [-O0|-O1|-O2] [--passes=<a,b,...>] "
+      "[--inline-threshold=<n>] [--time-passes] <path-to-file | file.jxb>\n",
+      argv[0]);
   exit(1);
 }
 
+bool verify_ssa_module(const ir::Module& module) {
+  std::vector<std::string> errors;
+  for (const ir::Function& fn : module.functions) ir::verify_ssa(fn, errors);
+  if (ir::verify(module, errors)) return true;
+  for (const auto& err : errors) LOG_ERROR("[IR] {}", err);
+  return false;
+}
+
+int run_bytecode(const vm::Program& program) {
+  std::vector<std::string> errors;
+  if (!vm::verify(program, errors)) {
+    for (const auto& err : errors) LOG_ERROR("[VM] {}", err);
+    return 1;
+  }
+  int exit_code = 0;
+  if (!vm::run(program, exit_code)) return 1;
+  return exit_code;
+}
+
 int main(const int argc, char** argv) {
   Diagnostics::instance().clear();
-  if (argc != 2) print_usage(argv);
 
-  std::string filepath = argv[1];
+  std::string filepath;
+  std::string asm_path;
+  std::string exe_path;
+  std::string jxb_path;
+  bool run = false;
+  bool use_vm = false;
+  int level = 1;
+  std::string passes;
+  bool custom_passes = false;
+  bool time_passes = false;
+  std::optional<int> inline_threshold;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-S" && i + 1 < argc)
+      asm_path = argv[++i];
+    else if (arg == "-o" && i + 1 < argc)
+      exe_path = argv[++i];
+    else if (arg == "--run")
+      run = true;
+    else if (arg == "--vm")
+      use_vm = true;
+    else if (arg == "--jxb" && i + 1 < argc)
+      jxb_path = argv[++i];
+    else if (arg == "-O0" || arg == "-O1" || arg == "-O2")
+      level = arg[2] - '0';
+    else if (arg.starts_with("--passes=")) {
+      passes = arg.substr(9);
+      custom_passes = true;
+    } else if (arg.starts_with("--inline-threshold=")) {
+      inline_threshold = std::atoi(arg.c_str() + 19);
+    } else if (arg == "--time-passes")
+      time_passes = true;
+    else if (filepath.empty() && !arg.starts_with("-"))
+      filepath = arg;
+    else
+      print_usage(argv);
+  }
+  if (filepath.empty()) print_usage(argv);
+
+  PassManager pass_manager;
+  if (custom_passes) {
+    std::string error;
+    if (!pass_manager.add(passes, error)) {
+      LOG_FATAL("{}", error);
+      return 1;
+    }
+  } else {
+    pass_manager.add_level(level);
+  }
+  if (inline_threshold)
+    pass_manager.options.inline_threshold = *inline_threshold;
+
+  if (filepath.ends_with(".jxb")) {
+    vm::Program bytecode;
+    std::string error;
+    if (!vm::read(filepath, bytecode, error)) {
+      LOG_FATAL("{}", error);
+      return 1;
+    }
+    return run_bytecode(bytecode);
+  }
 
   std::ifstream file(filepath, std::ios::binary);
   if (!file) {
@@ -56,13 +148,95 @@ int main(const int argc, char** argv) {
     return 1;
   }
 
-  // CodeGenerator gen(ctx);
-  // std::string code = gen.generate(*sema_tree);
-  // LOG_INFO("\n{}", code);
+  ir::Module module;
+  Lowering lowering(ctx, module);
+  lowering.lower(sema.reachable());
+
+  std::vector<std::string> ir_errors;
+  if (lowering.has_errors() || !ir::verify(module, ir_errors)) {
+    for (const auto& err : ir_errors) LOG_ERROR("[IR] {}", err);
+    LOG_ERROR("Lowering failed; skipping code generation");
+    delete ast;
+    return 1;
+  }
+
+  for (ir::Function& fn : module.functions) ir::construct_ssa(fn);
+  if (!verify_ssa_module(module)) {
+    LOG_ERROR("SSA construction failed; skipping code generation");
+    delete ast;
+    return 1;
+  }
+  LOG_DEBUG("\n{}", ir::print(module));
+
+  pass_manager.run(module);
+  if (!pass_manager.empty()) {
+    if (!verify_ssa_module(module)) {
+      LOG_ERROR("Optimization produced invalid IR");
+      delete ast;
+      return 1;
+    }
+    LOG_DEBUG("\n{}", ir::print(module));
+  }
+
+  for (ir::Function& fn : module.functions) ir::destruct_ssa(fn);
+
+  if (use_vm || !jxb_path.empty()) {
+    vm::Program bytecode = vm::compile(module);
+    LOG_DEBUG("\n{}", vm::print(bytecode));
+    if (!jxb_path.empty() && !vm::write(bytecode, jxb_path)) {
+      LOG_FATAL("Could not write bytecode: {}", jxb_path);
+      delete ast;
+      return 1;
+    }
+    if (use_vm) {
+      if (time_passes) LOG_INFO("\n{}", pass_manager.report());
+      delete ast;
+      return run_bytecode(bytecode);
+    }
+  }
+
+  CodeGenerator gen;
+  x86::Program program = gen.generate(module);
+  pass_manager.run(program);
+  if (time_passes) LOG_INFO("\n{}", pass_manager.report());
 
-  // std::ofstream out("program.s");
-  // out << code;
-  // out.close();
+  // the assembly text is only built when it is written
+  if (!asm_path.empty()) {
+    std::ofstream out(asm_path);
+    if (!out) {
+      LOG_FATAL("Could not open output file: {}", asm_path);
+      delete ast;
+      return 1;
+    }
+    std::string code = x86::print(program);
+    LOG_DEBUG("\n{}", code);
+    out.write(code.data(), static_cast<std::streamsize>(code.size()));
+  }
+
+  if (exe_path.empty() && !run) {
+    delete ast;
+    return 0;
+  }
+
+  // encoded once for both outputs, writing relocates a copy of its own
+  x86::Image image = x86::encode(program);
+  if (!exe_path.empty() && !write_executable(exe_path, image)) {
+    LOG_FATAL("Could not write executable: {}", exe_path);
+    delete ast;
+    return 1;
+  }
+
+  if (run) {
+    const std::string& entry = module.functions[module.entry].name;
+    uint32_t offset = image.entry;
+    for (size_t i = 0; i < program.symbols.size(); ++i)
+      if (program.symbols[i] == entry) offset = image.symbols[i];
+
+    int exit_code = 0;
+    delete ast;
+    if (!run_in_process(std::move(image), offset, exit_code)) return 1;
+    return exit_code;
+  }
 
   delete ast;
 }
@@ -510,7 +510,7 @@ ExprNode* Parser::parseMethodCall() {
       continue;
     }
 
-    ExprNode* arg_expr = Parser::parseExpr();
+    ExprNode* arg_expr = Parser::parseBinaryExpr();
 
     SourceLocation arg_loc;
     if (arg_expr) {
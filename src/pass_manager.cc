@@ -0,0 +1,193 @@
+#include "pass_manager.hh"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "ir/passes.hh"
+#include "ir/ssa.hh"
+#include "log.hh"
+#include "peephole.hh"
+
+const ir::CFG& Analyses::cfg(ir::FuncId fn) {
+  Entry& entry = entries[fn];
+  if (!entry.cfg) entry.cfg.emplace(module.functions[fn]);
+  return *entry.cfg;
+}
+
+const ir::DominatorTree& Analyses::dominators(ir::FuncId fn) {
+  Entry& entry = entries[fn];
+  if (!entry.dominators)
+    entry.dominators.emplace(module.functions[fn], cfg(fn));
+  return *entry.dominators;
+}
+
+const ir::LoopInfo& Analyses::loops(ir::FuncId fn) {
+  Entry& entry = entries[fn];
+  if (!entry.loops)
+    entry.loops.emplace(module.functions[fn], cfg(fn), dominators(fn));
+  return *entry.loops;
+}
+
+void Analyses::invalidate(ir::FuncId fn, Preserved preserved) {
+  if (preserved & kPreservesCfg) return;
+  Entry& entry = entries[fn];
+  entry.cfg.reset();
+  entry.dominators.reset();
+  entry.loops.reset();
+}
+
+void Analyses::invalidate(Preserved preserved) {
+  entries.resize(module.functions.size());
+  for (ir::FuncId fn = 0; fn < entries.size(); ++fn) invalidate(fn, preserved);
+}
+
+static Preserved verify_pass(ir::Module& module, ir::FuncId fn, Analyses&) {
+  std::vector<std::string> errors;
+  ir::verify_ssa(module.functions[fn], errors);
+  for (const std::string& error : errors) LOG_ERROR("[IR] {}", error);
+  return kPreservesAll;
+}
+
+static constexpr Pass kPasses[] = {
+    {.name = "verify",
+     .description = "check SSA invariants, changes nothing",
+     .kind = Pass::Kind::Function,
+     .function = verify_pass},
+    {.name = "inline",
+     .description = "inline small and single-use functions bottom-up",
+     .kind = Pass::Kind::Module,
+     .module = ir::inline_functions},
+    {.name = "tailcall",
+     .description = "turn self tail calls into loops, with accumulators",
+     .kind = Pass::Kind::Function,
+     .function = ir::eliminate_tail_calls},
+    {.name = "sccp",
+     .description = "propagate constants and fold branches on them",
+     .kind = Pass::Kind::Function,
+     .function = ir::propagate_constants},
+    {.name = "ifconvert",
+     .description = "turn small if/else into selects, lowered to cmov",
+     .kind = Pass::Kind::Function,
+     .function = ir::flatten_conditionals},
+    {.name = "licm",
+     .description = "hoist loop-invariant instructions into preheaders",
+     .kind = Pass::Kind::Function,
+     .function = ir::hoist_loop_invariants},
+    {.name = "unroll",
+     .description = "unroll counted loops, completely when they run briefly",
+     .kind = Pass::Kind::Function,
+     .function = ir::unroll_loops},
+    {.name = "strength",
+     .description = "turn multiplies and divisions into cheaper operations",
+     .kind = Pass::Kind::Function,
+     .function = ir::reduce_strength},
+    {.name = "dce",
+     .description = "remove instructions whose results are never used",
+     .kind = Pass::Kind::Function,
+     .function = ir::eliminate_dead_code},
+    {.name = "peephole",
+     .description = "rewrite short windows of machine instructions",
+     .kind = Pass::Kind::Machine,
+     .machine = x86::peephole},
+};
+
+std::span<const Pass> registered_passes() { return kPasses; }
+
+const Pass* find_pass(std::string_view name) {
+  for (const Pass& pass : kPasses)
+    if (name == pass.name) return &pass;
+  return nullptr;
+}
+
+void PassManager::add_level(int level) {
+  static constexpr const char* kLevels[kMaxLevel + 1] = {
+      "",
+      "inline,tailcall,sccp,ifconvert,licm,strength,dce,peephole",
+      "inline,tailcall,sccp,ifconvert,licm,unroll,sccp,strength,dce,peephole",
+  };
+  // -O1 only inlines bodies no larger than the call they replace
+  static constexpr int kInlineThresholds[kMaxLevel + 1] = {0, 0, 30};
+
+  level = std::clamp(level, 0, kMaxLevel);
+  options.inline_threshold = kInlineThresholds[level];
+  std::string error;
+  add(kLevels[level], error);
+}
+
+bool PassManager::add(std::string_view names, std::string& error) {
+  std::vector<Scheduled> added;
+  while (!names.empty()) {
+    size_t comma = names.find(',');
+    std::string_view name = names.substr(0, comma);
+    names = comma == std::string_view::npos ? "" : names.substr(comma + 1);
+    if (name.empty()) continue;
+
+    const Pass* pass = find_pass(name);
+    if (!pass) {
+      error = "unknown pass '" + std::string(name) + "'";
+      return false;
+    }
+    added.push_back({pass});
+  }
+  pipeline.insert(pipeline.end(), added.begin(), added.end());
+  return true;
+}
+
+void PassManager::run(ir::Module& module) {
+  Analyses analyses(module, options);
+  for (Scheduled& scheduled : pipeline) {
+    const Pass& pass = *scheduled.pass;
+    if (pass.kind == Pass::Kind::Machine) continue;
+
+    auto start = std::chrono::steady_clock::now();
+    if (pass.kind == Pass::Kind::Module) {
+      analyses.invalidate(pass.module(module, analyses));
+    } else {
+      for (ir::FuncId fn = 0; fn < module.functions.size(); ++fn)
+        analyses.invalidate(fn, pass.function(module, fn, analyses));
+    }
+    scheduled.time += std::chrono::steady_clock::now() - start;
+    ++scheduled.runs;
+  }
+}
+
+void PassManager::run(x86::Program& program) {
+  for (Scheduled& scheduled : pipeline) {
+    if (scheduled.pass->kind != Pass::Kind::Machine) continue;
+
+    auto start = std::chrono::steady_clock::now();
+    scheduled.pass->machine(program);
+    scheduled.time += std::chrono::steady_clock::now() - start;
+    ++scheduled.runs;
+  }
+}
+
+std::string PassManager::report() const {
+  std::vector<const Scheduled*> order;
+  std::chrono::nanoseconds total{};
+  for (const Scheduled& scheduled : pipeline) {
+    order.push_back(&scheduled);
+    total += scheduled.time;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [](const Scheduled* a, const Scheduled* b) {
+                     return a->time > b->time;
+                   });
+
+  auto line = [](std::string& out, std::chrono::nanoseconds time,
+                 const char* name, uint32_t runs) {
+    char buffer[96];
+    double ms = std::chrono::duration<double, std::milli>(time).count();
+    if (runs == 0)
+      std::snprintf(buffer, sizeof(buffer), "  %9.3f ms  %s\n", ms, name);
+    else
+      std::snprintf(buffer, sizeof(buffer), "  %9.3f ms  %-12s (%u run%s)\n",
+                    ms, name, runs, runs == 1 ? "" : "s");
+    out += buffer;
+  };
+  std::string out = "Pass timing:\n";
+  for (const Scheduled* scheduled : order)
+    line(out, scheduled->time, scheduled->pass->name, scheduled->runs);
+  line(out, total, "total", 0);
+  return out;
+}
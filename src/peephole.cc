@@ -0,0 +1,467 @@
+#include "peephole.hh"
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "log.hh"
+
+namespace x86 {
+
+namespace {
+
+// one bit per register, and one for the flags
+using RegSet = uint32_t;
+
+constexpr RegSet kFlags = RegSet{1} << kRegCount;
+
+constexpr RegSet bit(Reg reg) { return RegSet{1} << reg; }
+
+constexpr RegSet kCallerSaved = bit(rax) | bit(rcx) | bit(rdx) | bit(rsi) |
+                                bit(rdi) | bit(r8) | bit(r9) | bit(r10) |
+                                bit(r11);
+constexpr RegSet kCalleeSaved =
+    bit(rbx) | bit(rsp) | bit(rbp) | bit(r12) | bit(r13) | bit(r14) | bit(r15);
+constexpr RegSet kArguments =
+    bit(rdi) | bit(rsi) | bit(rdx) | bit(rcx) | bit(r8) | bit(r9);
+
+// registers an operand reads when it is a source or an address
+RegSet reads(const Operand& operand) {
+  switch (operand.kind) {
+    case Operand::Kind::Reg:
+      return bit(operand.reg);
+    case Operand::Kind::Mem:
+      if (operand.rip) return 0;
+      return bit(operand.reg) | (operand.has_index ? bit(operand.index) : 0);
+    default:
+      return 0;
+  }
+}
+
+struct Effects {
+  RegSet uses = 0;
+  RegSet defs = 0;
+};
+
+// a register destination narrower than 32 bits keeps the rest of the
+// register, so it reads it as well
+Effects write(const Operand& dst) {
+  if (!dst.is_reg()) return {reads(dst), 0};
+  if (dst.size < 4) return {bit(dst.reg), bit(dst.reg)};
+  return {0, bit(dst.reg)};
+}
+
+Effects effects(const Inst& inst) {
+  switch (inst.op) {
+    case Opcode::Label:
+    case Opcode::Jmp:
+      return {};
+    case Opcode::Jcc:
+      return {kFlags, 0};
+    case Opcode::Mov:
+    case Opcode::Movzx:
+    case Opcode::Movsxd:
+    case Opcode::Lea: {
+      Effects dst = write(inst.dst);
+      return {dst.uses | reads(inst.src), dst.defs};
+    }
+    case Opcode::Setcc: {
+      Effects dst = write(inst.dst);
+      return {dst.uses | kFlags, dst.defs};
+    }
+    case Opcode::Cmovcc:  // keeps the destination when not taken
+      return {bit(inst.dst.reg) | reads(inst.src) | kFlags,
+              bit(inst.dst.reg)};
+    case Opcode::Xor:
+      if (inst.dst.is_reg() && inst.dst == inst.src)  // zero idiom
+        return {0, bit(inst.dst.reg) | kFlags};
+      [[fallthrough]];
+    case Opcode::Add:
+    case Opcode::Sub:
+    case Opcode::Imul:
+    case Opcode::Neg:
+    case Opcode::Shl:
+    case Opcode::Sar:
+    case Opcode::Shr:
+      return {reads(inst.dst) | reads(inst.src),
+              write(inst.dst).defs | kFlags};
+    case Opcode::Cmp:
+    case Opcode::Test:
+      return {reads(inst.dst) | reads(inst.src), kFlags};
+    case Opcode::Cdq:
+    case Opcode::Cqo:
+      return {bit(rax), bit(rdx)};
+    case Opcode::Idiv:
+      return {bit(rax) | bit(rdx) | reads(inst.dst),
+              bit(rax) | bit(rdx) | kFlags};
+    case Opcode::Push:
+      return {reads(inst.dst) | bit(rsp), bit(rsp)};
+    case Opcode::Pop:
+      return {bit(rsp) | write(inst.dst).uses, bit(rsp) | write(inst.dst).defs};
+    case Opcode::Call:
+      return {kArguments | bit(rsp), kCallerSaved | kFlags};
+    case Opcode::Ret:
+      return {bit(rax) | bit(rdx) | kCalleeSaved, 0};
+    case Opcode::Leave:
+      return {bit(rbp), bit(rsp) | bit(rbp)};
+    case Opcode::Syscall:
+      return {bit(rax) | bit(rdi) | bit(rsi) | bit(rdx),
+              bit(rax) | bit(rcx) | bit(r11)};
+  }
+  return {};
+}
+
+/// Instructions of one function with what is live after each of them
+class Liveness {
+ public:
+  void compute(std::span<const Inst> insts, std::vector<uint32_t>& position) {
+    constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+    const uint32_t count = static_cast<uint32_t>(insts.size());
+
+    for (uint32_t i = 0; i < count; ++i)
+      if (insts[i].op == Opcode::Label) position[insts[i].dst.label] = i;
+
+    // successors: fall through, and the target of a jump
+    next.assign(count, kNone);
+    jump.assign(count, kNone);
+    for (uint32_t i = 0; i < count; ++i) {
+      const Inst& inst = insts[i];
+      if (inst.op == Opcode::Jmp || inst.op == Opcode::Jcc)
+        jump[i] = position[inst.dst.label];
+      if (inst.op != Opcode::Jmp && inst.op != Opcode::Ret && i + 1 < count)
+        next[i] = i + 1;
+    }
+
+    live_in.assign(count, 0);
+    live_out.assign(count, 0);
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (uint32_t i = count; i-- > 0;) {
+        RegSet out = 0;
+        if (next[i] != kNone) out |= live_in[next[i]];
+        if (jump[i] != kNone) out |= live_in[jump[i]];
+        Effects e = effects(insts[i]);
+        RegSet in = e.uses | (out & ~e.defs);
+        if (out != live_out[i] || in != live_in[i]) changed = true;
+        live_out[i] = out;
+        live_in[i] = in;
+      }
+    }
+
+    for (const Inst& inst : insts)
+      if (inst.op == Opcode::Label) position[inst.dst.label] = kNone;
+  }
+
+  std::vector<RegSet> live_out;
+
+ private:
+  std::vector<RegSet> live_in;
+  std::vector<uint32_t> next;
+  std::vector<uint32_t> jump;
+};
+
+/// A window of instructions a pattern looks at, and what it is replaced by
+struct Match {
+  std::span<const Inst> insts;
+  std::span<const RegSet> live_out;
+  std::vector<Inst>& out;
+
+  bool live_after(RegSet regs) const { return live_out.back() & regs; }
+};
+
+struct Pattern {
+  const char* name;
+  size_t length;
+  bool (*rewrite)(Match& match);
+};
+
+bool is_mov(const Inst& inst) {
+  return inst.op == Opcode::Mov &&
+         (inst.dst.is_reg() || inst.dst.is_mem()) &&
+         (inst.src.is_reg() || inst.src.is_mem());
+}
+
+bool is_rsp_adjust(const Inst& inst) {
+  return (inst.op == Opcode::Add || inst.op == Opcode::Sub) &&
+         inst.dst == Operand::r64(rsp) && inst.src.is_imm();
+}
+
+// 32-bit values are always kept zero-extended, so moving a register onto
+// itself changes nothing at either width
+bool self_move(Match& m) {
+  const Inst& mov = m.insts[0];
+  return mov.op == Opcode::Mov && mov.dst.is_reg() && mov.dst == mov.src;
+}
+
+// mov a, b; mov b, a
+bool move_back(Match& m) {
+  const Inst& first = m.insts[0];
+  const Inst& second = m.insts[1];
+  if (!is_mov(first) || !is_mov(second)) return false;
+  if (first.dst != second.src || first.src != second.dst) return false;
+  m.out.push_back(first);
+  return true;
+}
+
+bool dead_move(Match& m) {
+  const Inst& inst = m.insts[0];
+  if (inst.op != Opcode::Mov && inst.op != Opcode::Movzx &&
+      inst.op != Opcode::Lea)
+    return false;
+  if (!inst.dst.is_reg() || inst.dst.size < 4) return false;
+  return !m.live_after(bit(inst.dst.reg));
+}
+
+bool zero_idiom(Match& m) {
+  const Inst& mov = m.insts[0];
+  if (mov.op != Opcode::Mov || !mov.dst.is_reg() || !mov.src.is_imm() ||
+      mov.src.imm != 0 || m.live_after(kFlags))
+    return false;
+  m.out.push_back({.op = Opcode::Xor,
+                   .dst = Operand::r32(mov.dst.reg),
+                   .src = Operand::r32(mov.dst.reg)});
+  return true;
+}
+
+// setcc r8; movzx r32, r8; test r32, r32; jne target: branch on the
+// compare's flags, and keep the boolean only if something still reads it
+bool branch_on_compare(Match& m) {
+  const Inst& set = m.insts[0];
+  const Inst& zext = m.insts[1];
+  const Inst& test = m.insts[2];
+  const Inst& jump = m.insts[3];
+  if (set.op != Opcode::Setcc || zext.op != Opcode::Movzx ||
+      test.op != Opcode::Test || jump.op != Opcode::Jcc ||
+      jump.cc != Cond::NE)
+    return false;
+  const Reg reg = set.dst.reg;
+  if (zext.dst != Operand::r32(reg) || zext.src != Operand::r8(reg) ||
+      test.dst != zext.dst || test.src != zext.dst || m.live_after(kFlags))
+    return false;
+
+  if (m.live_after(bit(reg))) {
+    m.out.push_back(set);
+    m.out.push_back(zext);
+  }
+  m.out.push_back({.op = Opcode::Jcc, .cc = set.cc, .dst = jump.dst});
+  return true;
+}
+
+// jcc a; jmp b; a:
+bool branch_over_jump(Match& m) {
+  const Inst& jcc = m.insts[0];
+  const Inst& jmp = m.insts[1];
+  const Inst& label = m.insts[2];
+  if (jcc.op != Opcode::Jcc || jmp.op != Opcode::Jmp ||
+      label.op != Opcode::Label || jcc.dst.label != label.dst.label)
+    return false;
+  m.out.push_back({.op = Opcode::Jcc, .cc = invert(jcc.cc), .dst = jmp.dst});
+  m.out.push_back(label);
+  return true;
+}
+
+bool jump_to_next(Match& m) {
+  const Inst& jump = m.insts[0];
+  const Inst& label = m.insts[1];
+  if ((jump.op != Opcode::Jmp && jump.op != Opcode::Jcc) ||
+      label.op != Opcode::Label || jump.dst.label != label.dst.label)
+    return false;
+  m.out.push_back(label);
+  return true;
+}
+
+// mov d, a; shl d, k; add d, a: a multiply by 3, 5 or 9
+bool scaled_add(Match& m) {
+  const Inst& mov = m.insts[0];
+  const Inst& shl = m.insts[1];
+  const Inst& add = m.insts[2];
+  if (mov.op != Opcode::Mov || !mov.dst.is_reg() || !mov.src.is_reg() ||
+      mov.dst.reg == mov.src.reg || shl.op != Opcode::Shl ||
+      shl.dst != mov.dst || shl.src.imm < 1 || shl.src.imm > 3 ||
+      add.op != Opcode::Add || add.dst != mov.dst || add.src != mov.src ||
+      m.live_after(kFlags))
+    return false;
+  const Reg a = mov.src.reg;
+  m.out.push_back(
+      {.op = Opcode::Lea,
+       .dst = mov.dst,
+       .src = Operand::mem(a, a, 0, static_cast<uint8_t>(1 << shl.src.imm))});
+  return true;
+}
+
+bool merge_rsp_adjust(Match& m) {
+  const Inst& first = m.insts[0];
+  const Inst& second = m.insts[1];
+  if (!is_rsp_adjust(first) || !is_rsp_adjust(second) ||
+      m.live_after(kFlags))
+    return false;
+  int64_t amount = 0;
+  amount += first.op == Opcode::Add ? first.src.imm : -first.src.imm;
+  amount += second.op == Opcode::Add ? second.src.imm : -second.src.imm;
+  if (amount != 0)
+    m.out.push_back({.op = amount > 0 ? Opcode::Add : Opcode::Sub,
+                     .dst = Operand::r64(rsp),
+                     .src = Operand::immediate(amount > 0 ? amount : -amount)});
+  return true;
+}
+
+// tried in order at every instruction; a match that produces nothing
+// deletes its window
+constexpr Pattern kPatterns[] = {
+    {"self move", 1, self_move},
+    {"move back", 2, move_back},
+    {"dead move", 1, dead_move},
+    {"zero idiom", 1, zero_idiom},
+    {"branch on compare", 4, branch_on_compare},
+    {"branch over jump", 3, branch_over_jump},
+    {"jump to next", 2, jump_to_next},
+    {"scaled add", 3, scaled_add},
+    {"merge rsp adjust", 2, merge_rsp_adjust},
+};
+
+constexpr int kMaxRounds = 8;
+// jumps followed through at most this many jumps, so a loop of jumps ends
+constexpr int kMaxHops = 8;
+
+// a jump to a jmp goes straight to where that jmp goes, and code after an
+// unconditional jump that no jump reaches any more is dropped; returns the
+// number of changes
+size_t thread_jumps(std::vector<Inst>& insts, std::vector<Inst>& scratch,
+                    std::vector<uint32_t>& position,
+                    std::vector<uint32_t>& refs) {
+  constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+  const uint32_t count = static_cast<uint32_t>(insts.size());
+  for (uint32_t i = 0; i < count; ++i)
+    if (insts[i].op == Opcode::Label) position[insts[i].dst.label] = i;
+
+  // the jmp a label leads to, past any other labels
+  auto jump_at = [&](uint32_t label) -> const Inst* {
+    uint32_t i = position[label];
+    if (i == kNone) return nullptr;
+    while (i < count && insts[i].op == Opcode::Label) ++i;
+    return i < count && insts[i].op == Opcode::Jmp ? &insts[i] : nullptr;
+  };
+
+  size_t changes = 0;
+  for (Inst& inst : insts) {
+    if (inst.op != Opcode::Jmp && inst.op != Opcode::Jcc) continue;
+    uint32_t target = inst.dst.label;
+    for (int hop = 0; hop < kMaxHops; ++hop) {
+      const Inst* next = jump_at(target);
+      if (!next || next->dst.label == target) break;
+      target = next->dst.label;
+    }
+    if (target == inst.dst.label) continue;
+    LOG_DEBUG("[PEEPHOLE] thread jump");
+    inst.dst.label = target;
+    ++changes;
+  }
+
+  // labels jumped to or addressed, the definitions themselves aside
+  auto for_each_ref = [&](auto&& visit) {
+    for (const Inst& inst : insts) {
+      if (inst.op == Opcode::Label) continue;
+      if (inst.dst.kind == Operand::Kind::Label || inst.dst.rip)
+        visit(refs[inst.dst.label]);
+      if (inst.src.rip) visit(refs[inst.src.label]);
+    }
+  };
+  for_each_ref([](uint32_t& ref) { ++ref; });
+
+  scratch.clear();
+  bool reachable = true;
+  for (const Inst& inst : insts) {
+    if (inst.op == Opcode::Label) {
+      position[inst.dst.label] = kNone;
+      if (refs[inst.dst.label] > 0) reachable = true;
+    }
+    if (reachable) {
+      scratch.push_back(inst);
+    } else {
+      LOG_DEBUG("[PEEPHOLE] unreachable");
+      ++changes;
+    }
+    if (inst.op == Opcode::Jmp || inst.op == Opcode::Ret) reachable = false;
+  }
+  for_each_ref([](uint32_t& ref) { ref = 0; });
+  insts.swap(scratch);
+  return changes;
+}
+
+// rewrites until nothing matches; returns the number of rewrites
+size_t optimize(std::vector<Inst>& insts, std::vector<Inst>& scratch,
+                Liveness& liveness, std::vector<uint32_t>& position,
+                std::vector<uint32_t>& refs) {
+  size_t rewrites = 0;
+  for (int round = 0; round < kMaxRounds; ++round) {
+    size_t matched = thread_jumps(insts, scratch, position, refs);
+    liveness.compute(insts, position);
+    scratch.clear();
+
+    for (size_t i = 0; i < insts.size();) {
+      bool rewritten = false;
+      for (const Pattern& pattern : kPatterns) {
+        if (i + pattern.length > insts.size()) continue;
+        Match match{
+            std::span<const Inst>(insts).subspan(i, pattern.length),
+            std::span<const RegSet>(liveness.live_out)
+                .subspan(i, pattern.length),
+            scratch};
+        size_t mark = scratch.size();
+        if (pattern.rewrite(match)) {
+          LOG_DEBUG("[PEEPHOLE] {}", pattern.name);
+          i += pattern.length;
+          rewritten = true;
+          break;
+        }
+        scratch.resize(mark);
+      }
+      if (rewritten) {
+        ++matched;
+      } else {
+        scratch.push_back(insts[i++]);
+      }
+    }
+
+    insts.swap(scratch);
+    rewrites += matched;
+    if (matched == 0) break;
+  }
+  return rewrites;
+}
+
+}  // namespace
+
+void peephole(Program& program) {
+  std::vector<Inst> text;
+  text.reserve(program.text.size());
+  std::vector<Inst> function;
+  std::vector<Inst> scratch;
+  std::vector<uint32_t> position(program.labels.size(),
+                                 std::numeric_limits<uint32_t>::max());
+  std::vector<uint32_t> refs(program.labels.size(), 0);
+  Liveness liveness;
+
+  auto is_symbol = [&](const Inst& inst) {
+    return inst.op == Opcode::Label &&
+           program.labels[inst.dst.label].kind == Label::Kind::Symbol;
+  };
+
+  size_t rewrites = 0;
+  for (size_t begin = 0; begin < program.text.size();) {
+    size_t end = begin + 1;
+    while (end < program.text.size() && !is_symbol(program.text[end])) ++end;
+
+    function.assign(program.text.begin() + begin, program.text.begin() + end);
+    rewrites += optimize(function, scratch, liveness, position, refs);
+    text.insert(text.end(), function.begin(), function.end());
+    begin = end;
+  }
+
+  LOG_DEBUG("[PEEPHOLE] {} rewrites, {} -> {} instructions", rewrites,
+            program.text.size(), text.size());
+  program.text = std::move(text);
+}
+
+}  // namespace x86
@@ -0,0 +1,219 @@
+#include "query.hh"
+
+#include <algorithm>
+
+#include "diagnostics.hh"
+#include "log.hh"
+#include "visitor/nameresolver.hh"
+#include "visitor/symbolcollector.hh"
+#include "visitor/typechecker.hh"
+
+template <typename Compute>
+bool QueryEngine::run(QueryKey key, Compute&& compute) {
+  QueryState& state = cache[key];
+
+  // whoever asked depends on this result, cached or not
+  if (!active.empty()) {
+    const QueryKey& requester = active.back();
+    if (std::find(state.dependents.begin(), state.dependents.end(),
+                  requester) == state.dependents.end())
+      state.dependents.push_back(requester);
+  }
+
+  if (state.status == Status::Done) return state.ok;
+  if (state.status == Status::Running) {
+    Diagnostics::instance().report_error("Cyclic dependency between queries");
+    ++errors;
+    return false;
+  }
+
+  state.status = Status::Running;
+  active.push_back(key);
+  ++executed;
+  bool ok = compute();
+  active.pop_back();
+
+  // compute may have inserted into the cache, but node references into an
+  // unordered_map stay valid across rehashing
+  state.status = Status::Done;
+  state.ok = ok;
+  return ok;
+}
+
+void QueryEngine::index(ProgramNode& root) {
+  program = &root;
+  decls_by_name.clear();
+  top_level.clear();
+
+  for (auto& stmt : root.children) {
+    if (auto* method = dynamic_cast<MethodDeclNode*>(stmt.get()))
+      decls_by_name[method->identifier.getNameId()].push_back(method);
+    else
+      top_level.push_back(stmt.get());
+  }
+}
+
+bool QueryEngine::globals() {
+  return run({QueryKind::Globals, program}, [&] {
+    SymbolCollector collector(ctx);
+    ctx.push_scope();
+    for (StmtNode* stmt : top_level) collector.collect(*stmt);
+    ctx.pop_scope();
+
+    global_symbols.clear();
+    for (StmtNode* stmt : top_level) {
+      auto* expr_stmt = dynamic_cast<ExprStmtNode*>(stmt);
+      if (!expr_stmt) continue;
+      if (auto* var = dynamic_cast<VarDeclNode*>(expr_stmt->expr.get()))
+        if (var->semantic.data.variable.symbol)
+          global_symbols.push_back(var->semantic.data.variable.symbol);
+    }
+
+    NameResolver resolver(ctx);
+    TypeChecker checker(ctx, this);
+    if (!collector.has_errors()) {
+      ctx.push_scope();
+      for (StmtNode* stmt : top_level) resolver.resolve(*stmt);
+      ctx.pop_scope();
+      if (!resolver.has_errors())
+        for (StmtNode* stmt : top_level) checker.check(*stmt);
+    }
+
+    size_t failed = collector.error_count() + resolver.error_count() +
+                    checker.error_count();
+    errors += failed;
+    return failed == 0;
+  });
+}
+
+FunctionSymbol* QueryEngine::signature(MethodDeclNode& method) {
+  FunctionSymbol* result = nullptr;
+
+  bool ok = run({QueryKind::Signature, &method}, [&] {
+    SymbolCollector collector(ctx);
+    result = collector.collectSignature(method);
+    if (result) decl_of[result] = &method;
+
+    errors += collector.error_count();
+    return result && !collector.has_errors();
+  });
+
+  if (!ok) return nullptr;
+  return static_cast<FunctionSymbol*>(method.semantic.data.variable.symbol);
+}
+
+bool QueryEngine::body(MethodDeclNode& method) {
+  return run({QueryKind::Body, &method}, [&] {
+    // the globals are bound into the body's scope
+    if (!globals() || !signature(method)) return false;
+
+    ctx.push_scope();
+    bind_globals();
+
+    SymbolCollector collector(ctx);
+    collector.collectBody(method);
+
+    NameResolver resolver(ctx);
+    TypeChecker checker(ctx, this);
+    if (!collector.has_errors()) {
+      resolver.resolve(method);
+      if (!resolver.has_errors()) checker.check(method);
+    }
+    ctx.pop_scope();
+
+    size_t failed = collector.error_count() + resolver.error_count() +
+                    checker.error_count();
+    errors += failed;
+    return failed == 0;
+  });
+}
+
+const ClassLayout* QueryEngine::layout(ClassNode& cls) {
+  bool ok = run({QueryKind::ClassLayout, &cls}, [&] {
+    ClassLayout& result = layouts[&cls];
+    result = {};
+
+    for (auto& member : cls.members) {
+      auto* field = dynamic_cast<FieldDeclNode*>(member.get());
+      if (!field || field->is_static || !field->declared_type) continue;
+
+      size_t size = std::max<size_t>(field->declared_type->size_in_bytes(), 1);
+      size_t align = std::min<size_t>(size, 8);
+      result.size = (result.size + align - 1) & ~(align - 1);
+      result.fields.push_back(
+          {field->identifier.getNameId(), field->declared_type, result.size});
+      result.size += size;
+      result.align = std::max(result.align, align);
+    }
+    result.size = (result.size + result.align - 1) & ~(result.align - 1);
+    return true;
+  });
+
+  return ok ? &layouts[&cls] : nullptr;
+}
+
+void QueryEngine::demand_overloads(NameId owner, NameId name) {
+  // only free functions are indexed until classes are lowered
+  if (owner != kEmptyName) return;
+
+  auto it = decls_by_name.find(name);
+  if (it == decls_by_name.end()) return;
+  for (MethodDeclNode* method : it->second) signature(*method);
+}
+
+void QueryEngine::note_call(const FunctionSymbol* callee) {
+  MethodDeclNode* method = declaration(callee);
+  if (!method) return;
+
+  // bodies are checked from the worklist rather than nested, so recursion
+  // never has a query wait on itself
+  if (std::find(order.begin(), order.end(), method) != order.end()) return;
+  order.push_back(method);
+  worklist.push_back(method);
+}
+
+bool QueryEngine::check_reachable(MethodDeclNode& entry) {
+  if (std::find(order.begin(), order.end(), &entry) == order.end()) {
+    order.push_back(&entry);
+    worklist.push_back(&entry);
+  }
+
+  bool ok = true;
+  while (!worklist.empty()) {
+    MethodDeclNode* method = worklist.back();
+    worklist.pop_back();
+    LOG_DEBUG("Checking body of {}", method->identifier.getValue());
+    ok &= body(*method);
+  }
+  return ok;
+}
+
+void QueryEngine::invalidate(QueryKind kind, const ASTNode* node) {
+  auto it = cache.find({kind, node});
+  if (it == cache.end()) return;
+
+  std::vector<QueryKey> dependents = std::move(it->second.dependents);
+  cache.erase(it);
+
+  if (kind == QueryKind::Signature) {
+    auto* fn = static_cast<const FunctionSymbol*>(
+        node->semantic.data.variable.symbol);
+    ctx.method_table.remove_method(fn);
+    decl_of.erase(fn);
+  } else if (kind == QueryKind::ClassLayout) {
+    layouts.erase(static_cast<const ClassNode*>(node));
+  } else if (kind == QueryKind::Body) {
+    // the function stays reachable, the next check_reachable checks it again
+    auto it = std::find(order.begin(), order.end(), node);
+    if (it != order.end() &&
+        std::find(worklist.begin(), worklist.end(), *it) == worklist.end())
+      worklist.push_back(*it);
+  }
+
+  for (const QueryKey& dependent : dependents)
+    invalidate(dependent.kind, dependent.node);
+}
+
+void QueryEngine::bind_globals() {
+  for (Symbol* symbol : global_symbols) ctx.bind(symbol);
+}
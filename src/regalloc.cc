@@ -0,0 +1,612 @@
+#include "regalloc.hh"
+
+#include <algorithm>
+#include <deque>
+#include <queue>
+
+#include "ir/cfg.hh"
+#include "log.hh"
+
+namespace {
+
+constexpr uint32_t kMaxPosition = UINT32_MAX;
+
+struct Range {
+  uint32_t from;
+  uint32_t to;  // exclusive
+};
+
+struct Interval {
+  ir::Reg vreg = ir::kNoReg;  // kNoReg for the fixed interval of a register
+  std::vector<Range> ranges;  // sorted and disjoint
+  std::vector<uint32_t> uses;
+  int reg = -1;
+  bool spilled = false;
+
+  // preferred register: a fixed one (arguments), or wherever hint_vreg is
+  // at hint_position (the source of a copy or two-address operation)
+  int fixed_hint = -1;
+  ir::Reg hint_vreg = ir::kNoReg;
+  uint32_t hint_position = 0;
+
+  bool fixed() const { return vreg == ir::kNoReg; }
+  uint32_t start() const { return ranges.front().from; }
+  uint32_t end() const { return ranges.back().to; }
+
+  bool covers(uint32_t pos) const {
+    for (const Range& range : ranges) {
+      if (pos < range.from) return false;
+      if (pos < range.to) return true;
+    }
+    return false;
+  }
+
+  uint32_t next_intersection(const Interval& other) const {
+    size_t i = 0, j = 0;
+    while (i < ranges.size() && j < other.ranges.size()) {
+      const Range& a = ranges[i];
+      const Range& b = other.ranges[j];
+      uint32_t from = std::max(a.from, b.from);
+      if (from < std::min(a.to, b.to)) return from;
+      if (a.to < b.to)
+        ++i;
+      else
+        ++j;
+    }
+    return kMaxPosition;
+  }
+
+  uint32_t next_use(uint32_t pos) const {
+    auto it = std::lower_bound(uses.begin(), uses.end(), pos);
+    return it == uses.end() ? kMaxPosition : *it;
+  }
+
+  // ranges are collected backwards, from the end of the function
+  void prepend_range(uint32_t from, uint32_t to) {
+    if (!ranges.empty() && to >= ranges.back().from) {
+      ranges.back().from = std::min(ranges.back().from, from);
+      ranges.back().to = std::max(ranges.back().to, to);
+      return;
+    }
+    ranges.push_back({from, to});
+  }
+};
+
+struct StartsLater {
+  bool operator()(const Interval* a, const Interval* b) const {
+    if (a->start() != b->start()) return a->start() > b->start();
+    return a->vreg > b->vreg;
+  }
+};
+
+class LinearScan {
+ public:
+  explicit LinearScan(const ir::Function& fn)
+      : fn(fn), cfg(fn), dom(fn, cfg), loops(fn, cfg, dom) {}
+
+  Allocation run();
+
+ private:
+  const ir::Function& fn;
+  ir::CFG cfg;
+  ir::DominatorTree dom;
+  ir::LoopInfo loops;
+
+  std::vector<uint32_t> block_from;  // first position of each block
+  std::vector<uint32_t> block_to;
+  // registers live into each block, sorted
+  std::vector<std::vector<ir::Reg>> live_in;
+
+  std::deque<Interval> intervals;
+  std::vector<std::vector<Interval*>> pieces_of;  // per virtual register
+  bool callee_saved_used[x86::kRegCount] = {};
+  Interval fixed[x86::kRegCount];
+
+  std::priority_queue<Interval*, std::vector<Interval*>, StartsLater>
+      unhandled;
+  std::vector<Interval*> active;
+  std::vector<Interval*> inactive;
+
+  std::vector<uint32_t> slot_of;
+  uint32_t slot_count = 0;
+
+  void number_instructions(Allocation& result);
+  void compute_liveness();
+  void build_intervals();
+  void scan();
+
+  int hint_register(const Interval* interval) const;
+  void assign(Interval* interval, x86::Reg reg);
+  bool try_allocate_free(Interval* current);
+  void allocate_blocked(Interval* current);
+  void spill(Interval* interval);
+  void spill_until_next_use(Interval* interval, uint32_t after);
+  Interval* split(Interval* interval, uint32_t pos);
+  uint32_t split_position(uint32_t min_pos, uint32_t max_pos) const;
+  ir::BlockId block_at(uint32_t pos) const;
+
+  void resolve(Allocation& result);
+};
+
+Allocation LinearScan::run() {
+  Allocation result;
+  number_instructions(result);
+  compute_liveness();
+  build_intervals();
+  scan();
+  resolve(result);
+  return result;
+}
+
+void LinearScan::number_instructions(Allocation& result) {
+  uint32_t next = 0;
+  for (const ir::Block& block : fn.blocks) {
+    result.block_start.push_back(next);
+    block_from.push_back(4 * next);
+    next += static_cast<uint32_t>(block.insts.size());
+    block_to.push_back(4 * next);
+  }
+  result.moves_before.resize(next);
+  result.block_entry.resize(fn.blocks.size());
+  result.block_exit.resize(fn.blocks.size());
+}
+
+// Each register is followed backwards from the blocks reading it before
+// any definition, through predecessors that do not define it, so the work
+// is proportional to how far registers are live rather than to blocks
+// times registers.
+void LinearScan::compute_liveness() {
+  const size_t reg_count = fn.reg_types.size();
+  const size_t block_count = fn.blocks.size();
+
+  // per register: blocks reading it before defining it, and defining it
+  std::vector<std::vector<ir::BlockId>> exposed(reg_count);
+  std::vector<std::vector<ir::BlockId>> defined(reg_count);
+  std::vector<ir::BlockId> defined_in(reg_count, ir::kNoBlock);
+  std::vector<ir::BlockId> exposed_in(reg_count, ir::kNoBlock);
+  for (ir::BlockId block = 0; block < block_count; ++block) {
+    for (const ir::Inst& inst : fn.blocks[block].insts) {
+      ir::for_each_use(fn, inst, [&](ir::Reg reg) {
+        if (defined_in[reg] == block || exposed_in[reg] == block) return;
+        exposed_in[reg] = block;
+        exposed[reg].push_back(block);
+      });
+      for (ir::Reg dst : {inst.dst, inst.dst2}) {
+        if (dst == ir::kNoReg || defined_in[dst] == block) continue;
+        defined_in[dst] = block;
+        defined[dst].push_back(block);
+      }
+    }
+  }
+
+  // marks are the register being followed, so they never need clearing
+  live_in.assign(block_count, {});
+  std::vector<ir::Reg> kills(block_count, ir::kNoReg);
+  std::vector<ir::Reg> visited(block_count, ir::kNoReg);
+  std::vector<ir::BlockId> stack;
+  for (ir::Reg reg = 0; reg < reg_count; ++reg) {
+    for (ir::BlockId block : defined[reg]) kills[block] = reg;
+    for (ir::BlockId block : exposed[reg]) {
+      visited[block] = reg;
+      live_in[block].push_back(reg);
+      stack.push_back(block);
+    }
+    while (!stack.empty()) {
+      ir::BlockId block = stack.back();
+      stack.pop_back();
+      for (ir::BlockId pred : cfg.preds[block]) {
+        if (kills[pred] == reg || visited[pred] == reg) continue;
+        visited[pred] = reg;
+        live_in[pred].push_back(reg);
+        stack.push_back(pred);
+      }
+    }
+  }
+}
+
+void LinearScan::build_intervals() {
+  const size_t reg_count = fn.reg_types.size();
+  intervals.resize(reg_count);
+  pieces_of.resize(reg_count);
+  for (ir::Reg reg = 0; reg < reg_count; ++reg) {
+    intervals[reg].vreg = reg;
+    pieces_of[reg].push_back(&intervals[reg]);
+  }
+
+  for (ir::BlockId block = fn.blocks.size(); block-- > 0;) {
+    // live out of the block, the same range again merges away
+    const uint32_t from = block_from[block];
+    for (ir::BlockId succ : cfg.succs[block])
+      for (ir::Reg reg : live_in[succ])
+        intervals[reg].prepend_range(from, block_to[block]);
+
+    const auto& insts = fn.blocks[block].insts;
+    for (size_t i = insts.size(); i-- > 0;) {
+      const ir::Inst& inst = insts[i];
+      const uint32_t index = from / 4 + static_cast<uint32_t>(i);
+      const uint32_t def = 4 * index + 2;
+
+      for (ir::Reg dst : {inst.dst, inst.dst2}) {
+        if (dst == ir::kNoReg) continue;
+        Interval& interval = intervals[dst];
+        if (interval.ranges.empty() || interval.ranges.back().from > def)
+          interval.prepend_range(def, def + 1);  // never read
+        else
+          interval.ranges.back().from = def;
+      }
+
+      // sharing a register with the first operand saves a move
+      if (inst.dst != ir::kNoReg && inst.a != ir::kNoReg &&
+          (inst.op == ir::Op::Copy || inst.op == ir::Op::Neg ||
+           inst.op == ir::Op::Add || inst.op == ir::Op::Sub ||
+           inst.op == ir::Op::Mul || inst.op == ir::Op::Shl ||
+           inst.op == ir::Op::Sar || inst.op == ir::Op::Shr ||
+           inst.op == ir::Op::Sext || inst.op == ir::Op::Trunc)) {
+        intervals[inst.dst].hint_vreg = inst.a;
+        intervals[inst.dst].hint_position = 4 * index;
+      }
+      if (inst.op == ir::Op::Call) {
+        auto args = fn.args(inst);
+        for (size_t arg = 0; arg < args.size() && arg < 6; ++arg)
+          if (x86::kArgumentRegs[arg] != x86::rdx)
+            intervals[args[arg]].fixed_hint = x86::kArgumentRegs[arg];
+      }
+      if (inst.op == ir::Op::Print) intervals[inst.a].fixed_hint = x86::rsi;
+
+      // the callee (or the kernel) may overwrite every caller-saved register
+      if (Allocation::clobbers(inst.op)) {
+        for (x86::Reg reg : kAllocatableRegs) {
+          if (x86::is_callee_saved(reg)) continue;
+          if (inst.op == ir::Op::Print && reg != x86::rcx &&
+              reg != x86::rsi && reg != x86::rdi)
+            continue;
+          fixed[reg].prepend_range(4 * index + 1, 4 * index + 2);
+        }
+      }
+
+      ir::for_each_use(fn, inst, [&](ir::Reg reg) {
+        intervals[reg].prepend_range(from, 4 * index + 1);
+        intervals[reg].uses.push_back(4 * index);
+      });
+    }
+  }
+
+  for (Interval& interval : intervals) {
+    std::reverse(interval.ranges.begin(), interval.ranges.end());
+    std::reverse(interval.uses.begin(), interval.uses.end());
+    interval.uses.erase(std::unique(interval.uses.begin(), interval.uses.end()),
+                        interval.uses.end());
+  }
+  for (ir::Reg param = 0; param < fn.params.size() && param < 6; ++param)
+    if (x86::kArgumentRegs[param] != x86::rdx)
+      intervals[param].fixed_hint = x86::kArgumentRegs[param];
+
+  for (x86::Reg reg : kAllocatableRegs) {
+    Interval& interval = fixed[reg];
+    std::reverse(interval.ranges.begin(), interval.ranges.end());
+    interval.reg = reg;
+  }
+}
+
+void LinearScan::scan() {
+  for (Interval& interval : intervals)
+    if (!interval.ranges.empty()) unhandled.push(&interval);
+  for (x86::Reg reg : kAllocatableRegs)
+    if (!fixed[reg].ranges.empty()) inactive.push_back(&fixed[reg]);
+  slot_of.assign(fn.reg_types.size(), UINT32_MAX);
+
+  while (!unhandled.empty()) {
+    Interval* current = unhandled.top();
+    unhandled.pop();
+    const uint32_t position = current->start();
+
+    std::vector<Interval*> still_active;
+    for (Interval* interval : active) {
+      if (interval->end() <= position) continue;
+      if (interval->covers(position))
+        still_active.push_back(interval);
+      else
+        inactive.push_back(interval);
+    }
+    active = std::move(still_active);
+
+    std::vector<Interval*> still_inactive;
+    for (Interval* interval : inactive) {
+      if (interval->end() <= position) continue;
+      if (interval->covers(position))
+        active.push_back(interval);
+      else
+        still_inactive.push_back(interval);
+    }
+    inactive = std::move(still_inactive);
+
+    if (!try_allocate_free(current)) allocate_blocked(current);
+    if (current->reg >= 0) active.push_back(current);
+  }
+}
+
+bool LinearScan::try_allocate_free(Interval* current) {
+  uint32_t free_until[x86::kRegCount] = {};
+  for (x86::Reg reg : kAllocatableRegs) free_until[reg] = kMaxPosition;
+
+  for (Interval* interval : active) free_until[interval->reg] = 0;
+  for (Interval* interval : inactive) {
+    uint32_t pos = interval->next_intersection(*current);
+    if (pos < free_until[interval->reg]) free_until[interval->reg] = pos;
+  }
+
+  // among registers free for the whole interval take the hint, else one
+  // that costs nothing to use: caller-saved registers, when the interval
+  // crosses no call, or callee-saved ones that are saved anyway
+  const uint32_t end = current->end();
+  const int hint = hint_register(current);
+  int best = hint >= 0 && free_until[hint] >= end ? hint : -1;
+  for (int pass = 0; pass < 3 && best < 0; ++pass) {
+    for (x86::Reg reg : kAllocatableRegs) {
+      if (free_until[reg] < end) continue;
+      if (pass == 0 && x86::is_callee_saved(reg)) continue;
+      if (pass == 1 && !callee_saved_used[reg]) continue;
+      best = reg;
+      break;
+    }
+  }
+  if (best < 0) {
+    best = hint >= 0 ? hint : kAllocatableRegs[0];
+    for (x86::Reg reg : kAllocatableRegs)
+      if (free_until[reg] > free_until[best]) best = reg;
+  }
+
+  if (free_until[best] <= current->start()) return false;
+  if (free_until[best] < current->end()) {
+    // the register is taken later on, keep it until then
+    uint32_t pos = split_position(current->start(), free_until[best]);
+    if (pos <= current->start()) return false;
+    unhandled.push(split(current, pos));
+  }
+  assign(current, static_cast<x86::Reg>(best));
+  return true;
+}
+
+int LinearScan::hint_register(const Interval* interval) const {
+  if (interval->fixed_hint >= 0) return interval->fixed_hint;
+  if (interval->hint_vreg == ir::kNoReg) return -1;
+  for (const Interval* piece : pieces_of[interval->hint_vreg])
+    if (piece->reg >= 0 && piece->covers(interval->hint_position))
+      return piece->reg;
+  return -1;
+}
+
+void LinearScan::assign(Interval* interval, x86::Reg reg) {
+  interval->reg = reg;
+  if (x86::is_callee_saved(reg)) callee_saved_used[reg] = true;
+}
+
+void LinearScan::allocate_blocked(Interval* current) {
+  uint32_t use_pos[x86::kRegCount] = {};
+  uint32_t block_pos[x86::kRegCount] = {};
+  for (x86::Reg reg : kAllocatableRegs) {
+    use_pos[reg] = kMaxPosition;
+    block_pos[reg] = kMaxPosition;
+  }
+
+  const uint32_t start = current->start();
+  for (Interval* interval : active) {
+    int reg = interval->reg;
+    if (interval->fixed()) {
+      use_pos[reg] = block_pos[reg] = 0;
+      continue;
+    }
+    use_pos[reg] = std::min(use_pos[reg], interval->next_use(start));
+  }
+  for (Interval* interval : inactive) {
+    uint32_t pos = interval->next_intersection(*current);
+    if (pos == kMaxPosition) continue;
+    int reg = interval->reg;
+    if (interval->fixed()) {
+      block_pos[reg] = std::min(block_pos[reg], pos);
+      use_pos[reg] = std::min(use_pos[reg], pos);
+      continue;
+    }
+    use_pos[reg] = std::min(use_pos[reg], interval->next_use(start));
+  }
+
+  x86::Reg best = kAllocatableRegs[0];
+  for (x86::Reg reg : kAllocatableRegs)
+    if (use_pos[reg] > use_pos[best]) best = reg;
+
+  // everyone else needs a register sooner, current waits on the stack
+  const uint32_t first_use = current->next_use(start);
+  if (first_use > use_pos[best] || use_pos[best] <= start) {
+    spill_until_next_use(current, start);
+    return;
+  }
+
+  if (block_pos[best] < current->end()) {
+    uint32_t pos = split_position(start, block_pos[best]);
+    if (pos <= start) {
+      spill_until_next_use(current, start);
+      return;
+    }
+    unhandled.push(split(current, pos));
+  }
+  assign(current, best);
+
+  // evict whatever else holds the register while current does
+  std::vector<Interval*> kept;
+  for (Interval* interval : active) {
+    if (interval->fixed() || interval->reg != best) {
+      kept.push_back(interval);
+      continue;
+    }
+    uint32_t pos = start & ~3u;
+    if (pos > interval->start()) interval = split(interval, pos);
+    interval->reg = -1;
+    spill_until_next_use(interval, start);
+  }
+  active = std::move(kept);
+
+  kept.clear();
+  for (Interval* interval : inactive) {
+    uint32_t pos = interval->fixed() || interval->reg != best
+                       ? kMaxPosition
+                       : interval->next_intersection(*current);
+    if (pos == kMaxPosition) {
+      kept.push_back(interval);
+      continue;
+    }
+    // the part after the hole gets allocated again
+    unhandled.push(split(interval, split_position(start, pos)));
+    kept.push_back(interval);
+  }
+  inactive = std::move(kept);
+}
+
+void LinearScan::spill(Interval* interval) {
+  interval->spilled = true;
+  uint32_t& slot = slot_of[interval->vreg];
+  if (slot == UINT32_MAX) slot = slot_count++;
+}
+
+void LinearScan::spill_until_next_use(Interval* interval, uint32_t after) {
+  spill(interval);
+  uint32_t use = interval->next_use(after);
+  if (use == kMaxPosition) return;
+
+  uint32_t from = std::max(interval->start(), after);
+  uint32_t pos = split_position(from, use);
+  if (pos > from) unhandled.push(split(interval, pos));
+}
+
+Interval* LinearScan::split(Interval* interval, uint32_t pos) {
+  Interval& child = intervals.emplace_back();
+  child.vreg = interval->vreg;
+  child.fixed_hint = interval->fixed_hint;
+  pieces_of[child.vreg].push_back(&child);
+
+  auto& ranges = interval->ranges;
+  size_t i = 0;
+  while (i < ranges.size() && ranges[i].to <= pos) ++i;
+  if (i < ranges.size() && ranges[i].from < pos) {
+    child.ranges.push_back({pos, ranges[i].to});
+    ranges[i].to = pos;
+    ++i;
+  }
+  child.ranges.insert(child.ranges.end(), ranges.begin() + i, ranges.end());
+  ranges.erase(ranges.begin() + i, ranges.end());
+
+  auto& uses = interval->uses;
+  auto first = std::lower_bound(uses.begin(), uses.end(), pos);
+  child.uses.assign(first, uses.end());
+  uses.erase(first, uses.end());
+
+  if (child.ranges.empty() || ranges.empty())
+    LOG_FATAL("[REGALLOC] Bad split of %{} at {}", interval->vreg, pos);
+  return &child;
+}
+
+ir::BlockId LinearScan::block_at(uint32_t pos) const {
+  auto it = std::upper_bound(block_from.begin(), block_from.end(), pos);
+  return static_cast<ir::BlockId>(it - block_from.begin() - 1);
+}
+
+// latest position in (min_pos, max_pos] between two instructions; a block
+// boundary in a shallower loop is preferred so that the moves land there
+uint32_t LinearScan::split_position(uint32_t min_pos, uint32_t max_pos) const {
+  max_pos &= ~3u;
+  if (max_pos <= min_pos) return min_pos;
+
+  ir::BlockId min_block = block_at(min_pos);
+  ir::BlockId max_block = block_at(max_pos);
+  if (min_block == max_block) return max_pos;
+
+  uint32_t best = max_pos;
+  uint32_t best_depth = loops.depth(max_block);
+  for (ir::BlockId block = max_block; block > min_block; --block) {
+    if (loops.depth(block) < best_depth) {
+      best_depth = loops.depth(block);
+      best = block_from[block];
+    }
+  }
+  return best;
+}
+
+void LinearScan::resolve(Allocation& result) {
+  result.pieces.resize(fn.reg_types.size());
+  for (Interval& interval : intervals) {
+    if (interval.ranges.empty()) continue;
+    if (interval.reg < 0 && !interval.spilled)
+      LOG_FATAL("[REGALLOC] %{} in {} was never allocated", interval.vreg,
+                fn.name);
+    Location location =
+        interval.reg >= 0
+            ? Location::in(static_cast<x86::Reg>(interval.reg))
+            : Location::stack(slot_of[interval.vreg]);
+    result.pieces[interval.vreg].push_back(
+        {interval.start(), interval.end(), location});
+
+    if (interval.reg >= 0 && x86::is_callee_saved(location.reg) &&
+        std::find(result.callee_saved.begin(), result.callee_saved.end(),
+                  location.reg) == result.callee_saved.end())
+      result.callee_saved.push_back(location.reg);
+  }
+  std::sort(result.callee_saved.begin(), result.callee_saved.end());
+  result.spill_slots = slot_count;
+
+  // moves inside a block where an interval was split
+  for (ir::Reg reg = 0; reg < fn.reg_types.size(); ++reg) {
+    auto& pieces = result.pieces[reg];
+    std::sort(pieces.begin(), pieces.end(),
+              [](const auto& a, const auto& b) { return a.from < b.from; });
+    const bool wide = ir::is_wide(fn.reg_types[reg]);
+
+    for (size_t i = 1; i < pieces.size(); ++i) {
+      const auto& before = pieces[i - 1];
+      const auto& after = pieces[i];
+      if (before.to != after.from || before.location == after.location)
+        continue;
+      if (std::binary_search(block_from.begin(), block_from.end(), after.from))
+        continue;
+      result.moves_before[after.from / 4].push_back(
+          {before.location, after.location, wide});
+    }
+  }
+
+  // moves on control flow edges where both ends disagree
+  for (ir::BlockId block : cfg.rpo) {
+    for (size_t i = 0; i < cfg.succs[block].size(); ++i) {
+      ir::BlockId succ = cfg.succs[block][i];
+      if (i > 0 && succ == cfg.succs[block][0]) continue;
+
+      std::vector<Move> moves;
+      for (ir::Reg reg : live_in[succ]) {
+        Location from = result.at(reg, block_to[block] - 1);
+        Location to = result.at(reg, block_from[succ]);
+        if (from != to)
+          moves.push_back({from, to, ir::is_wide(fn.reg_types[reg])});
+      }
+      if (moves.empty()) continue;
+
+      if (cfg.preds[succ].size() == 1)
+        result.block_entry[succ] = std::move(moves);
+      else if (cfg.succs[block].size() == 1)
+        result.block_exit[block] = std::move(moves);
+      else
+        result.stubs.push_back({block, succ, std::move(moves)});
+    }
+  }
+}
+
+}  // namespace
+
+Location Allocation::at(ir::Reg reg, uint32_t position) const {
+  const auto& list = pieces[reg];
+  auto it = std::upper_bound(
+      list.begin(), list.end(), position,
+      [](uint32_t pos, const Piece& piece) { return pos < piece.from; });
+  if (it == list.begin()) return {};
+  return std::prev(it)->location;
+}
+
+Allocation allocate_registers(const ir::Function& fn) {
+  return LinearScan(fn).run();
+}
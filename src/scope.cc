@@ -1,90 +1,53 @@
 #include "scope.hh"
 
 #include <iostream>
-#include <memory>
 
-Symbol* Scope::declare(const std::string& name, const Type* type,
-                       SourceLocation loc) {
-  if (symbols.find(name) != symbols.end()) {
-    return nullptr;
-  }
-
-  auto symbol = std::make_unique<Symbol>();
-  symbol->name = name;
-  symbol->type = type;
-  symbol->location = loc;
-
-  Symbol* raw = symbol.get();
-  symbols[name] = std::move(symbol);
-  return raw;
-}
+void ScopeTable::exit_scope() {
+  if (marks.empty()) return;
 
-VariableSymbol* Scope::declare(const std::string& name, const Type* type,
-                               bool is_mutable, SourceLocation loc) {
-  if (symbols.find(name) != symbols.end()) return nullptr;
-
-  auto var = std::make_unique<VariableSymbol>();
-  var->name = name;
-  var->type = type;
-  var->location = loc;
-  var->is_mutable = is_mutable;
-
-  VariableSymbol* ptr = var.get();
-  symbols[name] = std::move(var);
-  return ptr;
-}
+  uint32_t mark = marks.back();
+  marks.pop_back();
 
-FunctionSymbol* Scope::declare(const std::string& name, const Type* return_type,
-                               const std::vector<const Type*> param_types,
-                               SourceLocation loc) {
-  if (symbols.find(name) != symbols.end()) {
-    return nullptr;
+  while (undo_log.size() > mark) {
+    const Shadowed& entry = undo_log.back();
+    bindings[entry.name] = entry.previous;
+    undo_log.pop_back();
   }
-
-  auto func = std::make_unique<FunctionSymbol>();
-  func->name = name;
-  func->type = return_type;
-  func->param_types = param_types;
-  func->location = loc;
-
-  FunctionSymbol* ptr = func.get();
-  symbols[name] = std::move(func);
-  return ptr;
 }
 
-Symbol* Scope::lookup(const std::string& name, bool walkParent) {
-  Scope* scope = this;
-  if (!walkParent) {
-    auto it = scope->symbols.find(name);
-    return (it != symbols.end()) ? it->second.get() : nullptr;
-  }
+bool ScopeTable::bind(NameId name, Symbol* symbol) {
+  if (name == kInvalidName || !symbol) return false;
+  if (name >= bindings.size()) bindings.resize(name + 1);
 
-  while (scope != nullptr) {
-    auto it = scope->symbols.find(name);
-    if (it != scope->symbols.end()) return it->second.get();
-    scope = scope->parent;
-  }
+  uint32_t current = static_cast<uint32_t>(marks.size());
+  Binding& slot = bindings[name];
+  if (slot.symbol && slot.depth == current) return false;
 
-  return nullptr;
+  undo_log.push_back({name, slot});
+  slot.symbol = symbol;
+  slot.depth = current;
+  return true;
 }
 
-Symbol* Scope::lookup(const std::string& name, Scope* startingScope,
-                      bool walkParent) {
-  Scope* scope = startingScope;
-  while (scope) {
-    Symbol* sym = scope->lookup(name, walkParent);
-    if (sym) return sym;
-
-    if (walkParent) scope = scope->get_parent();
-  }
+Symbol* ScopeTable::lookup_local(NameId name) const {
+  if (name >= bindings.size()) return nullptr;
+  const Binding& slot = bindings[name];
+  return slot.depth == marks.size() ? slot.symbol : nullptr;
+}
 
-  return nullptr;
+void ScopeTable::clear() {
+  bindings.clear();
+  undo_log.clear();
+  marks.clear();
 }
 
-void Scope::dump() const {
-  std::cout << "Scope contents:\n";
-  for (const auto& [name, symbol] : symbols) {
-    std::cout << "   " << name << " : "
-              << (symbol->type ? symbol->type->to_string() : "unknown") << "\n";
+void ScopeTable::dump(const NameInterner& names) const {
+  std::cout << "Scope contents (depth " << marks.size() << "):\n";
+  for (NameId id = 0; id < bindings.size(); ++id) {
+    const Symbol* symbol = bindings[id].symbol;
+    if (!symbol) continue;
+    std::cout << "   " << names.name(id) << " : "
+              << (symbol->type ? symbol->type->to_string() : "unknown")
+              << " @" << bindings[id].depth << "\n";
   }
 }
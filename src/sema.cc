@@ -3,51 +3,49 @@
 #include "ast.hh"
 #include "log.hh"
 #include "methodtable.hh"
-#include "visitor/nameresolver.hh"
-#include "visitor/symbolcollector.hh"
-#include "visitor/typechecker.hh"
 
 ProgramNode* Sema::analyze(ProgramNode& root) {
-  // pass 1: symbol table and scopes
-  LOG_DEBUG("Collecting symbols");
-  SymbolCollector symbol_collector(ctx);
-  symbol_collector.collect(root);
-  if (symbol_collector.has_errors()) {
-    LOG_ERROR("Symbol collector has failed with {} errors",
-              symbol_collector.error_count());
+  LOG_DEBUG("Indexing declarations");
+  queries.index(root);
+
+  LOG_DEBUG("Checking globals");
+  if (!queries.globals()) {
+    LOG_ERROR("Semantic analysis has failed with {} errors",
+              queries.error_count());
     return nullptr;
   }
 
-  {
-    const std::vector<const Type*> no_params;
-    const Symbol* main_method =
-        ctx.method_table.find_overload("", "main", no_params);
-
-    if (!main_method || !main_method->type ||
-        main_method->type != ctx.get_int32_type()) {
-      LOG_ERROR("Missing required entry point: int main()");
-      return nullptr;
-    }
+  // field offsets are fixed before any body can refer to them
+  for (auto& stmt : root.children) {
+    auto* cls = dynamic_cast<ClassNode*>(stmt.get());
+    if (!cls) continue;
+    const ClassLayout* layout = queries.layout(*cls);
+    LOG_DEBUG("Class {} has {} fields in {} bytes",
+              cls->identifier.getValue(), layout->fields.size(), layout->size);
   }
 
-  LOG_DEBUG("Resolving names");
-  NameResolver name_resolver(ctx);
-  name_resolver.resolve(root);
-  if (name_resolver.has_errors()) {
-    LOG_ERROR("Name resolver has failed with {} errors",
-              name_resolver.error_count());
+  NameId main_name = ctx.intern("main");
+  queries.demand_overloads(kEmptyName, main_name);
+
+  const std::vector<const Type*> no_params;
+  const FunctionSymbol* main_method =
+      ctx.method_table.find_overload(kEmptyName, main_name, no_params);
+
+  if (!main_method || !main_method->type ||
+      main_method->type != ctx.get_int32_type()) {
+    LOG_ERROR("Missing required entry point: int main()");
     return nullptr;
   }
 
-  LOG_DEBUG("Type/decl checking");
-  TypeChecker type_checker(ctx);
-  type_checker.check(root);
-
-  if (type_checker.has_errors()) {
-    LOG_ERROR("Type checker has failed with {} errors",
-              type_checker.error_count());
+  // only what main can reach is checked; everything else is never demanded
+  LOG_DEBUG("Checking functions reachable from main");
+  if (!queries.check_reachable(*queries.declaration(main_method))) {
+    LOG_ERROR("Semantic analysis has failed with {} errors",
+              queries.error_count());
     return nullptr;
   }
 
+  LOG_DEBUG("Ran {} queries for {} reachable functions",
+            queries.executed_count(), queries.reachable().size());
   return &root;
 }
@@ -0,0 +1,471 @@
+#include "visitor/lowering.hh"
+
+#include <string>
+
+void Lowering::lower(const std::vector<MethodDeclNode*>& methods) {
+  // the builder refers into module.functions, so room for the string helper
+  // is reserved before any body is lowered
+  module.functions.reserve(module.functions.size() + methods.size() + 1);
+
+  // every function needs an id before any call to it is lowered
+  for (MethodDeclNode* method : methods) declareFunction(*method);
+  if (!methods.empty())
+    module.entry = functions.at(methods.front()->semantic.data.variable.symbol);
+
+  for (MethodDeclNode* method : methods) lowerMethodDecl(*method);
+}
+
+std::string Lowering::mangle(const FunctionSymbol& fn) {
+  std::string name = "jx_" + fn.name;
+  if (!fn.param_types.empty()) name += "_";
+
+  for (const Type* type : fn.param_types) {
+    std::string type_name = type->to_string();
+    if (type->is_pointer())
+      name += "s";
+    else if (type->is_array())
+      name += "a";
+    else
+      name += type_name.front();
+  }
+  return name;
+}
+
+void Lowering::declareFunction(MethodDeclNode& node) {
+  auto* symbol =
+      static_cast<const FunctionSymbol*>(node.semantic.data.variable.symbol);
+
+  ir::Function fn;
+  fn.name = mangle(*symbol);
+  for (const Type* param : symbol->param_types) append_types(param, fn.params);
+  append_types(symbol->type, fn.results);
+  for (ir::Ty ty : fn.params) fn.new_reg(ty);
+
+  functions[symbol] = static_cast<ir::FuncId>(module.functions.size());
+  module.functions.push_back(std::move(fn));
+}
+
+void Lowering::lowerMethodDecl(MethodDeclNode& node) {
+  current_function =
+      static_cast<const FunctionSymbol*>(node.semantic.data.variable.symbol);
+  ir::Function& fn = module.functions[functions.at(current_function)];
+
+  ir::Builder b(fn);
+  builder = &b;
+  b.set_block(fn.new_block());
+  locals.clear();
+
+  ir::Reg next_param = 0;
+  for (auto& param : node.param_list) {
+    Value value{next_param++};
+    if (is_string(param->declared_type)) value.len = next_param++;
+    locals[param->semantic.data.variable.symbol] = value;
+  }
+
+  if (node.body) lowerBlock(*node.body);
+
+  // falling off the end returns a zero value
+  if (!b.terminated()) {
+    Value ret = defaultValue(current_function->type);
+    b.ret(ret.reg, ret.len);
+  }
+
+  ir::remove_unreachable_blocks(fn);
+  builder = nullptr;
+  current_function = nullptr;
+}
+
+void Lowering::lowerStatement(StmtNode& stmt) {
+  // code after a return still gets lowered, into a block nothing reaches
+  if (builder->terminated()) {
+    report_warning("Unreachable code", stmt.location);
+    builder->set_block(builder->function().new_block());
+  }
+
+  if (auto* node = dynamic_cast<BlockNode*>(&stmt))
+    lowerBlock(*node);
+  else if (auto* node = dynamic_cast<IfStmtNode*>(&stmt))
+    lowerIfStmt(*node);
+  else if (auto* node = dynamic_cast<WhileStmtNode*>(&stmt))
+    lowerWhileStmt(*node);
+  else if (auto* node = dynamic_cast<ReturnStmtNode*>(&stmt))
+    lowerReturn(*node);
+  else if (auto* node = dynamic_cast<ExprStmtNode*>(&stmt))
+    lowerExprStmt(*node);
+  else
+    report_error("Cannot lower statement", stmt.location);
+}
+
+Lowering::Value Lowering::lowerExpression(ExprNode& expr) {
+  if (auto* node = dynamic_cast<BinaryExprNode*>(&expr))
+    return lowerBinaryExpr(*node);
+  if (auto* node = dynamic_cast<UnaryExprNode*>(&expr))
+    return lowerUnaryExpr(*node);
+  if (auto* node = dynamic_cast<LiteralExprNode*>(&expr))
+    return lowerLiteralExpr(*node);
+  if (auto* node = dynamic_cast<IdentifierExprNode*>(&expr))
+    return lowerIdentifierExpr(*node);
+  if (auto* node = dynamic_cast<AssignmentExprNode*>(&expr))
+    return lowerAssignmentExpr(*node);
+  if (auto* node = dynamic_cast<MethodCallNode*>(&expr))
+    return lowerMethodCall(*node);
+  if (auto* node = dynamic_cast<ArgumentNode*>(&expr))
+    return lowerExpression(*node->expr);
+  if (auto* node = dynamic_cast<VarDeclNode*>(&expr))
+    return lowerVarDecl(*node);
+
+  report_error("Cannot lower expression", expr.location);
+  return defaultValue(ctx.get_int32_type());
+}
+
+void Lowering::lowerBlock(BlockNode& node) {
+  for (auto& stmt : node.statements) lowerStatement(*stmt);
+}
+
+void Lowering::lowerIfStmt(IfStmtNode& node) {
+  ir::Function& fn = builder->function();
+  Value cond = lowerExpression(*node.condition);
+
+  ir::BlockId then_block = fn.new_block();
+  ir::BlockId else_block = node.else_stmt ? fn.new_block() : ir::kNoBlock;
+  ir::BlockId join = fn.new_block();
+  builder->cond_br(cond.reg, then_block,
+                   node.else_stmt ? else_block : join);
+
+  // without an else the false edge already reaches the join
+  bool joined = !node.else_stmt;
+  builder->set_block(then_block);
+  if (node.statement) lowerStatement(*node.statement);
+  if (!builder->terminated()) {
+    builder->br(join);
+    joined = true;
+  }
+
+  if (node.else_stmt) {
+    builder->set_block(else_block);
+    lowerStatement(*node.else_stmt);
+    if (!builder->terminated()) {
+      builder->br(join);
+      joined = true;
+    }
+  }
+
+  // when both branches return, what follows is unreachable and the builder
+  // stays in the terminated block so the next statement notices
+  if (joined) builder->set_block(join);
+}
+
+// Rotated into a guarded do-while: the condition is checked once before
+// the loop and again at the bottom of the body, so every iteration costs a
+// single conditional branch back to the top.
+void Lowering::lowerWhileStmt(WhileStmtNode& node) {
+  ir::Function& fn = builder->function();
+  Value guard = lowerExpression(*node.condition);
+  ir::BlockId entry = builder->block();
+
+  ir::BlockId body = fn.new_block();
+  builder->set_block(body);
+  if (node.statement) lowerStatement(*node.statement);
+  ir::BlockId latch = ir::kNoBlock;
+  Value cond;
+  if (!builder->terminated()) {
+    cond = lowerExpression(*node.condition);
+    latch = builder->block();
+  }
+
+  // created last so the exit is laid out after the whole loop
+  ir::BlockId exit = fn.new_block();
+  if (latch != ir::kNoBlock) {
+    builder->set_block(latch);
+    builder->cond_br(cond.reg, body, exit);
+  }
+  builder->set_block(entry);
+  builder->cond_br(guard.reg, body, exit);
+  builder->set_block(exit);
+}
+
+void Lowering::lowerReturn(ReturnStmtNode& node) {
+  if (!node.ret) {
+    builder->ret();
+    return;
+  }
+
+  Value value = lowerExpression(*node.ret);
+  if (!current_function->type || current_function->type->is_void()) {
+    builder->ret();
+    return;
+  }
+
+  value = convert(value, node.ret->semantic.declared_type,
+                  current_function->type);
+  builder->ret(value.reg, value.len);
+}
+
+void Lowering::lowerExprStmt(ExprStmtNode& node) {
+  if (!node.expr) return;
+  Value value = lowerExpression(*node.expr);
+
+  // a string on its own is printed; declarations and assignments only store
+  bool stores = dynamic_cast<VarDeclNode*>(node.expr.get()) ||
+                dynamic_cast<AssignmentExprNode*>(node.expr.get());
+  if (!stores && is_string(node.expr->semantic.declared_type))
+    builder->print(value.reg, value.len);
+}
+
+Lowering::Value Lowering::lowerVarDecl(VarDeclNode& node) {
+  const Symbol* symbol = node.semantic.data.variable.symbol;
+
+  if (node.declared_type->is_array()) {
+    // no element access exists yet, so an array never needs storage
+    locals[symbol] = {};
+    if (node.initializer)
+      report_error("Array initializers are not supported by code generation",
+                   node.location);
+    return {};
+  }
+
+  // a rotated loop lowers its condition twice, and the second declaration
+  // has to assign the variable the first one made
+  auto lowered = locals.find(symbol);
+  Value var = lowered != locals.end() ? lowered->second
+                                      : newVariable(node.declared_type);
+  Value init = node.initializer
+                   ? convert(lowerExpression(*node.initializer),
+                             node.initializer->semantic.declared_type,
+                             node.declared_type)
+                   : defaultValue(node.declared_type);
+  assign(var, init);
+  // bound after the initializer, the declaration is not visible inside it
+  locals[symbol] = var;
+  return init;
+}
+
+Lowering::Value Lowering::lowerBinaryExpr(BinaryExprNode& node) {
+  Value left = lowerExpression(*node.left);
+  Value right = lowerExpression(*node.right);
+  TokenType op = node.op.getType();
+
+  if (is_string(node.left->semantic.declared_type) &&
+      (op == TokenType::TOKEN_DEQ || op == TokenType::TOKEN_NEQ)) {
+    const ir::Reg args[] = {left.reg, left.len, right.reg, right.len};
+    const ir::Ty results[] = {ir::Ty::I1};
+    ir::Reg equal = builder->call(stringEquals(), args, results).dst;
+    if (op == TokenType::TOKEN_DEQ) return {equal};
+
+    ir::Reg zero = builder->constant(ir::Ty::I1, 0);
+    return {builder->binary(ir::Op::Eq, ir::Ty::I1, equal, zero)};
+  }
+
+  switch (op) {
+    case TokenType::TOKEN_PLUS:
+      return {builder->binary(ir::Op::Add, ir::Ty::I32, left.reg, right.reg)};
+    case TokenType::TOKEN_MINUS:
+      return {builder->binary(ir::Op::Sub, ir::Ty::I32, left.reg, right.reg)};
+    case TokenType::TOKEN_MULTIPLY:
+      return {builder->binary(ir::Op::Mul, ir::Ty::I32, left.reg, right.reg)};
+    case TokenType::TOKEN_DIVIDE:
+      return {builder->binary(ir::Op::Div, ir::Ty::I32, left.reg, right.reg)};
+    case TokenType::TOKEN_DEQ:
+      return {builder->binary(ir::Op::Eq, ir::Ty::I1, left.reg, right.reg)};
+    case TokenType::TOKEN_NEQ:
+      return {builder->binary(ir::Op::Ne, ir::Ty::I1, left.reg, right.reg)};
+    case TokenType::TOKEN_LT:
+      return {builder->binary(ir::Op::Lt, ir::Ty::I1, left.reg, right.reg)};
+    case TokenType::TOKEN_LEQ:
+      return {builder->binary(ir::Op::Le, ir::Ty::I1, left.reg, right.reg)};
+    case TokenType::TOKEN_GT:
+      return {builder->binary(ir::Op::Gt, ir::Ty::I1, left.reg, right.reg)};
+    case TokenType::TOKEN_GEQ:
+      return {builder->binary(ir::Op::Ge, ir::Ty::I1, left.reg, right.reg)};
+    default:
+      report_error("Cannot lower operator '" + node.op.getValue() + "'",
+                   node.location);
+      return defaultValue(ctx.get_int32_type());
+  }
+}
+
+Lowering::Value Lowering::lowerUnaryExpr(UnaryExprNode& node) {
+  Value operand = lowerExpression(*node.operand);
+
+  if (node.op.getType() != TokenType::TOKEN_MINUS) {
+    report_error("Cannot lower unary operator '" + node.op.getValue() + "'",
+                 node.location);
+    return operand;
+  }
+  return {builder->unary(ir::Op::Neg, ir::Ty::I32, operand.reg)};
+}
+
+Lowering::Value Lowering::lowerLiteralExpr(LiteralExprNode& node) {
+  const Token& token = node.literal_token;
+
+  switch (token.getType()) {
+    case TokenType::TOKEN_STRING: {
+      const std::string contents = token.getValue();
+      uint32_t id = module.intern_string(contents);
+      return {builder->string_address(id),
+              builder->constant(ir::Ty::I64,
+                                static_cast<int64_t>(contents.size()))};
+    }
+    case TokenType::TOKEN_CHAR:
+      // the lexer stores character literals as their decimal code
+      return {builder->constant(ir::Ty::I8, std::stoll(token.getValue()))};
+    default:
+      break;
+  }
+
+  const std::string value = token.getValue();
+  if (value == "true") return {builder->constant(ir::Ty::I32, 1)};
+  if (value == "false") return {builder->constant(ir::Ty::I32, 0)};
+  return {builder->constant(ir::Ty::I32, std::stoll(value))};
+}
+
+Lowering::Value Lowering::lowerIdentifierExpr(IdentifierExprNode& node) {
+  auto it = locals.find(node.semantic.data.variable.symbol);
+  if (it == locals.end()) {
+    report_error("Global variable '" + node.identifier.getValue() +
+                     "' is not supported by code generation",
+                 node.location);
+    return defaultValue(node.semantic.declared_type);
+  }
+  if (it->second.reg == ir::kNoReg) {
+    report_error("Arrays are not supported by code generation",
+                 node.location);
+    return defaultValue(ctx.get_int32_type());
+  }
+
+  // read into a temporary, a later assignment in the same expression must
+  // not change a value that was already read
+  ir::Function& fn = builder->function();
+  Value value{builder->copy(fn.reg_types[it->second.reg], it->second.reg)};
+  if (it->second.len != ir::kNoReg)
+    value.len = builder->copy(ir::Ty::I64, it->second.len);
+  return value;
+}
+
+Lowering::Value Lowering::lowerAssignmentExpr(AssignmentExprNode& node) {
+  Value value = convert(lowerExpression(*node.right),
+                        node.right->semantic.declared_type,
+                        node.left->semantic.declared_type);
+
+  auto it = locals.find(node.semantic.data.variable.symbol);
+  if (it == locals.end() || it->second.reg == ir::kNoReg) {
+    report_error("Cannot lower assignment target", node.location);
+    return value;
+  }
+
+  assign(it->second, value);
+  return value;
+}
+
+Lowering::Value Lowering::lowerMethodCall(MethodCallNode& node) {
+  auto* callee =
+      static_cast<const FunctionSymbol*>(node.semantic.data.call.callee);
+  auto it = functions.find(callee);
+  if (it == functions.end()) {
+    report_error("Call to '" + node.identifier.getValue() +
+                     "' has no lowered callee",
+                 node.location);
+    return defaultValue(node.semantic.declared_type);
+  }
+
+  std::vector<ir::Reg> args;
+  for (size_t i = 0; i < node.arg_list.size(); ++i) {
+    ArgumentNode& arg = *node.arg_list[i];
+    Value value =
+        convert(lowerExpression(*arg.expr), arg.expr->semantic.declared_type,
+                callee->param_types[i]);
+    args.push_back(value.reg);
+    if (value.len != ir::kNoReg) args.push_back(value.len);
+  }
+
+  const std::vector<ir::Ty> results = module.functions[it->second].results;
+  ir::Inst& call = builder->call(it->second, args, results);
+  return {call.dst, call.dst2};
+}
+
+Lowering::Value Lowering::defaultValue(const Type* type) {
+  if (!type || type->is_void()) return {};
+  if (is_string(type)) {
+    return {builder->constant(ir::Ty::Ptr, 0),
+            builder->constant(ir::Ty::I64, 0)};
+  }
+  return {builder->constant(scalar_ty(type), 0)};
+}
+
+Lowering::Value Lowering::convert(Value value, const Type* from,
+                                  const Type* to) {
+  // int is accepted where a bool is expected; normalize it to 0 or 1
+  if (to == ctx.get_bool_type() && from != ctx.get_bool_type() &&
+      value.reg != ir::kNoReg) {
+    ir::Function& fn = builder->function();
+    ir::Reg zero = builder->constant(fn.reg_types[value.reg], 0);
+    return {builder->binary(ir::Op::Ne, ir::Ty::I1, value.reg, zero)};
+  }
+  return value;
+}
+
+Lowering::Value Lowering::newVariable(const Type* type) {
+  ir::Function& fn = builder->function();
+  Value var{fn.new_reg(scalar_ty(type))};
+  if (is_string(type)) var.len = fn.new_reg(ir::Ty::I64);
+  return var;
+}
+
+void Lowering::assign(const Value& target, const Value& value) {
+  if (value.reg != ir::kNoReg) builder->copy_to(target.reg, value.reg);
+  if (target.len != ir::kNoReg && value.len != ir::kNoReg)
+    builder->copy_to(target.len, value.len);
+}
+
+// string equality is an ordinary IR function so every backend and pass sees
+// it; it is only added to the module when a comparison needs it
+ir::FuncId Lowering::stringEquals() {
+  if (streq != UINT32_MAX) return streq;
+
+  ir::Function fn;
+  fn.name = "jx_streq";
+  fn.params = {ir::Ty::Ptr, ir::Ty::I64, ir::Ty::Ptr, ir::Ty::I64};
+  fn.results = {ir::Ty::I1};
+  for (ir::Ty ty : fn.params) fn.new_reg(ty);
+  const ir::Reg a = 0, a_len = 1, b = 2, b_len = 3;
+
+  // the byte loop is a guarded do-while, like a lowered while statement
+  ir::Builder build(fn);
+  ir::BlockId entry = fn.new_block();
+  ir::BlockId guard = fn.new_block();
+  ir::BlockId body = fn.new_block();
+  ir::BlockId next = fn.new_block();
+  ir::BlockId equal = fn.new_block();
+  ir::BlockId differ = fn.new_block();
+
+  build.set_block(entry);
+  ir::Reg i = build.constant(ir::Ty::I64, 0);
+  ir::Reg len_differs = build.binary(ir::Op::Ne, ir::Ty::I1, a_len, b_len);
+  build.cond_br(len_differs, differ, guard);
+
+  build.set_block(guard);
+  ir::Reg has_bytes = build.binary(ir::Op::Lt, ir::Ty::I1, i, a_len);
+  build.cond_br(has_bytes, body, equal);
+
+  build.set_block(body);
+  ir::Reg x = build.load_byte(a, i);
+  ir::Reg y = build.load_byte(b, i);
+  ir::Reg byte_differs = build.binary(ir::Op::Ne, ir::Ty::I1, x, y);
+  build.cond_br(byte_differs, differ, next);
+
+  build.set_block(next);
+  ir::Reg one = build.constant(ir::Ty::I64, 1);
+  build.copy_to(i, build.binary(ir::Op::Add, ir::Ty::I64, i, one));
+  ir::Reg more = build.binary(ir::Op::Lt, ir::Ty::I1, i, a_len);
+  build.cond_br(more, body, equal);
+
+  build.set_block(equal);
+  build.ret(build.constant(ir::Ty::I1, 1));
+
+  build.set_block(differ);
+  build.ret(build.constant(ir::Ty::I1, 0));
+
+  streq = static_cast<ir::FuncId>(module.functions.size());
+  module.functions.push_back(std::move(fn));
+  return streq;
+}
@@ -31,24 +31,37 @@ void NameResolver::resolveExpression(ExprNode& expr) {
     resolveAssignmentExpr(*node);
   if (auto* node = dynamic_cast<MethodCallNode*>(&expr))
     resolveMethodCall(*node);
+  if (auto* node = dynamic_cast<VarDeclNode*>(&expr)) resolveVarDecl(*node);
   // if (auto* node = dynamic_cast<ArgumentNode*>(&expr))
   // resolveArgument(*node);
 }
 
+// the collector already created every symbol; here the scopes are replayed in
+// source order so a name is only visible after its declaration
 void NameResolver::resolveProgram(ProgramNode& node) {
-  ctx.set_current_scope(node.semantic.scope);
+  ctx.push_scope();
   for (auto& stmt : node.children) resolveStatement(*stmt);
-  ctx.set_current_scope(node.semantic.scope->get_parent());
+  ctx.pop_scope();
 }
 
 void NameResolver::resolveBlock(BlockNode& node) {
-  ctx.set_current_scope(node.semantic.scope);
+  ctx.push_scope();
   for (auto& stmt : node.statements) resolveStatement(*stmt);
-  ctx.set_current_scope(node.semantic.scope->get_parent());
+  ctx.pop_scope();
 }
 
 void NameResolver::resolveVarDecl(VarDeclNode& node) {
   if (node.initializer) resolveExpression(*node.initializer);
+
+  bindVariable(node);
+}
+
+void NameResolver::bindVariable(ASTNode& node) {
+  auto* var =
+      dynamic_cast<VariableSymbol*>(node.semantic.data.variable.symbol);
+  if (!var) return;
+
+  ctx.bind(var);
 }
 
 void NameResolver::resolveIfStmt(IfStmtNode& node) {
@@ -71,7 +84,11 @@ void NameResolver::resolveExprStmt(ExprStmtNode& node) {
 }
 
 void NameResolver::resolveMethodDecl(MethodDeclNode& node) {
+  ctx.push_scope();
+  for (auto& param : node.param_list) bindVariable(*param);
+
   if (node.body) resolveStatement(*node.body);
+  ctx.pop_scope();
 }
 
 void NameResolver::resolveBinaryExpr(BinaryExprNode& node) {
@@ -84,7 +101,7 @@ void NameResolver::resolveUnaryExpr(UnaryExprNode& node) {
 }
 
 void NameResolver::resolveIdentifierExpr(IdentifierExprNode& node) {
-  Symbol* sym = ctx.lookup(node.identifier.getValue());
+  Symbol* sym = ctx.lookup(node.identifier.getNameId());
 
   if (!sym) {
     report_error(
@@ -93,12 +110,23 @@ void NameResolver::resolveIdentifierExpr(IdentifierExprNode& node) {
     return;
   }
 
-  node.semantic.data.variable.symbol = sym;
+  auto* var = dynamic_cast<VariableSymbol*>(sym);
+  if (!var) {
+    report_error("'" + node.identifier.getValue() + "' is not a variable",
+                 node.location);
+    return;
+  }
+
+  node.semantic.data.variable.symbol = var;
 }
 
 void NameResolver::resolveAssignmentExpr(AssignmentExprNode& node) {
   if (node.left) resolveExpression(*node.left);
   if (node.right) resolveExpression(*node.right);
+
+  if (auto* target = dynamic_cast<IdentifierExprNode*>(node.left.get()))
+    node.semantic.data.variable.symbol =
+        target->semantic.data.variable.symbol;
 }
 
 void NameResolver::resolveMethodCall(MethodCallNode& node) {
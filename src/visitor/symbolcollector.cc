@@ -15,7 +15,6 @@ void SymbolCollector::collectStatement(StmtNode& stmt) {
 
 void SymbolCollector::collectProgram(ProgramNode& node) {
   ctx.push_scope();
-  node.semantic.scope = ctx.get_current_scope();
 
   for (auto& stmt : node.children) collectStatement(*stmt);
   ctx.pop_scope();
@@ -23,7 +22,6 @@ void SymbolCollector::collectProgram(ProgramNode& node) {
 
 void SymbolCollector::collectBlock(BlockNode& node) {
   ctx.push_scope();
-  node.semantic.scope = ctx.get_current_scope();
 
   for (auto& stmt : node.statements) collectStatement(*stmt);
   ctx.pop_scope();
@@ -82,9 +80,14 @@ void SymbolCollector::collectBlock(BlockNode& node) {
 // }
 
 void SymbolCollector::collectMethodDecl(MethodDeclNode& node) {
+  if (!collectSignature(node)) return;
+  collectBody(node);
+}
+
+FunctionSymbol* SymbolCollector::collectSignature(MethodDeclNode& node) {
   if (!node.declared_type) {
     report_error("Missing return type in method declaration", node.location);
-    return;
+    return nullptr;
   }
 
   ctx.push_scope();
@@ -98,7 +101,8 @@ void SymbolCollector::collectMethodDecl(MethodDeclNode& node) {
     }
 
     Symbol* param_sym = ctx.declare(param->identifier.getValue(),
-                                    param->declared_type, param->location);
+                                    param->declared_type, true,
+                                    param->location);
 
     if (param_sym) {
       param->semantic.data.variable.symbol = param_sym;
@@ -121,6 +125,19 @@ void SymbolCollector::collectMethodDecl(MethodDeclNode& node) {
                  node.location);
   }
 
+  ctx.pop_scope();
+  return func_sym;
+}
+
+void SymbolCollector::collectBody(MethodDeclNode& node) {
+  // same visibility the signature had: the function and its parameters
+  ctx.push_scope();
+  if (Symbol* func_sym = node.semantic.data.variable.symbol)
+    ctx.bind(func_sym);
+  for (auto& param : node.param_list)
+    if (Symbol* param_sym = param->semantic.data.variable.symbol)
+      ctx.bind(param_sym);
+
   if (node.body) {
     collectBlock(*node.body);
   }
@@ -135,7 +152,7 @@ void SymbolCollector::collectParamNode(ParamNode& node) {
   }
 
   auto symbol = ctx.declare(node.identifier.getValue(), node.declared_type,
-                            node.location);
+                            true, node.location);
 
   if (!symbol) {
     report_error(
@@ -199,7 +216,7 @@ void SymbolCollector::collectVarDecl(VarDeclNode& node) {
     return;
   }
 
-  if (ctx.lookup(node.identifier.getValue(), true)) {
+  if (ctx.lookup(node.identifier.getNameId())) {
     report_error(
         "Redeclaration of variable '" + node.identifier.getValue() + "'",
         node.location);
@@ -207,6 +224,6 @@ void SymbolCollector::collectVarDecl(VarDeclNode& node) {
   }
 
   auto symbol = ctx.declare(node.identifier.getValue(), node.declared_type,
-                            node.location);
+                            true, node.location);
   node.semantic.data.variable.symbol = symbol;
 }
@@ -1,5 +1,7 @@
 #include "visitor/typechecker.hh"
 
+#include "query.hh"
+
 void TypeChecker::checkStatement(StmtNode& stmt) {
   if (auto* node = dynamic_cast<BlockNode*>(&stmt))
     checkBlock(*node);
@@ -42,15 +44,11 @@ const Type* TypeChecker::checkExpression(ExprNode& expr) {
 }
 
 void TypeChecker::checkProgram(ProgramNode& node) {
-  ctx.set_current_scope(node.semantic.scope);
   for (auto& child : node.children) checkStatement(*child);
-  ctx.set_current_scope(node.semantic.scope->get_parent());
 }
 
 void TypeChecker::checkBlock(BlockNode& node) {
-  ctx.set_current_scope(node.semantic.scope);
   for (auto& stmt : node.statements) checkStatement(*stmt);
-  ctx.set_current_scope(node.semantic.scope->get_parent());
 }
 
 const Type* TypeChecker::checkVarDecl(VarDeclNode& node) {
@@ -99,6 +97,8 @@ void TypeChecker::checkWhileStmt(WhileStmtNode& node) {
         node.condition->location);
     return;
   }
+
+  if (node.statement) checkStatement(*node.statement);
 }
 
 void TypeChecker::checkReturn(ReturnStmtNode& node) {
@@ -239,10 +239,11 @@ const Type* TypeChecker::checkMethodCall(MethodCallNode& node) {
   }
 
   // for now this will do, update when classes are done
-  std::string owner = "global";
+  if (queries)
+    queries->demand_overloads(kEmptyName, node.identifier.getNameId());
 
-  const FunctionSymbol* candidate =
-      ctx.method_table.find_overload("", node.identifier.getValue(), arg_types);
+  const FunctionSymbol* candidate = ctx.method_table.find_overload(
+      kEmptyName, node.identifier.getNameId(), arg_types);
 
   if (!candidate) {
     report_error("Cannot find candidate for method call with identifier '" +
@@ -252,6 +253,7 @@ const Type* TypeChecker::checkMethodCall(MethodCallNode& node) {
   }
 
   node.semantic.data.call.callee = const_cast<FunctionSymbol*>(candidate);
+  if (queries) queries->note_call(candidate);
   node.semantic.declared_type = candidate->type;
   return node.semantic.declared_type;
 }
@@ -0,0 +1,482 @@
+#include "vm/bytecode.hh"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include "log.hh"
+
+namespace vm {
+
+const char* op_name(Op op) {
+  switch (op) {
+#define X(name) \
+  case Op::name: \
+    return #name;
+    BYTECODE_OPS
+#undef X
+  }
+  return "?";
+}
+
+static Op arithmetic(ir::Op op, bool wide) {
+  switch (op) {
+    case ir::Op::Add:
+      return wide ? Op::Add64 : Op::Add32;
+    case ir::Op::Sub:
+      return wide ? Op::Sub64 : Op::Sub32;
+    case ir::Op::Mul:
+      return wide ? Op::Mul64 : Op::Mul32;
+    case ir::Op::Div:
+      return wide ? Op::Div64 : Op::Div32;
+    default:
+      return wide ? Op::Neg64 : Op::Neg32;
+  }
+}
+
+static Op shift(ir::Op op, bool wide) {
+  switch (op) {
+    case ir::Op::Shl:
+      return wide ? Op::Shl64 : Op::Shl32;
+    case ir::Op::Sar:
+      return wide ? Op::Sar64 : Op::Sar32;
+    default:
+      return wide ? Op::Shr64 : Op::Shr32;
+  }
+}
+
+static Op compare(ir::Op op) {
+  switch (op) {
+    case ir::Op::Eq:
+      return Op::Eq;
+    case ir::Op::Ne:
+      return Op::Ne;
+    case ir::Op::Lt:
+      return Op::Lt;
+    case ir::Op::Le:
+      return Op::Le;
+    case ir::Op::Gt:
+      return Op::Gt;
+    default:
+      return Op::Ge;
+  }
+}
+
+static Function compile_function(const ir::Function& fn) {
+  using ir::Op;
+
+  Function out;
+  out.name = fn.name;
+  out.params = static_cast<uint32_t>(fn.params.size());
+  out.results = static_cast<uint32_t>(fn.results.size());
+  out.registers = static_cast<uint32_t>(fn.reg_types.size());
+
+  // jump operands hold block ids until every block has its pc
+  std::vector<uint32_t> block_pc(fn.blocks.size());
+  for (ir::BlockId block = 0; block < fn.blocks.size(); ++block) {
+    block_pc[block] = static_cast<uint32_t>(out.code.size());
+    for (const ir::Inst& inst : fn.blocks[block].insts) {
+      const bool wide = ir::is_wide(inst.ty);
+      switch (inst.op) {
+        case Op::Nop:
+          break;
+        case Op::Const: {
+          int64_t value = wide ? inst.imm : static_cast<int32_t>(inst.imm);
+          out.code.push_back({vm::Op::Const, inst.dst,
+                              static_cast<uint32_t>(out.constants.size())});
+          out.constants.push_back(value);
+          break;
+        }
+        case Op::Copy:
+          out.code.push_back({vm::Op::Move, inst.dst, inst.a});
+          break;
+        case Op::Add:
+        case Op::Sub:
+        case Op::Mul:
+        case Op::Div:
+        case Op::Neg:
+          out.code.push_back(
+              {arithmetic(inst.op, wide), inst.dst, inst.a, inst.b});
+          break;
+        case Op::Shl:
+        case Op::Sar:
+        case Op::Shr:
+          out.code.push_back({shift(inst.op, wide), inst.dst, inst.a,
+                              static_cast<uint32_t>(inst.imm)});
+          break;
+        case Op::Sext:
+          out.code.push_back({vm::Op::Sext, inst.dst, inst.a});
+          break;
+        case Op::Trunc:
+          out.code.push_back({vm::Op::Trunc, inst.dst, inst.a});
+          break;
+        case Op::Eq:
+        case Op::Ne:
+        case Op::Lt:
+        case Op::Le:
+        case Op::Gt:
+        case Op::Ge:
+          out.code.push_back({compare(inst.op), inst.dst, inst.a, inst.b});
+          break;
+        case Op::Select:
+          // the destination is a register of its own out of SSA
+          out.code.push_back({vm::Op::Move, inst.dst, inst.b});
+          out.code.push_back({vm::Op::Select, inst.dst, inst.a, inst.c});
+          break;
+        case Op::LoadByte:
+          out.code.push_back({vm::Op::LoadByte, inst.dst, inst.a, inst.b});
+          break;
+        case Op::StrAddr:
+          out.code.push_back({vm::Op::String, inst.dst,
+                              static_cast<uint32_t>(inst.imm)});
+          break;
+        case Op::Call: {
+          auto args = fn.args(inst);
+          uint32_t call = static_cast<uint32_t>(out.calls.size());
+          out.calls.push_back(static_cast<uint32_t>(args.size()));
+          out.calls.push_back(inst.dst2);
+          out.calls.insert(out.calls.end(), args.begin(), args.end());
+          out.code.push_back({vm::Op::Call, inst.dst, inst.callee, call});
+          break;
+        }
+        case Op::Phi:
+          LOG_FATAL("[VM] Phi in {}, leave SSA before compiling bytecode",
+                    fn.name);
+          break;
+        case Op::Print:
+          out.code.push_back({vm::Op::Print, inst.a, inst.b});
+          break;
+        case Op::Br:
+          if (inst.target != block + 1)
+            out.code.push_back({vm::Op::Jump, inst.target});
+          break;
+        case Op::CondBr:
+          out.code.push_back(
+              {vm::Op::Branch, inst.a, inst.target, inst.other});
+          break;
+        case Op::Ret:
+          out.code.push_back({vm::Op::Ret, inst.a, inst.b});
+          break;
+      }
+    }
+  }
+
+  for (Instr& instr : out.code) {
+    if (instr.op == vm::Op::Jump) instr.a = block_pc[instr.a];
+    if (instr.op == vm::Op::Branch) {
+      instr.b = block_pc[instr.b];
+      instr.c = block_pc[instr.c];
+    }
+  }
+  return out;
+}
+
+Program compile(const ir::Module& module) {
+  Program program;
+  program.strings = module.strings;
+  program.entry = module.entry;
+  for (const ir::Function& fn : module.functions)
+    program.functions.push_back(compile_function(fn));
+  return program;
+}
+
+bool verify(const Program& program, std::vector<std::string>& errors) {
+  size_t initial = errors.size();
+
+  if (program.entry >= program.functions.size())
+    errors.push_back("entry function out of range");
+  else if (program.functions[program.entry].params != 0)
+    errors.push_back("entry function takes parameters");
+
+  for (const Function& fn : program.functions) {
+    auto fail = [&](size_t pc, const std::string& message) {
+      errors.push_back(fn.name + ": " + std::to_string(pc) + ": " + message);
+    };
+    auto is_reg = [&](uint32_t reg) { return reg < fn.registers; };
+    auto is_reg_or_none = [&](uint32_t reg) {
+      return reg == kNone || reg < fn.registers;
+    };
+    auto is_pc = [&](uint32_t pc) { return pc < fn.code.size(); };
+
+    if (fn.registers < fn.params)
+      errors.push_back(fn.name + ": parameters have no registers");
+    if (fn.code.empty()) {
+      errors.push_back(fn.name + ": function has no code");
+      continue;
+    }
+    Op last = fn.code.back().op;
+    if (last != Op::Jump && last != Op::Branch && last != Op::Ret)
+      errors.push_back(fn.name + ": code runs off the end");
+
+    for (size_t pc = 0; pc < fn.code.size(); ++pc) {
+      const Instr& instr = fn.code[pc];
+      bool ok = true;
+      switch (instr.op) {
+        case Op::Const:
+          ok = is_reg(instr.a) && instr.b < fn.constants.size();
+          break;
+        case Op::Move:
+        case Op::Neg32:
+        case Op::Neg64:
+        case Op::Sext:
+        case Op::Trunc:
+          ok = is_reg(instr.a) && is_reg(instr.b);
+          break;
+        case Op::Shl32:
+        case Op::Sar32:
+        case Op::Shr32:
+          ok = is_reg(instr.a) && is_reg(instr.b) && instr.c < 32;
+          break;
+        case Op::Shl64:
+        case Op::Sar64:
+        case Op::Shr64:
+          ok = is_reg(instr.a) && is_reg(instr.b) && instr.c < 64;
+          break;
+        case Op::Add32:
+        case Op::Add64:
+        case Op::Sub32:
+        case Op::Sub64:
+        case Op::Mul32:
+        case Op::Mul64:
+        case Op::Div32:
+        case Op::Div64:
+        case Op::Eq:
+        case Op::Ne:
+        case Op::Lt:
+        case Op::Le:
+        case Op::Gt:
+        case Op::Ge:
+        case Op::Select:
+        case Op::LoadByte:
+          ok = is_reg(instr.a) && is_reg(instr.b) && is_reg(instr.c);
+          break;
+        case Op::String:
+          ok = is_reg(instr.a) && instr.b < program.strings.size();
+          break;
+        case Op::Call: {
+          ok = is_reg_or_none(instr.a) &&
+               instr.b < program.functions.size() &&
+               instr.c < fn.calls.size() && fn.calls.size() - instr.c >= 2;
+          if (!ok) break;
+          uint32_t count = fn.calls[instr.c];
+          ok = fn.calls.size() - instr.c - 2 >= count &&
+               count == program.functions[instr.b].params &&
+               is_reg_or_none(fn.calls[instr.c + 1]);
+          for (uint32_t i = 0; ok && i < count; ++i)
+            ok = is_reg(fn.calls[instr.c + 2 + i]);
+          break;
+        }
+        case Op::Print:
+          ok = is_reg(instr.a) && is_reg(instr.b);
+          break;
+        case Op::Jump:
+          ok = is_pc(instr.a);
+          break;
+        case Op::Branch:
+          ok = is_reg(instr.a) && is_pc(instr.b) && is_pc(instr.c);
+          break;
+        case Op::Ret:
+          ok = is_reg_or_none(instr.a) && is_reg_or_none(instr.b);
+          break;
+        default:
+          ok = false;
+          break;
+      }
+      if (!ok) fail(pc, std::string("bad operands for ") + op_name(instr.op));
+    }
+  }
+  return errors.size() == initial;
+}
+
+namespace {
+
+constexpr char kMagic[4] = {'J', 'X', 'B', '3'};
+
+class Writer {
+ public:
+  void u32(uint32_t value) {
+    for (int i = 0; i < 4; ++i)
+      out.push_back(static_cast<char>(value >> 8 * i));
+  }
+  void i64(int64_t value) {
+    for (int i = 0; i < 8; ++i)
+      out.push_back(static_cast<char>(static_cast<uint64_t>(value) >> 8 * i));
+  }
+  void string(const std::string& value) {
+    u32(static_cast<uint32_t>(value.size()));
+    out += value;
+  }
+
+  std::string out;
+};
+
+class Reader {
+ public:
+  explicit Reader(const std::string& in) : in(in) {}
+
+  bool u32(uint32_t& value) {
+    if (in.size() - pos < 4) return false;
+    value = 0;
+    for (int i = 0; i < 4; ++i)
+      value |= uint32_t{static_cast<uint8_t>(in[pos++])} << 8 * i;
+    return true;
+  }
+  bool i64(int64_t& value) {
+    if (in.size() - pos < 8) return false;
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; ++i)
+      bits |= uint64_t{static_cast<uint8_t>(in[pos++])} << 8 * i;
+    value = static_cast<int64_t>(bits);
+    return true;
+  }
+  bool string(std::string& value) {
+    uint32_t size = 0;
+    if (!u32(size) || in.size() - pos < size) return false;
+    value.assign(in, pos, size);
+    pos += size;
+    return true;
+  }
+  // a count of items that take at least item_size bytes each
+  bool count(uint32_t& value, size_t item_size) {
+    return u32(value) && value <= (in.size() - pos) / item_size;
+  }
+  bool magic() {
+    if (in.size() < sizeof(kMagic) ||
+        std::memcmp(in.data(), kMagic, sizeof(kMagic)) != 0)
+      return false;
+    pos = sizeof(kMagic);
+    return true;
+  }
+  bool done() const { return pos == in.size(); }
+
+ private:
+  const std::string& in;
+  size_t pos = 0;
+};
+
+}  // namespace
+
+bool write(const Program& program, const std::string& path) {
+  Writer w;
+  w.out.append(kMagic, sizeof(kMagic));
+  w.u32(static_cast<uint32_t>(program.strings.size()));
+  for (const std::string& s : program.strings) w.string(s);
+  w.u32(static_cast<uint32_t>(program.functions.size()));
+  for (const Function& fn : program.functions) {
+    w.string(fn.name);
+    w.u32(fn.params);
+    w.u32(fn.results);
+    w.u32(fn.registers);
+    w.u32(static_cast<uint32_t>(fn.constants.size()));
+    for (int64_t constant : fn.constants) w.i64(constant);
+    w.u32(static_cast<uint32_t>(fn.calls.size()));
+    for (uint32_t word : fn.calls) w.u32(word);
+    w.u32(static_cast<uint32_t>(fn.code.size()));
+    for (const Instr& instr : fn.code) {
+      w.u32(static_cast<uint32_t>(instr.op));
+      w.u32(instr.a);
+      w.u32(instr.b);
+      w.u32(instr.c);
+    }
+  }
+  w.u32(program.entry);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) return false;
+  file.write(w.out.data(), static_cast<std::streamsize>(w.out.size()));
+  return static_cast<bool>(file);
+}
+
+bool read(const std::string& path, Program& program, std::string& error) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    error = "cannot open " + path;
+    return false;
+  }
+  std::string bytes((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+
+  Reader r(bytes);
+  if (!r.magic()) {
+    error = path + " is not a bytecode file";
+    return false;
+  }
+  auto truncated = [&] {
+    error = path + " is truncated";
+    return false;
+  };
+
+  program = {};
+  uint32_t count = 0;
+  if (!r.count(count, 4)) return truncated();
+  program.strings.resize(count);
+  for (std::string& s : program.strings)
+    if (!r.string(s)) return truncated();
+
+  if (!r.count(count, 28)) return truncated();
+  program.functions.resize(count);
+  for (Function& fn : program.functions) {
+    if (!r.string(fn.name) || !r.u32(fn.params) || !r.u32(fn.results) ||
+        !r.u32(fn.registers) || !r.count(count, 8))
+      return truncated();
+    fn.constants.resize(count);
+    for (int64_t& constant : fn.constants)
+      if (!r.i64(constant)) return truncated();
+    if (!r.count(count, 4)) return truncated();
+    fn.calls.resize(count);
+    for (uint32_t& word : fn.calls)
+      if (!r.u32(word)) return truncated();
+    if (!r.count(count, 16)) return truncated();
+    fn.code.resize(count);
+    for (Instr& instr : fn.code) {
+      uint32_t op = 0;
+      if (!r.u32(op) || !r.u32(instr.a) || !r.u32(instr.b) || !r.u32(instr.c))
+        return truncated();
+      if (op >= kOpCount) {
+        error = path + ": unknown opcode " + std::to_string(op);
+        return false;
+      }
+      instr.op = static_cast<Op>(op);
+    }
+  }
+  if (!r.u32(program.entry)) return truncated();
+  if (!r.done()) {
+    error = path + " has trailing bytes";
+    return false;
+  }
+  return true;
+}
+
+std::string print(const Program& program) {
+  std::ostringstream out;
+  for (size_t i = 0; i < program.strings.size(); ++i)
+    out << ".str" << i << " = \"" << program.strings[i] << "\"\n";
+  if (!program.strings.empty()) out << "\n";
+
+  auto operand = [&](uint32_t value) {
+    if (value == kNone)
+      out << " -";
+    else
+      out << " " << value;
+  };
+  for (const Function& fn : program.functions) {
+    out << "func " << fn.name << " params=" << fn.params
+        << " registers=" << fn.registers << "\n";
+    for (size_t pc = 0; pc < fn.code.size(); ++pc) {
+      const Instr& instr = fn.code[pc];
+      out << "  " << pc << ": " << op_name(instr.op);
+      operand(instr.a);
+      operand(instr.b);
+      operand(instr.c);
+      if (instr.op == Op::Const) out << "  ; " << fn.constants[instr.b];
+      if (instr.op == Op::Call)
+        out << "  ; " << program.functions[instr.b].name;
+      out << "\n";
+    }
+    out << "\n";
+  }
+  return out.str();
+}
+
+}  // namespace vm
@@ -0,0 +1,315 @@
+#include "vm/vm.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+
+#include "log.hh"
+
+// Labels as values are a GNU extension; other compilers get a switch
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#if defined(__clang__)
+#pragma GCC diagnostic ignored "-Wgnu-label-as-value"
+#endif
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+namespace vm {
+
+namespace {
+
+// registers of all active frames, in 64-bit words
+constexpr size_t kMaxStack = size_t{1} << 24;
+
+struct Frame {
+  const Function* fn;
+  const Instr* pc;  // where to continue in the caller
+  size_t base;
+  uint32_t dst;
+  uint32_t dst2;
+};
+
+int32_t wrap32(uint64_t value) {
+  return static_cast<int32_t>(static_cast<uint32_t>(value));
+}
+
+}  // namespace
+
+bool run(const Program& program, int& exit_code) {
+  std::vector<Frame> frames;
+  std::vector<int64_t> stack(1024);
+
+  const Function* fn = &program.functions[program.entry];
+  const Instr* code = fn->code.data();
+  const Instr* pc = code;
+  const int64_t* constants = fn->constants.data();
+  size_t base = 0;
+  if (stack.size() < fn->registers) stack.resize(fn->registers);
+  int64_t* r = stack.data();
+
+  // the program writes to fd 1 through stdio, after what is buffered
+  std::cout.flush();
+
+  auto fail = [&](const char* message) {
+    std::fflush(stdout);
+    LOG_ERROR("[VM] {} in {} at {}", message, fn->name, pc - code);
+    return false;
+  };
+
+#if VM_COMPUTED_GOTO
+  static const void* const labels[] = {
+#define X(name) &&op_##name,
+      BYTECODE_OPS
+#undef X
+  };
+#define VM_CASE(name) op_##name:
+#define VM_NEXT() goto* labels[static_cast<uint8_t>(pc->op)]
+#define VM_DISPATCH() VM_NEXT();
+#else
+#define VM_CASE(name) case Op::name:
+#define VM_NEXT() continue
+#define VM_DISPATCH() \
+  for (;;)            \
+    switch (pc->op)
+#endif
+
+  VM_DISPATCH() {
+    VM_CASE(Const) {
+      r[pc->a] = constants[pc->b];
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Move) {
+      r[pc->a] = r[pc->b];
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Add32) {
+      r[pc->a] = wrap32(static_cast<uint64_t>(r[pc->b]) +
+                        static_cast<uint64_t>(r[pc->c]));
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Add64) {
+      r[pc->a] = static_cast<int64_t>(static_cast<uint64_t>(r[pc->b]) +
+                                      static_cast<uint64_t>(r[pc->c]));
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Sub32) {
+      r[pc->a] = wrap32(static_cast<uint64_t>(r[pc->b]) -
+                        static_cast<uint64_t>(r[pc->c]));
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Sub64) {
+      r[pc->a] = static_cast<int64_t>(static_cast<uint64_t>(r[pc->b]) -
+                                      static_cast<uint64_t>(r[pc->c]));
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Mul32) {
+      r[pc->a] = wrap32(static_cast<uint64_t>(r[pc->b]) *
+                        static_cast<uint64_t>(r[pc->c]));
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Mul64) {
+      r[pc->a] = static_cast<int64_t>(static_cast<uint64_t>(r[pc->b]) *
+                                      static_cast<uint64_t>(r[pc->c]));
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Div32) {
+      int32_t dividend = static_cast<int32_t>(r[pc->b]);
+      int32_t divisor = static_cast<int32_t>(r[pc->c]);
+      if (divisor == 0) return fail("division by zero");
+      if (divisor == -1 && dividend == std::numeric_limits<int32_t>::min())
+        return fail("division overflow");
+      r[pc->a] = dividend / divisor;
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Div64) {
+      int64_t dividend = r[pc->b];
+      int64_t divisor = r[pc->c];
+      if (divisor == 0) return fail("division by zero");
+      if (divisor == -1 && dividend == std::numeric_limits<int64_t>::min())
+        return fail("division overflow");
+      r[pc->a] = dividend / divisor;
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Neg32) {
+      r[pc->a] = wrap32(0 - static_cast<uint64_t>(r[pc->b]));
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Neg64) {
+      r[pc->a] = static_cast<int64_t>(0 - static_cast<uint64_t>(r[pc->b]));
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Shl32) {
+      r[pc->a] = wrap32(static_cast<uint64_t>(r[pc->b]) << pc->c);
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Shl64) {
+      r[pc->a] = static_cast<int64_t>(static_cast<uint64_t>(r[pc->b]) << pc->c);
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Sar32) {
+      r[pc->a] = static_cast<int32_t>(r[pc->b]) >> pc->c;
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Sar64) {
+      r[pc->a] = r[pc->b] >> pc->c;
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Shr32) {
+      r[pc->a] = wrap32(static_cast<uint32_t>(r[pc->b]) >> pc->c);
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Shr64) {
+      r[pc->a] = static_cast<int64_t>(static_cast<uint64_t>(r[pc->b]) >> pc->c);
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Sext) {
+      r[pc->a] = static_cast<int32_t>(r[pc->b]);
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Trunc) {
+      r[pc->a] = wrap32(static_cast<uint64_t>(r[pc->b]));
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Eq) {
+      r[pc->a] = r[pc->b] == r[pc->c];
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Ne) {
+      r[pc->a] = r[pc->b] != r[pc->c];
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Lt) {
+      r[pc->a] = r[pc->b] < r[pc->c];
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Le) {
+      r[pc->a] = r[pc->b] <= r[pc->c];
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Gt) {
+      r[pc->a] = r[pc->b] > r[pc->c];
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Ge) {
+      r[pc->a] = r[pc->b] >= r[pc->c];
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Select) {
+      if (r[pc->b] == 0) r[pc->a] = r[pc->c];
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(LoadByte) {
+      const auto* bytes = reinterpret_cast<const uint8_t*>(r[pc->b]);
+      r[pc->a] = bytes[r[pc->c]];
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(String) {
+      r[pc->a] = reinterpret_cast<int64_t>(program.strings[pc->b].data());
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Call) {
+      const Function* callee = &program.functions[pc->b];
+      const uint32_t* call = &fn->calls[pc->c];
+      const size_t callee_base = base + fn->registers;
+      if (callee_base + callee->registers > stack.size()) {
+        if (callee_base + callee->registers > kMaxStack)
+          return fail("call stack exhausted");
+        stack.resize(
+            std::min(kMaxStack, 2 * (callee_base + callee->registers)));
+        r = stack.data() + base;
+      }
+
+      int64_t* callee_r = stack.data() + callee_base;
+      for (uint32_t i = 0; i < call[0]; ++i) callee_r[i] = r[call[2 + i]];
+      frames.push_back({fn, pc + 1, base, pc->a, call[1]});
+
+      fn = callee;
+      code = fn->code.data();
+      pc = code;
+      constants = fn->constants.data();
+      base = callee_base;
+      r = callee_r;
+      VM_NEXT();
+    }
+    VM_CASE(Print) {
+      std::fwrite(reinterpret_cast<const char*>(r[pc->a]), 1,
+                  static_cast<size_t>(r[pc->b]), stdout);
+      ++pc;
+      VM_NEXT();
+    }
+    VM_CASE(Jump) {
+      pc = code + pc->a;
+      VM_NEXT();
+    }
+    VM_CASE(Branch) {
+      pc = code + (r[pc->a] != 0 ? pc->b : pc->c);
+      VM_NEXT();
+    }
+    VM_CASE(Ret) {
+      int64_t first = pc->a != kNone ? r[pc->a] : 0;
+      int64_t second = pc->b != kNone ? r[pc->b] : 0;
+      if (frames.empty()) {
+        std::fflush(stdout);
+        exit_code = static_cast<int>(first);
+        return true;
+      }
+
+      const Frame& frame = frames.back();
+      fn = frame.fn;
+      code = fn->code.data();
+      pc = frame.pc;
+      constants = fn->constants.data();
+      base = frame.base;
+      r = stack.data() + base;
+      if (frame.dst != kNone) r[frame.dst] = first;
+      if (frame.dst2 != kNone) r[frame.dst2] = second;
+      frames.pop_back();
+      VM_NEXT();
+    }
+  }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_DISPATCH
+  return false;
+}
+
+}  // namespace vm
+
+#if VM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
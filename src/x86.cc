@@ -0,0 +1,239 @@
+#include "x86.hh"
+
+#include <bit>
+#include <charconv>
+#include <cstdio>
+
+namespace x86 {
+
+const char* cond_name(Cond cc) {
+  switch (cc) {
+    case Cond::E:
+      return "e";
+    case Cond::NE:
+      return "ne";
+    case Cond::L:
+      return "l";
+    case Cond::GE:
+      return "ge";
+    case Cond::LE:
+      return "le";
+    case Cond::G:
+      return "g";
+  }
+  return "?";
+}
+
+static const char* mnemonic(Opcode op) {
+  switch (op) {
+    case Opcode::Label:
+      return "";
+    case Opcode::Mov:
+      return "mov";
+    case Opcode::Movzx:
+      return "movzx";
+    case Opcode::Movsxd:
+      return "movsxd";
+    case Opcode::Lea:
+      return "lea";
+    case Opcode::Add:
+      return "add";
+    case Opcode::Sub:
+      return "sub";
+    case Opcode::Imul:
+      return "imul";
+    case Opcode::Neg:
+      return "neg";
+    case Opcode::Shl:
+      return "shl";
+    case Opcode::Sar:
+      return "sar";
+    case Opcode::Shr:
+      return "shr";
+    case Opcode::Xor:
+      return "xor";
+    case Opcode::Cmp:
+      return "cmp";
+    case Opcode::Test:
+      return "test";
+    case Opcode::Setcc:
+      return "set";
+    case Opcode::Cmovcc:
+      return "cmov";
+    case Opcode::Cdq:
+      return "cdq";
+    case Opcode::Cqo:
+      return "cqo";
+    case Opcode::Idiv:
+      return "idiv";
+    case Opcode::Push:
+      return "push";
+    case Opcode::Pop:
+      return "pop";
+    case Opcode::Jmp:
+      return "jmp";
+    case Opcode::Jcc:
+      return "j";
+    case Opcode::Call:
+      return "call";
+    case Opcode::Ret:
+      return "ret";
+    case Opcode::Leave:
+      return "leave";
+    case Opcode::Syscall:
+      return "syscall";
+  }
+  return "?";
+}
+
+static void append_number(std::string& out, int64_t value) {
+  char digits[24];
+  auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+  out.append(digits, end);
+}
+
+static void append_label(std::string& out, const Program& program,
+                         uint32_t label) {
+  const Label& info = program.labels[label];
+  switch (info.kind) {
+    case Label::Kind::Symbol:
+      out += program.symbols[info.a];
+      return;
+    case Label::Kind::Literal:
+      out += ".LC";
+      append_number(out, info.a);
+      return;
+    case Label::Kind::Block:
+    case Label::Kind::Stub:
+      out += ".L";
+      append_number(out, info.a);
+      out += '_';
+      append_number(out, info.b);
+      if (info.kind == Label::Kind::Stub) {
+        out += '_';
+        append_number(out, info.c);
+      }
+      return;
+  }
+}
+
+std::string label_name(const Program& program, uint32_t label) {
+  std::string name;
+  append_label(name, program, label);
+  return name;
+}
+
+static const char* reg_name(Reg reg, uint8_t size) {
+  return size == 8 ? name64(reg) : size == 4 ? name32(reg) : name8(reg);
+}
+
+static void append_operand(std::string& out, const Program& program,
+                           const Operand& operand) {
+  switch (operand.kind) {
+    case Operand::Kind::None:
+      return;
+    case Operand::Kind::Reg:
+      out += reg_name(operand.reg, operand.size);
+      return;
+    case Operand::Kind::Imm:
+      append_number(out, operand.imm);
+      return;
+    case Operand::Kind::Label:
+      append_label(out, program, operand.label);
+      return;
+    case Operand::Kind::Mem:
+      break;
+  }
+
+  if (operand.size == 1) out += "BYTE PTR ";
+  if (operand.size == 4) out += "DWORD PTR ";
+  if (operand.size == 8) out += "QWORD PTR ";
+  out += '[';
+  if (operand.rip) {
+    out += "rip+";
+    append_label(out, program, operand.label);
+  } else {
+    out += name64(operand.reg);
+    if (operand.has_index) {
+      out += '+';
+      out += name64(operand.index);
+      if (operand.scale > 1) {
+        out += '*';
+        append_number(out, operand.scale);
+      }
+    }
+  }
+  if (operand.disp > 0) out += '+';
+  if (operand.disp != 0) append_number(out, operand.disp);
+  out += ']';
+}
+
+static void append_string_literal(std::string& out, const std::string& text) {
+  out += "    .ascii \"";
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += static_cast<char>(c);
+    } else if (c < 0x20 || c >= 0x7f) {
+      char escaped[5];
+      std::snprintf(escaped, sizeof(escaped), "\\%03o", c);
+      out += escaped;
+    } else {
+      out += static_cast<char>(c);
+    }
+  }
+  out += "\"\n    .byte 0\n";
+}
+
+std::string print(const Program& program) {
+  size_t size = 64 + 32 * program.text.size();
+  for (const std::string& text : program.strings) size += 32 + 4 * text.size();
+
+  std::string out;
+  out.reserve(size);
+  out += ".intel_syntax noprefix\n.section .text\n.global _start\n";
+
+  for (const Inst& inst : program.text) {
+    if (inst.op == Opcode::Label) {
+      if (program.labels[inst.dst.label].kind == Label::Kind::Symbol)
+        out += '\n';
+      if (inst.src.is_imm()) {
+        out += "    .p2align ";
+        append_number(out,
+                      std::countr_zero(static_cast<uint64_t>(inst.src.imm)));
+        out += ",,";
+        append_number(out, kMaxAlignPadding);
+        out += '\n';
+      }
+      append_label(out, program, inst.dst.label);
+      out += ":\n";
+      continue;
+    }
+
+    out += "    ";
+    out += mnemonic(inst.op);
+    if (inst.op == Opcode::Setcc || inst.op == Opcode::Cmovcc ||
+        inst.op == Opcode::Jcc)
+      out += cond_name(inst.cc);
+    if (inst.dst.kind != Operand::Kind::None) {
+      out += ' ';
+      append_operand(out, program, inst.dst);
+    }
+    if (inst.src.kind != Operand::Kind::None) {
+      out += ", ";
+      append_operand(out, program, inst.src);
+    }
+    out += '\n';
+  }
+
+  if (!program.strings.empty()) out += "\n.section .rodata\n";
+  for (size_t id = 0; id < program.strings.size(); ++id) {
+    out += ".LC";
+    append_number(out, static_cast<int64_t>(id));
+    out += ":\n";
+    append_string_literal(out, program.strings[id]);
+  }
+  return out;
+}
+
+}  // namespace x86
@@ -0,0 +1,135 @@
+#if __has_include(<catch2/catch_test_macros.hpp>)
+#include <catch2/catch_test_macros.hpp>
+#else
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#endif
+
+#include <sstream>
+#include <string>
+
+#include "context.hh"
+#include "lexer.hh"
+#include "parser.hh"
+#include "query.hh"
+#include "sema.hh"
+
+namespace {
+
+ProgramNode* parse(CompilerContext& ctx, const std::string& source) {
+  std::istringstream input(source);
+  Lexer lexer(input, ctx);
+  Parser parser(lexer, ctx);
+  return parser.parseProgram();
+}
+
+MethodDeclNode* find_method(ProgramNode& program, const std::string& name) {
+  for (auto& stmt : program.children)
+    if (auto* method = dynamic_cast<MethodDeclNode*>(stmt.get()))
+      if (method->identifier.getValue() == name) return method;
+  return nullptr;
+}
+
+const char* kProgram = R"(
+int helper(int x) {
+  return x + 1;
+}
+
+int other(int x) {
+  return x * 2;
+}
+
+int main() {
+  return helper(1) + other(2);
+}
+)";
+
+}  // namespace
+
+TEST_CASE("Invalidating an edited body only checks that body again",
+          "[query]") {
+  CompilerContext ctx;
+  std::unique_ptr<ProgramNode> program(parse(ctx, kProgram));
+  REQUIRE(program);
+
+  Sema sema(ctx);
+  REQUIRE(sema.analyze(*program));
+  QueryEngine& queries = sema.query_engine();
+  MethodDeclNode* helper = find_method(*program, "helper");
+  MethodDeclNode* main = find_method(*program, "main");
+  REQUIRE(helper);
+  REQUIRE(main);
+
+  // nothing is recomputed while every result is still cached
+  size_t before = queries.executed_count();
+  REQUIRE(queries.check_reachable(*main));
+  REQUIRE(queries.executed_count() == before);
+
+  // edit helper's body; nothing demands a body, so it is all that runs again
+  std::unique_ptr<ProgramNode> edit(
+      parse(ctx, "int helper(int x) { int y = x - 1; return y; }"));
+  REQUIRE(edit);
+  helper->body = std::move(find_method(*edit, "helper")->body);
+
+  queries.invalidate(QueryKind::Body, helper);
+  REQUIRE(queries.check_reachable(*main));
+  REQUIRE(queries.executed_count() == before + 1);
+}
+
+TEST_CASE("Invalidating a signature checks the bodies that demanded it",
+          "[query]") {
+  CompilerContext ctx;
+  std::unique_ptr<ProgramNode> program(parse(ctx, kProgram));
+  REQUIRE(program);
+
+  Sema sema(ctx);
+  REQUIRE(sema.analyze(*program));
+  QueryEngine& queries = sema.query_engine();
+  MethodDeclNode* helper = find_method(*program, "helper");
+  MethodDeclNode* other = find_method(*program, "other");
+  MethodDeclNode* main = find_method(*program, "main");
+
+  // helper's signature, its body and main's body, which resolved the call;
+  // other and the globals stay cached
+  size_t before = queries.executed_count();
+  queries.invalidate(QueryKind::Signature, helper);
+  REQUIRE(queries.check_reachable(*main));
+  REQUIRE(queries.executed_count() == before + 3);
+
+  REQUIRE(queries.body(*other));
+  REQUIRE(queries.globals());
+  REQUIRE(queries.executed_count() == before + 3);
+}
+
+TEST_CASE("Class layouts are recomputed after invalidation", "[query]") {
+  CompilerContext ctx;
+  QueryEngine queries(ctx);
+
+  uptr_vector<ClassMemberNode> members;
+  for (const Type* type :
+       {ctx.get_bool_type(), ctx.get_int32_type(), ctx.get_char_type()})
+    members.push_back(std::make_unique<FieldDeclNode>(
+        Token(TokenType::KW_ACCESS_MODIFIER, "public", SourceLocation()),
+        false, type, Token(), SourceLocation()));
+  ClassNode cls(Token(), std::move(members), SourceLocation());
+
+  const ClassLayout* layout = queries.layout(cls);
+  REQUIRE(layout);
+  REQUIRE(layout->fields.size() == 3);
+  REQUIRE(layout->fields[1].offset == 4);
+  REQUIRE(layout->fields[2].offset == 8);
+  REQUIRE(layout->size == 12);
+
+  // cached until the class is edited and invalidated
+  static_cast<FieldDeclNode&>(*cls.members[0]).declared_type =
+      ctx.get_int32_type();
+  size_t before = queries.executed_count();
+  REQUIRE(queries.layout(cls)->fields[1].offset == 4);
+  REQUIRE(queries.executed_count() == before);
+
+  queries.invalidate(QueryKind::ClassLayout, &cls);
+  layout = queries.layout(cls);
+  REQUIRE(queries.executed_count() == before + 1);
+  REQUIRE(layout->size == 12);
+  REQUIRE(layout->fields[0].type == ctx.get_int32_type());
+}